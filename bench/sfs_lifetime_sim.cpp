@@ -0,0 +1,336 @@
+// Host tool, replays a logging workload through sfs on the mock flash, counts
+// erases of every sector and projects how long the flash part lasts
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include "sfs/simple_file_system.h"
+    #include "flash_mock/flash_mock.h"
+}
+
+enum class Policy {
+    WHEN_FULL,  // Files grow over cycles, flash is reformatted when it is full
+    REFORMAT,   // Logs are downloaded and flash is reformatted after every cycle
+};
+
+struct FileLoad {
+    std::string name;
+    uint32_t record_size = 0;
+    double rate = 0;            // Records per second
+    uint32_t ring_sectors = 0;
+    double due = 0;             // Records owed to the current second
+    sfs_file_t file;
+};
+
+struct Workload {
+    uint32_t size_mb = 8;
+    uint32_t sector_kb = 4;
+    uint32_t endurance = 100000; // Erase cycles per sector from the datasheet
+    double cycle_seconds = 3600; // Logging time of one flight plus bench cycle
+    double cycles_per_day = 1;
+    uint32_t cycles = 10;       // Simulated cycles, lifetime is projected from them
+    Policy policy = Policy::WHEN_FULL;
+    std::vector<FileLoad> files;
+};
+
+// Counting device, flash content is kept only because mount reads headers back
+struct Counter {
+    flash_mock_t chip;
+    std::vector<uint32_t> erases;
+    uint64_t programmed = 0;
+    uint64_t programs = 0;
+};
+
+static bool count_erase(void *ctx, uint32_t sector) {
+    Counter *counter = (Counter *) ctx;
+    counter->erases[sector] += 1;
+    return flash_mock_erase_sector(&counter->chip, sector);
+}
+
+static int count_read(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    return flash_mock_read(&((Counter *) ctx)->chip, address, buffer, size);
+}
+
+static int count_write(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    Counter *counter = (Counter *) ctx;
+    counter->programmed += size;
+    counter->programs += 1;
+    return flash_mock_write(&counter->chip, address / counter->chip.sector_size_bytes,
+                            address % counter->chip.sector_size_bytes, buffer, size);
+}
+
+static void usage(const char *name) {
+    std::cerr << "Usage: " << name << " workload [cycles] [erase_counts.csv]" << std::endl
+              << "Workload lines, # starts a comment:" << std::endl
+              << "  flash <size_mb> <sector_kb>" << std::endl
+              << "  endurance <erase cycles per sector>" << std::endl
+              << "  cycle <logging seconds> <cycles per day>" << std::endl
+              << "  cycles <simulated cycles>" << std::endl
+              << "  policy when_full|reformat" << std::endl
+              << "  file <name> <record bytes> <records per second> [ring <sectors>]" << std::endl;
+}
+
+static bool parse_workload(const std::string &path, Workload *workload) {
+    std::ifstream input(path);
+    if (input.is_open() == false) {
+        std::cerr << path << ": can not open" << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (uint32_t number = 1; std::getline(input, line); ++number) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string key;
+        if (!(words >> key)) {
+            continue;
+        }
+
+        bool ok = true;
+        if (key == "flash") {
+            ok = static_cast<bool>(words >> workload->size_mb >> workload->sector_kb);
+        } else if (key == "endurance") {
+            ok = static_cast<bool>(words >> workload->endurance);
+        } else if (key == "cycle") {
+            ok = static_cast<bool>(words >> workload->cycle_seconds >> workload->cycles_per_day);
+        } else if (key == "cycles") {
+            ok = static_cast<bool>(words >> workload->cycles);
+        } else if (key == "policy") {
+            std::string policy;
+            ok = static_cast<bool>(words >> policy) && (policy == "when_full" || policy == "reformat");
+            workload->policy = policy == "reformat" ? Policy::REFORMAT : Policy::WHEN_FULL;
+        } else if (key == "file") {
+            FileLoad load;
+            std::string ring;
+            ok = static_cast<bool>(words >> load.name >> load.record_size >> load.rate) &&
+                 load.name.size() < MAX_FILE_NAME_SIZE && load.record_size > 0 && load.rate >= 0;
+            if (ok == true && words >> ring) {
+                ok = ring == "ring" && static_cast<bool>(words >> load.ring_sectors) && load.ring_sectors != 1;
+            }
+            workload->files.push_back(load);
+        } else {
+            ok = false;
+        }
+
+        if (ok == false) {
+            std::cerr << path << ":" << number << ": invalid line" << std::endl;
+            return false;
+        }
+    }
+
+    if (workload->files.empty() || workload->cycle_seconds <= 0 || workload->cycles_per_day <= 0) {
+        std::cerr << path << ": workload needs files and a cycle" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+struct Simulation {
+    Workload *workload;
+    Counter *counter;
+    sfs_config_t cfg;
+    sfs_t sfs;
+    uint64_t records = 0;
+    uint64_t user_bytes = 0;
+    uint32_t reformats = 0;
+    uint32_t full_events = 0;   // Flash filled up in the middle of a cycle
+};
+
+// Power on, files are opened as the logger does at boot
+static bool mount(Simulation *sim) {
+    if (sfs_init(&sim->sfs, &sim->cfg) != SFS_OK) {
+        return false;
+    }
+
+    for (FileLoad &load : sim->workload->files) {
+        sfs_file_config_t file_cfg = {};
+        file_cfg.ring_sectors = load.ring_sectors;
+        char name[MAX_FILE_NAME_SIZE] = {0};
+        (void) load.name.copy(name, sizeof(name) - 1);
+        if (sfs_open_ex(&sim->sfs, &load.file, name, &file_cfg) != SFS_OK) {
+            std::cerr << "open of " << load.name << " failed" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Erase every sector with data, as the ground station does after download
+static bool reformat(Simulation *sim) {
+    flash_mock_t *chip = &sim->counter->chip;
+    uint32_t sectors = chip->memory_size_bytes / chip->sector_size_bytes;
+    for (uint32_t sector = 0; sector < sectors; ++sector) {
+        if (chip->memory[sector * chip->sector_size_bytes] != 0xFF) {
+            (void) count_erase(sim->counter, sector);
+        }
+    }
+    sim->reformats += 1;
+
+    return mount(sim);
+}
+
+static bool run_cycle(Simulation *sim, uint8_t *payload) {
+    if (mount(sim) == false) {
+        return false;
+    }
+
+    uint32_t seconds = (uint32_t) std::ceil(sim->workload->cycle_seconds);
+    for (uint32_t second = 0; second < seconds; ++second) {
+        for (FileLoad &load : sim->workload->files) {
+            for (load.due += load.rate; load.due >= 1.0; load.due -= 1.0) {
+                sfs_err_t ret = sfs_write(&sim->sfs, &load.file, payload, load.record_size);
+                if (ret == SFS_FLASH_FULL) {
+                    sim->full_events += 1;
+                    if (reformat(sim) == false) {
+                        return false;
+                    }
+                    ret = sfs_write(&sim->sfs, &load.file, payload, load.record_size);
+                }
+                if (ret != SFS_OK) {
+                    std::cerr << "write to " << load.name << " failed " << ret << std::endl;
+                    return false;
+                }
+
+                sim->records += 1;
+                sim->user_bytes += load.record_size;
+            }
+        }
+    }
+
+    if (sim->workload->policy == Policy::REFORMAT) {
+        return reformat(sim);
+    }
+
+    return true;
+}
+
+template <typename T>
+static T percentile(std::vector<T> values, double p) {
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t) (p * (double) (values.size() - 1) + 0.5);
+    return values[index];
+}
+
+int main(int argc, char *argv[]) {
+    Workload workload;
+    if (argc < 2 || parse_workload(argv[1], &workload) == false) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (argc > 2) {
+        workload.cycles = (uint32_t) std::strtoul(argv[2], nullptr, 0);
+    }
+    if (workload.cycles == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Counter counter;
+    if (flash_mock_init(&counter.chip, (flash_mock_size_t) workload.size_mb, workload.sector_kb) == false) {
+        std::cerr << "unsupported flash geometry" << std::endl;
+        return 1;
+    }
+    uint32_t sectors = counter.chip.memory_size_bytes / counter.chip.sector_size_bytes;
+    counter.erases.assign(sectors, 0);
+
+    sfs_device_t device = {};
+    device.ctx = &counter;
+    device.erase_fnc = count_erase;
+    device.read_fnc = count_read;
+    device.write_fnc = count_write;
+
+    Simulation sim;
+    sim.workload = &workload;
+    sim.counter = &counter;
+    sim.cfg = {};
+    sim.cfg.flash_size_mb = workload.size_mb;
+    sim.cfg.flash_sector_kb = workload.sector_kb;
+    sim.cfg.devices = &device;
+    sim.cfg.device_count = 1;
+    // Reads are served from the mock memory and free sectors from RAM, as fast as sfs gets
+    sim.cfg.map_base = counter.chip.memory;
+    sfs_ram_usage_t ram;
+    (void) sfs_ram_usage(&sim.cfg, &ram);
+    std::vector<uint8_t> arena(ram.free_map);
+    sim.cfg.arena = arena.data();
+    sim.cfg.arena_size = arena.size();
+
+    uint32_t max_record = 0;
+    for (const FileLoad &load : workload.files) {
+        max_record = std::max(max_record, load.record_size);
+    }
+    // Content does not matter for wear, records are not kept
+    std::vector<uint8_t> payload(max_record, 0x5A);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t cycle = 0; cycle < workload.cycles; ++cycle) {
+        if (run_cycle(&sim, payload.data()) == false) {
+            std::cerr << "cycle " << cycle << " failed" << std::endl;
+            (void) flash_mock_deinit(&counter.chip);
+            return 1;
+        }
+    }
+    double host_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t erases = 0;
+    for (uint32_t count : counter.erases) {
+        erases += count;
+    }
+    double mean = (double) erases / sectors;
+    double variance = 0;
+    for (uint32_t count : counter.erases) {
+        variance += (count - mean) * (count - mean);
+    }
+    uint32_t max_erases = percentile(counter.erases, 1.0);
+    double sector_size = counter.chip.sector_size_bytes;
+    double sector_writes = (double) counter.programmed / sector_size;
+
+    std::cout << "Workload: " << workload.files.size() << " files, " << workload.cycle_seconds
+              << " s per cycle, " << workload.cycles_per_day << " cycles per day, "
+              << (workload.policy == Policy::REFORMAT ? "reformat after every cycle" : "reformat when full")
+              << std::endl;
+    std::cout << "Simulated " << workload.cycles << " cycles: " << sim.records << " records, "
+              << sim.user_bytes << " data bytes, " << sim.reformats << " reformats, "
+              << sim.full_events << " full during a cycle" << std::endl;
+    std::cout << "Erases per sector of " << sectors << ": min " << percentile(counter.erases, 0.0)
+              << " p50 " << percentile(counter.erases, 0.5) << " p90 " << percentile(counter.erases, 0.9)
+              << " p99 " << percentile(counter.erases, 0.99) << " max " << max_erases
+              << " mean " << mean << " stddev " << std::sqrt(variance / sectors) << std::endl;
+    if (sim.user_bytes > 0) {
+        std::cout << "Write amplification: programmed " << (double) counter.programmed / sim.user_bytes
+                  << ", erased " << (double) erases * sector_size / sim.user_bytes << std::endl;
+    }
+    if (max_erases > 0) {
+        // Hottest sector keeps wearing at the simulated pace
+        double cycles_left = (double) workload.endurance * workload.cycles / max_erases;
+        double leveled = (double) workload.endurance * workload.cycles / mean;
+        std::cout << "Projected: first sector reaches " << workload.endurance << " erases after "
+                  << cycles_left << " cycles, " << cycles_left / workload.cycles_per_day << " days ("
+                  << leveled / workload.cycles_per_day << " days with perfect leveling)" << std::endl;
+    } else {
+        std::cout << "Projected: no sector was erased, lifetime is not limited by this workload" << std::endl;
+    }
+    std::cout << "Host: " << host_seconds << " s, " << counter.programs / host_seconds << " programs/s, "
+              << sector_writes / host_seconds << " sectors programmed/s, "
+              << sim.records / host_seconds << " records/s" << std::endl;
+
+    if (argc > 3) {
+        std::ofstream csv(argv[3]);
+        csv << "sector,erases" << std::endl;
+        for (uint32_t sector = 0; sector < sectors; ++sector) {
+            csv << sector << "," << counter.erases[sector] << std::endl;
+        }
+    }
+
+    (void) flash_mock_deinit(&counter.chip);
+    return 0;
+}
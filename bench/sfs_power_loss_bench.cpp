@@ -0,0 +1,160 @@
+// Host tool, cuts power of the mock flash while a ring log is written,
+// mounts again and checks that every acknowledged record survived and no
+// damaged record is returned
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include "sfs/simple_file_system.h"
+    #include "flash_mock/flash_mock.h"
+}
+
+#include "test/power_loss_log.h"
+
+static bool device_erase(void *ctx, uint32_t sector) {
+    return flash_mock_erase_sector((flash_mock_t *) ctx, sector);
+}
+
+static int device_read(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    return flash_mock_read((flash_mock_t *) ctx, address, buffer, size);
+}
+
+static int device_write(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    flash_mock_t *dev = (flash_mock_t *) ctx;
+    return flash_mock_write(dev, address / dev->sector_size_bytes, address % dev->sector_size_bytes,
+                            buffer, size);
+}
+
+template <typename T>
+static T percentile(std::vector<T> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t) (p * (double) (values.size() - 1) + 0.5);
+    return values[index];
+}
+
+template <typename T>
+static void print_distribution(const char *name, const char *unit, const std::vector<T> &values) {
+    std::cout << "  " << name << " [" << unit << "]: p50 " << percentile(values, 0.5)
+              << " p90 " << percentile(values, 0.9) << " p99 " << percentile(values, 0.99)
+              << " max " << percentile(values, 1.0) << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t iterations = 2000;
+    uint32_t seed = 1;
+    uint32_t ring_sectors = 16;
+    if (argc > 1) {
+        iterations = (uint32_t) std::strtoul(argv[1], nullptr, 0);
+    }
+    if (argc > 2) {
+        seed = (uint32_t) std::strtoul(argv[2], nullptr, 0);
+    }
+    if (argc > 3) {
+        ring_sectors = (uint32_t) std::strtoul(argv[3], nullptr, 0);
+    }
+    if (iterations == 0 || ring_sectors < 2) {
+        std::cerr << "Usage: " << argv[0] << " [iterations] [seed] [ring sectors]" << std::endl;
+        return 1;
+    }
+
+    flash_mock_t chip;
+    if (flash_mock_init(&chip, SIZE_8MB, 4) == false) {
+        return 1;
+    }
+    // SPI NOR at tens of MHz, mount time is dominated by reads
+    chip.timing.read_ns_per_byte = 20;
+    chip.timing.program_ns_per_byte = 200;
+    chip.timing.erase_ns = 45000000;
+
+    sfs_device_t device = {};
+    device.ctx = &chip;
+    device.erase_fnc = device_erase;
+    device.read_fnc = device_read;
+    device.write_fnc = device_write;
+
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = &device;
+    cfg.device_count = 1;
+
+    char file_name[] = "log";
+    sfs_file_config_t file_cfg = {};
+    file_cfg.ring_sectors = ring_sectors;
+
+    std::vector<bool> acked;
+    std::vector<uint64_t> mount_ns;
+    std::vector<double> mount_us;
+    uint8_t data[CRASH_RECORD_MAX];
+    uint32_t passed = 0;
+    uint32_t failed = 0;
+    uint32_t errors = 0;
+    for (uint32_t crash = 0; crash <= iterations; ++crash) {
+        flash_mock_power_on(&chip);
+        sfs_t sfs;
+        sfs_file_t file;
+        uint64_t start_ns = chip.now_ns;
+        auto start = std::chrono::steady_clock::now();
+        sfs_err_t ret = sfs_init(&sfs, &cfg);
+        if (ret == SFS_OK) {
+            ret = sfs_open_ex(&sfs, &file, file_name, &file_cfg);
+        }
+        std::chrono::duration<double, std::micro> host = std::chrono::steady_clock::now() - start;
+        if (ret != SFS_OK) {
+            std::cerr << "crash " << crash << ": open failed " << ret << std::endl;
+            errors += 1;
+            break;
+        }
+        if (crash > 0) {
+            mount_ns.push_back(chip.now_ns - start_ns);
+            mount_us.push_back(host.count());
+        }
+
+        uint32_t records = 0;
+        if (crash_verify(&sfs, &file, acked, &records) == true) {
+            passed += 1;
+        } else {
+            std::cerr << "crash " << crash << ": records lost or damaged, " << records << " read" << std::endl;
+            failed += 1;
+        }
+        if (crash == iterations) {
+            break;
+        }
+
+        // Power is lost within the next few sectors, by bytes or by operations,
+        // also while a record continues after rollover
+        seed = seed * 1103515245 + 12345;
+        if (crash % 2 == 0) {
+            flash_mock_cut_power(&chip, seed % 12000, UINT32_MAX, seed);
+        } else {
+            flash_mock_cut_power(&chip, UINT32_MAX, seed % 160, seed);
+        }
+
+        ret = SFS_OK;
+        while (ret == SFS_OK) {
+            uint32_t index = acked.size();
+            ret = sfs_write(&sfs, &file, data, crash_record(index, data));
+            acked.push_back(ret == SFS_OK);
+        }
+    }
+
+    std::cout << "Power loss: " << iterations << " crashes, " << acked.size() << " writes, ring of "
+              << ring_sectors << " sectors" << std::endl;
+    std::cout << "  recovered " << passed << ", lost or damaged data " << failed << ", open errors " << errors
+              << std::endl;
+    std::cout << "Mount and open after crash" << std::endl;
+    print_distribution("flash time", "ns", mount_ns);
+    print_distribution("host time", "us", mount_us);
+
+    (void) flash_mock_deinit(&chip);
+    return failed == 0 && errors == 0 ? 0 : 1;
+}
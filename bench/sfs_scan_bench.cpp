@@ -0,0 +1,109 @@
+// Host tool, compares scan kernels with the byte loops they replaced
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include "sfs/sfs_scan.h"
+}
+
+static const uint32_t sector_size = 4096;
+static const uint8_t magic[] = {0x53, 0x46};
+
+static bool byte_equal(const uint8_t *a, const uint8_t *b, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static size_t byte_not_erased(const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] != 0xFF) {
+            return i;
+        }
+    }
+
+    return size;
+}
+
+static uint32_t byte_headers(const uint8_t *base, uint32_t count, uint8_t *matches) {
+    uint32_t found = 0;
+    memset(matches, 0, (count + 7) / 8);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (byte_equal(&base[i * sector_size], magic, sizeof(magic)) == true) {
+            matches[i / 8] |= 1U << (i % 8);
+            found += 1;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * @brief Run fnc until at least 100 ms passed and print throughput of bytes per call
+ */
+template <typename F>
+static void measure(const char *name, const char *kernel, size_t bytes, F fnc) {
+    using clock = std::chrono::steady_clock;
+    volatile size_t sink = 0;
+    uint64_t calls = 0;
+    auto start = clock::now();
+    std::chrono::duration<double> elapsed{0};
+    do {
+        for (int i = 0; i < 16; ++i) {
+            sink = sink + fnc();
+        }
+        calls += 16;
+        elapsed = clock::now() - start;
+    } while (elapsed.count() < 0.1);
+
+    double gbs = (double) bytes * (double) calls / elapsed.count() / 1e9;
+    std::cout << "  " << name << " [" << kernel << "]: " << gbs << " GB/s" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t sectors = 2048;
+    if (argc > 1) {
+        sectors = (uint32_t) std::strtoul(argv[1], nullptr, 0);
+    }
+    if (sectors < 2) {
+        std::cerr << "Usage: " << argv[0] << " [sectors]" << std::endl;
+        return 1;
+    }
+
+    // Every other sector holds a file, files are filled to half of the sector
+    std::vector<uint8_t> image((size_t) sectors * sector_size, 0xFF);
+    for (uint32_t i = 0; i < sectors; i += 2) {
+        uint8_t *sector = &image[(size_t) i * sector_size];
+        memcpy(sector, magic, sizeof(magic));
+        memset(&sector[64], 0x5A, sector_size / 2 - 64);
+    }
+    std::vector<uint8_t> matches((sectors + 7) / 8);
+    const uint8_t *erased = &image[sector_size];
+    std::vector<uint8_t> copy(erased, erased + sector_size);
+    const char *kernel = sfs_scan_kernel();
+
+    std::cout << "Erased check of " << sector_size << " B sector" << std::endl;
+    measure("byte loop", "scalar", sector_size, [&] { return byte_not_erased(erased, sector_size); });
+    measure("sfs_scan_not_erased", kernel, sector_size, [&] { return sfs_scan_not_erased(erased, sector_size); });
+
+    std::cout << "Compare of " << sector_size << " B buffers" << std::endl;
+    measure("byte loop", "scalar", sector_size, [&] { return byte_equal(erased, copy.data(), sector_size); });
+    measure("sfs_scan_equal", kernel, sector_size, [&] { return sfs_scan_equal(erased, copy.data(), sector_size); });
+
+    // Throughput relative to the mapped image size, which is what mount walks
+    std::cout << "Header magic of " << sectors << " sectors" << std::endl;
+    measure("byte loop", "scalar", image.size(), [&] { return byte_headers(image.data(), sectors, matches.data()); });
+    measure("sfs_scan_headers", kernel, image.size(), [&] {
+        return sfs_scan_headers(image.data(), sector_size, sectors, magic, sizeof(magic), matches.data());
+    });
+
+    return 0;
+}
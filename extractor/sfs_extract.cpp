@@ -0,0 +1,372 @@
+// Host tool, decodes every file from raw flash images
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+    #include "sfs/simple_file_system.h"
+}
+
+enum class OutputFormat {
+    RAW,
+    CSV,
+};
+
+struct Options {
+    std::vector<std::string> images;
+    std::string output_dir = ".";
+    uint32_t sector_kb = 4;
+    uint32_t threads = std::thread::hardware_concurrency();
+    OutputFormat format = OutputFormat::RAW;
+};
+
+struct Image {
+    std::string path;
+    std::string output_dir;
+    const uint8_t *memory = nullptr;
+    size_t size = 0;
+    sfs_t file_system;
+    // File sectors in chain order, used to skip corrupted data
+    std::map<std::string, std::vector<uint32_t>> file_sectors;
+};
+
+struct Task {
+    Image *image;
+    sfs_stat_t info;
+};
+
+struct Summary {
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> records{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> errors{0};
+};
+
+static std::mutex report_mutex;
+
+static void report(const std::string &image, const std::string &message) {
+    std::lock_guard<std::mutex> lock(report_mutex);
+    std::cerr << image << ": " << message << std::endl;
+}
+
+static void usage(const char *name) {
+    std::cerr << "Usage: " << name << " [-o output_dir] [-s sector_kb] [-j threads] [-f raw|csv] image..."
+              << std::endl;
+}
+
+static bool parse_options(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-o" && has_value) {
+            options->output_dir = argv[++i];
+        } else if (arg == "-s" && has_value) {
+            options->sector_kb = std::stoul(argv[++i]);
+        } else if (arg == "-j" && has_value) {
+            options->threads = std::stoul(argv[++i]);
+        } else if (arg == "-f" && has_value) {
+            std::string format = argv[++i];
+            if (format == "raw") {
+                options->format = OutputFormat::RAW;
+            } else if (format == "csv") {
+                options->format = OutputFormat::CSV;
+            } else {
+                return false;
+            }
+        } else if (arg.size() > 0 && arg[0] == '-') {
+            return false;
+        } else {
+            options->images.push_back(arg);
+        }
+    }
+
+    if (options->threads == 0) {
+        options->threads = 1;
+    }
+
+    return options->images.empty() == false && options->sector_kb > 0;
+}
+
+static std::string base_name(const std::string &path) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+static bool map_image(Image *image) {
+    int fd = open(image->path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        report(image->path, "can not open image");
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        report(image->path, "can not read image size");
+        close(fd);
+        return false;
+    }
+
+    void *memory = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        report(image->path, "mmap failed");
+        return false;
+    }
+
+    (void) madvise(memory, st.st_size, MADV_SEQUENTIAL);
+    image->memory = static_cast<const uint8_t*>(memory);
+    image->size = st.st_size;
+
+    return true;
+}
+
+/**
+ * @brief Mount image and find sectors of every file, report sectors which
+ * are neither erased nor valid file sectors and broken links
+ */
+static bool scan_image(Image *image, const Options &options, Summary *summary) {
+    uint32_t sector_size = KB_TO_BITS(options.sector_kb);
+    if (image->size % MB_TO_BITS(1) != 0 || image->size % sector_size != 0) {
+        report(image->path, "image size is not a multiple of 1 MB and sector size");
+        return false;
+    }
+
+    sfs_config_t cfg;
+    cfg.flash_size_mb = image->size / MB_TO_BITS(1);
+    cfg.flash_sector_kb = options.sector_kb;
+    cfg.erase_fnc = nullptr;
+    cfg.read_fnc = nullptr;
+    cfg.write_fnc = nullptr;
+    cfg.map_base = image->memory;
+    cfg.burst_buffer = nullptr;
+    cfg.burst_size = 0;
+    cfg.devices = nullptr;
+    cfg.device_count = 0;
+    cfg.io_scheduler = false;
+    cfg.arena = nullptr;
+    cfg.arena_size = 0;
+    cfg.retention = nullptr;
+    cfg.retention_size = 0;
+    cfg.partition_offset = 0;
+    cfg.partition_sectors = 0;
+
+    if (sfs_init(&image->file_system, &cfg) != SFS_OK || sfs_mount(&image->file_system) != SFS_OK) {
+        report(image->path, "mount failed");
+        return false;
+    }
+
+    std::map<std::string, std::vector<std::pair<uint64_t, uint32_t>>> ordered;
+    std::vector<sfs_sector_info_t> infos(image->size / sector_size);
+    for (uint32_t sector = 0; sector < infos.size(); ++sector) {
+        sfs_err_t ret = sfs_sector_info(&image->file_system, sector, &infos[sector]);
+        if (ret == SFS_OK) {
+            const sfs_sector_info_t &info = infos[sector];
+            // Sectors without sequence number go first in address order
+            uint64_t order = info.sequence == SFS_UNSET ? sector : ((uint64_t) 1 << 32) | info.sequence;
+            ordered[info.name].push_back(std::make_pair(order, sector));
+        } else if (image->memory[(size_t) sector * sector_size] != FLASH_NO_DATA) {
+            report(image->path, "sector " + std::to_string(sector) + " has invalid header, error " +
+                   std::to_string(ret));
+            summary->errors += 1;
+        }
+    }
+
+    for (auto &file : ordered) {
+        std::sort(file.second.begin(), file.second.end());
+        std::vector<uint32_t> &sectors = image->file_sectors[file.first];
+        for (size_t i = 0; i < file.second.size(); ++i) {
+            uint32_t sector = file.second[i].second;
+            sectors.push_back(sector);
+
+            uint32_t next = infos[sector].next_sector;
+            bool last = i + 1 == file.second.size();
+            if ((last == true && next != NO_NEXT_SECTOR) ||
+                (last == false && next != file.second[i + 1].second)) {
+                report(image->path, "file " + file.first + " sector " + std::to_string(sector) +
+                       " has broken link to " + std::to_string(next));
+                summary->errors += 1;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void write_record(FILE *out, OutputFormat format, uint64_t index, uint32_t address,
+                         const uint8_t *data, uint32_t size) {
+    if (format == OutputFormat::RAW) {
+        (void) fwrite(data, 1, size, out);
+        return;
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    std::string line = std::to_string(index) + "," + std::to_string(address) + "," +
+                       std::to_string(size) + ",";
+    line.reserve(line.size() + size * 2 + 1);
+    for (uint32_t i = 0; i < size; ++i) {
+        line.push_back(hex[data[i] >> 4]);
+        line.push_back(hex[data[i] & 0xF]);
+    }
+    line.push_back('\n');
+    (void) fwrite(line.data(), 1, line.size(), out);
+}
+
+/**
+ * @brief Decode one file, on corrupted data continue from the next sector
+ */
+static void extract_file(Task *task, const Options &options, Summary *summary) {
+    Image *image = task->image;
+    std::string name = task->info.name;
+    std::string path = image->output_dir + "/" + name +
+                       (options.format == OutputFormat::RAW ? ".bin" : ".csv");
+
+    FILE *out = fopen(path.c_str(), "wb");
+    if (out == nullptr) {
+        report(image->path, "can not create " + path);
+        summary->errors += 1;
+        return;
+    }
+
+    std::vector<char> out_buffer(1 << 20);
+    (void) setvbuf(out, out_buffer.data(), _IOFBF, out_buffer.size());
+    if (options.format == OutputFormat::CSV) {
+        (void) fputs("record,address,size,data\n", out);
+    }
+
+    // Every worker has own copy, reads do not modify shared state
+    std::unique_ptr<sfs_t> file_system(new sfs_t(image->file_system));
+    sfs_file_t file;
+    sfs_file_config_t cfg = {};
+    cfg.flags = SFS_OPEN_NO_CREATE;
+    if (sfs_open_ex(file_system.get(), &file, &name[0], &cfg) != SFS_OK) {
+        report(image->path, "can not open file " + name);
+        summary->errors += 1;
+        fclose(out);
+        return;
+    }
+
+    const std::vector<uint32_t> &sectors = image->file_sectors[name];
+    std::vector<uint8_t> buffer(4096);
+    uint64_t index = 0;
+    while (true) {
+        uint32_t size = 0;
+        uint32_t address = file.address_pointer;
+        sfs_err_t ret = sfs_read_record(file_system.get(), &file, buffer.data(), buffer.size(), &size);
+        if (ret == SFS_BUFFER_SIZE) {
+            buffer.resize(size);
+            continue;
+        }
+
+        if (ret == SFS_EOF) {
+            break;
+        }
+
+        if (ret != SFS_OK) {
+            report(image->path, "file " + name + " corrupted at address " + std::to_string(address) +
+                   ", error " + std::to_string(ret));
+            summary->errors += 1;
+
+            // Resume at the first sector after the damaged one
+            uint32_t sector = address / file_system->flash_sector_bits;
+            auto it = std::find(sectors.begin(), sectors.end(), sector);
+            if (it == sectors.end() || it + 1 == sectors.end() ||
+                sfs_seek_sector(file_system.get(), &file, *(it + 1)) != SFS_OK) {
+                break;
+            }
+            continue;
+        }
+
+        write_record(out, options.format, index, address, buffer.data(), size);
+        index += 1;
+        summary->records += 1;
+        summary->bytes += size;
+    }
+
+    fclose(out);
+    summary->files += 1;
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (parse_options(argc, argv, &options) == false) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Summary summary;
+    std::vector<std::unique_ptr<Image>> images;
+    std::vector<Task> tasks;
+    for (const std::string &path : options.images) {
+        std::unique_ptr<Image> image(new Image());
+        image->path = path;
+        image->output_dir = options.output_dir + "/" + base_name(path);
+        if (map_image(image.get()) == false || scan_image(image.get(), options, &summary) == false) {
+            summary.errors += 1;
+            continue;
+        }
+
+        (void) mkdir(options.output_dir.c_str(), 0755);
+        (void) mkdir(image->output_dir.c_str(), 0755);
+
+        sfs_dir_t dir;
+        Task task;
+        task.image = image.get();
+        (void) sfs_opendir(&image->file_system, &dir);
+        while (sfs_readdir(&image->file_system, &dir, &task.info) == SFS_OK) {
+            tasks.push_back(task);
+        }
+
+        images.push_back(std::move(image));
+    }
+
+    // Largest files first, so workers finish at the same time
+    std::sort(tasks.begin(), tasks.end(), [](const Task &a, const Task &b) {
+        return a.info.size > b.info.size;
+    });
+
+    std::atomic<size_t> next_task{0};
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < options.threads; ++i) {
+        workers.emplace_back([&]() {
+            size_t task;
+            while ((task = next_task.fetch_add(1)) < tasks.size()) {
+                extract_file(&tasks[task], options, &summary);
+            }
+        });
+    }
+
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    for (const std::unique_ptr<Image> &image : images) {
+        (void) munmap(const_cast<uint8_t*>(image->memory), image->size);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "images: " << images.size() << " files: " << summary.files
+              << " records: " << summary.records << " bytes: " << summary.bytes
+              << " errors: " << summary.errors << " time: " << seconds << " s";
+    if (seconds > 0) {
+        std::cout << " (" << summary.bytes / seconds / MB_TO_BITS(1) << " MB/s)";
+    }
+    std::cout << std::endl;
+
+    return summary.errors == 0 ? 0 : 2;
+}
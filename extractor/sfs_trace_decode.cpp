@@ -0,0 +1,81 @@
+// Host tool, decodes sfs trace ring from RAM dump of the firmware
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include "sfs/simple_file_system.h"
+}
+
+static void usage(const char *name) {
+    std::cerr << "Usage: " << name << " <ram dump>" << std::endl;
+    std::cerr << "  Dump has to contain sfs_trace_t, e.g. memory of sfs_trace_get()" << std::endl;
+}
+
+static uint32_t read_u32(const uint8_t *bytes) {
+    uint32_t value;
+    (void) memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Find ring header in dump, ring is 4 byte aligned in RAM
+ */
+static bool find_ring(const std::vector<uint8_t> &dump, size_t *offset, uint32_t *entries) {
+    const size_t header_size = offsetof(sfs_trace_t, ring);
+    for (size_t i = 0; i + header_size <= dump.size(); i += 4) {
+        if (read_u32(&dump[i]) != SFS_TRACE_MAGIC) {
+            continue;
+        }
+
+        uint32_t count = read_u32(&dump[i + offsetof(sfs_trace_t, entries)]);
+        bool power_of_2 = count != 0 && (count & (count - 1)) == 0;
+        if (power_of_2 == true && i + header_size + count * sizeof(sfs_trace_entry_t) <= dump.size()) {
+            *offset = i;
+            *entries = count;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::ifstream input(argv[1], std::ios::binary);
+    if (input.is_open() == false) {
+        std::cerr << "Can not open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> dump((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    size_t offset = 0;
+    uint32_t entries = 0;
+    if (find_ring(dump, &offset, &entries) == false) {
+        std::cerr << "No trace ring in " << argv[1] << std::endl;
+        return 1;
+    }
+
+    uint32_t head = read_u32(&dump[offset + offsetof(sfs_trace_t, head)]);
+    uint32_t first = head > entries ? head - entries : 0;
+    const uint8_t *ring = &dump[offset + offsetof(sfs_trace_t, ring)];
+    if (first > 0) {
+        std::cout << "# " << first << " older events overwritten" << std::endl;
+    }
+
+    for (uint32_t i = first; i < head; ++i) {
+        sfs_trace_entry_t entry;
+        (void) memcpy(&entry, &ring[(i & (entries - 1)) * sizeof(entry)], sizeof(entry));
+        std::cout << i << "\t" << entry.timestamp << "\t" << sfs_trace_event_name(entry.event)
+                  << "\t" << entry.args[0] << "\t" << entry.args[1] << std::endl;
+    }
+
+    return 0;
+}
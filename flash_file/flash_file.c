@@ -0,0 +1,295 @@
+#include "flash_file.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ERASED_BYTE 0xFF
+#define FILL_CHUNK 4096U
+
+static bool pread_all(int fd, uint8_t *data, uint32_t size, uint32_t offset) {
+    while (size > 0) {
+        ssize_t done = pread(fd, data, size, offset);
+        if (done <= 0) {
+            return false;
+        }
+
+        data += done;
+        size -= (uint32_t) done;
+        offset += (uint32_t) done;
+    }
+
+    return true;
+}
+
+static bool pwrite_all(int fd, const uint8_t *data, uint32_t size, uint32_t offset) {
+    while (size > 0) {
+        ssize_t done = pwrite(fd, data, size, offset);
+        if (done <= 0) {
+            return false;
+        }
+
+        data += done;
+        size -= (uint32_t) done;
+        offset += (uint32_t) done;
+    }
+
+    return true;
+}
+
+// Image shorter than flash is extended with erased bytes
+static bool fill_erased(int fd, uint32_t from, uint32_t to) {
+    uint8_t erased[FILL_CHUNK];
+    (void) memset(erased, ERASED_BYTE, sizeof(erased));
+    while (from < to) {
+        uint32_t size = to - from < FILL_CHUNK ? to - from : FILL_CHUNK;
+        if (pwrite_all(fd, erased, size, from) == false) {
+            return false;
+        }
+        from += size;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Open or create flash image
+ *
+ * @param dev
+ * @param path image file, created if it does not exist
+ * @param mode
+ * @param size_bytes flash size, 0 to use size of existing image
+ * @param sector_size_bytes
+ * @return true on success
+ */
+bool flash_file_open(flash_file_t *dev, const char *path, flash_file_mode_t mode,
+                     uint32_t size_bytes, uint32_t sector_size_bytes) {
+    if (dev == NULL || path == NULL || sector_size_bytes == 0) {
+        return false;
+    }
+
+    dev->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (dev->fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(dev->fd, &st) != 0) {
+        (void) close(dev->fd);
+        return false;
+    }
+
+    if (size_bytes == 0) {
+        size_bytes = (uint32_t) st.st_size;
+    }
+
+    if (size_bytes == 0 || size_bytes % sector_size_bytes != 0 ||
+        ((uint64_t) st.st_size < size_bytes && fill_erased(dev->fd, (uint32_t) st.st_size, size_bytes) == false)) {
+        (void) close(dev->fd);
+        return false;
+    }
+
+    dev->mode = mode;
+    dev->memory_size_bytes = size_bytes;
+    dev->sector_size_bytes = sector_size_bytes;
+    dev->memory = NULL;
+    dev->cache = NULL;
+    dev->cache_sector = -1;
+    dev->cache_dirty = false;
+
+    if (mode == FLASH_FILE_MMAP) {
+        void *memory = mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
+        if (memory == MAP_FAILED) {
+            (void) close(dev->fd);
+            return false;
+        }
+        dev->memory = (uint8_t *) memory;
+    } else {
+        dev->cache = (uint8_t *) malloc(sector_size_bytes);
+        if (dev->cache == NULL) {
+            (void) close(dev->fd);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool cache_flush(flash_file_t *dev) {
+    if (dev->cache_dirty == false) {
+        return true;
+    }
+
+    dev->cache_dirty = false;
+    return pwrite_all(dev->fd, dev->cache, dev->sector_size_bytes,
+                      (uint32_t) dev->cache_sector * dev->sector_size_bytes);
+}
+
+static bool cache_load(flash_file_t *dev, uint32_t sector) {
+    if (dev->cache_sector == (int32_t) sector) {
+        return true;
+    }
+
+    if (cache_flush(dev) == false) {
+        return false;
+    }
+
+    dev->cache_sector = -1;
+    if (pread_all(dev->fd, dev->cache, dev->sector_size_bytes, sector * dev->sector_size_bytes) == false) {
+        return false;
+    }
+    dev->cache_sector = (int32_t) sector;
+
+    return true;
+}
+
+static bool in_range(flash_file_t *dev, uint32_t address, uint32_t size) {
+    return address <= dev->memory_size_bytes && size <= dev->memory_size_bytes - address;
+}
+
+/**
+ * @brief Program bytes, bits are only cleared, in pread mode sector is written
+ * back when other sector is programmed or on sync
+ *
+ * @return int programmed bytes, -1 on error
+ */
+int flash_file_write(flash_file_t *dev, uint32_t address, const uint8_t *data, uint32_t size) {
+    if (dev == NULL || data == NULL || in_range(dev, address, size) == false) {
+        return -1;
+    }
+
+    if (dev->mode == FLASH_FILE_MMAP) {
+        for (uint32_t i = 0; i < size; ++i) {
+            dev->memory[address + i] &= data[i];
+        }
+        return (int) size;
+    }
+
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t sector = (address + done) / dev->sector_size_bytes;
+        uint32_t offset = (address + done) % dev->sector_size_bytes;
+        uint32_t chunk = dev->sector_size_bytes - offset;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+
+        if (cache_load(dev, sector) == false) {
+            return -1;
+        }
+
+        for (uint32_t i = 0; i < chunk; ++i) {
+            dev->cache[offset + i] &= data[done + i];
+        }
+        dev->cache_dirty = true;
+        done += chunk;
+    }
+
+    return (int) size;
+}
+
+/**
+ * @return int read bytes, -1 on error
+ */
+int flash_file_read(flash_file_t *dev, uint32_t address, uint8_t *data, uint32_t size) {
+    if (dev == NULL || data == NULL || in_range(dev, address, size) == false) {
+        return -1;
+    }
+
+    if (dev->mode == FLASH_FILE_MMAP) {
+        (void) memcpy(data, dev->memory + address, size);
+        return (int) size;
+    }
+
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t sector = (address + done) / dev->sector_size_bytes;
+        uint32_t offset = (address + done) % dev->sector_size_bytes;
+        uint32_t chunk = dev->sector_size_bytes - offset;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+
+        if (dev->cache_sector == (int32_t) sector) {
+            (void) memcpy(&data[done], &dev->cache[offset], chunk);
+        } else if (pread_all(dev->fd, &data[done], chunk, address + done) == false) {
+            return -1;
+        }
+        done += chunk;
+    }
+
+    return (int) size;
+}
+
+/**
+ * @brief Erase sector, in pread mode erased sector becomes the cached one,
+ * so following programs are written together with the erase
+ */
+bool flash_file_erase_sector(flash_file_t *dev, uint32_t sector) {
+    if (dev == NULL || sector >= dev->memory_size_bytes / dev->sector_size_bytes) {
+        return false;
+    }
+
+    if (dev->mode == FLASH_FILE_MMAP) {
+        (void) memset(dev->memory + sector * dev->sector_size_bytes, ERASED_BYTE, dev->sector_size_bytes);
+        return true;
+    }
+
+    if (dev->cache_sector != (int32_t) sector && cache_flush(dev) == false) {
+        return false;
+    }
+
+    (void) memset(dev->cache, ERASED_BYTE, dev->sector_size_bytes);
+    dev->cache_sector = (int32_t) sector;
+    dev->cache_dirty = true;
+
+    return true;
+}
+
+/**
+ * @brief Write pending programs and flush image to disk, msync in mmap mode
+ */
+bool flash_file_sync(flash_file_t *dev) {
+    if (dev == NULL) {
+        return false;
+    }
+
+    if (dev->mode == FLASH_FILE_MMAP) {
+        return msync(dev->memory, dev->memory_size_bytes, MS_SYNC) == 0;
+    }
+
+    return cache_flush(dev) == true && fsync(dev->fd) == 0;
+}
+
+bool flash_file_close(flash_file_t *dev) {
+    if (dev == NULL || dev->fd < 0) {
+        return false;
+    }
+
+    bool synced = flash_file_sync(dev);
+    if (dev->memory != NULL) {
+        (void) munmap(dev->memory, dev->memory_size_bytes);
+        dev->memory = NULL;
+    }
+    free(dev->cache);
+    dev->cache = NULL;
+    (void) close(dev->fd);
+    dev->fd = -1;
+
+    return synced;
+}
+
+bool flash_file_device_erase(void *ctx, uint32_t sector) {
+    return flash_file_erase_sector((flash_file_t *) ctx, sector);
+}
+
+int flash_file_device_read(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    return flash_file_read((flash_file_t *) ctx, address, buffer, size);
+}
+
+int flash_file_device_write(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    return flash_file_write((flash_file_t *) ctx, address, buffer, size);
+}
@@ -0,0 +1,40 @@
+#ifndef __FLASH_FILE_H_
+#define __FLASH_FILE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Host flash backed by image file, e.g. dump of device flash. Programs
+// clear bits only (NOR AND semantics), erase sets sector to 0xFF.
+
+typedef enum {
+    FLASH_FILE_MMAP = 0,    // Image mapped into memory, memory can be used as map_base of sfs
+    FLASH_FILE_PREAD,       // pread/pwrite, programs are collected in sector cache
+} flash_file_mode_t;
+
+typedef struct {
+    int fd;
+    flash_file_mode_t mode;
+    uint32_t memory_size_bytes;
+    uint32_t sector_size_bytes;
+    uint8_t *memory;        // Mapped image, NULL in FLASH_FILE_PREAD mode
+
+    uint8_t *cache;         // Content of one sector with pending programs, FLASH_FILE_PREAD mode
+    int32_t cache_sector;   // -1 if cache is empty
+    bool cache_dirty;
+} flash_file_t;
+
+bool flash_file_open(flash_file_t *dev, const char *path, flash_file_mode_t mode,
+                     uint32_t size_bytes, uint32_t sector_size_bytes);
+int flash_file_write(flash_file_t *dev, uint32_t address, const uint8_t *data, uint32_t size);
+int flash_file_read(flash_file_t *dev, uint32_t address, uint8_t *data, uint32_t size);
+bool flash_file_erase_sector(flash_file_t *dev, uint32_t sector);
+bool flash_file_sync(flash_file_t *dev);
+bool flash_file_close(flash_file_t *dev);
+
+// sfs_device_t callbacks, ctx is flash_file_t
+bool flash_file_device_erase(void *ctx, uint32_t sector);
+int flash_file_device_read(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size);
+int flash_file_device_write(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size);
+
+#endif
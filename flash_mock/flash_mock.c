@@ -25,10 +25,72 @@ bool flash_mock_init(flash_mock_t *dev, flash_mock_size_t size, uint32_t sector_
     }
 
     (void) memset(dev->memory, ERASED_BYTE, dev->memory_size_bytes);
+    (void) memset(&dev->timing, 0, sizeof(dev->timing));
+    dev->now_ns = 0;
+    dev->busy_until_ns = 0;
+    dev->remaining_ns = 0;
+    dev->suspended = false;
+    flash_mock_power_on(dev);
 
     return true;
 }
 
+// Operation issued during running erase waits for its end
+static void mock_wait(flash_mock_t *dev) {
+    if (dev->suspended == false && dev->now_ns < dev->busy_until_ns) {
+        dev->now_ns = dev->busy_until_ns;
+    }
+}
+
+/**
+ * @brief Lose power after given number of programmed bytes or started
+ * operations, whichever comes first, program in progress is torn: bytes
+ * before the cut are programmed, the next one only partly, the rest stays,
+ * erase in progress does not start
+ *
+ * @param dev
+ * @param bytes
+ * @param ops
+ * @param seed random bits of the torn byte
+ */
+void flash_mock_cut_power(flash_mock_t *dev, uint32_t bytes, uint32_t ops, uint32_t seed) {
+    dev->cut_armed = true;
+    dev->cut_bytes = bytes;
+    dev->cut_ops = ops;
+    dev->cut_seed = seed != 0 ? seed : 1;
+}
+
+// Flash is powered again, e.g. after reboot of the application
+void flash_mock_power_on(flash_mock_t *dev) {
+    dev->cut_armed = false;
+    dev->power_lost = false;
+}
+
+// Operation is allowed to start, false if power is lost before it
+static bool mock_power_op(flash_mock_t *dev) {
+    if (dev->power_lost == true) {
+        return false;
+    }
+
+    if (dev->cut_armed == true) {
+        if (dev->cut_ops == 0) {
+            dev->power_lost = true;
+            return false;
+        }
+        dev->cut_ops -= 1;
+    }
+
+    return true;
+}
+
+static uint8_t mock_torn_bits(flash_mock_t *dev) {
+    // xorshift32
+    dev->cut_seed ^= dev->cut_seed << 13;
+    dev->cut_seed ^= dev->cut_seed >> 17;
+    dev->cut_seed ^= dev->cut_seed << 5;
+    return dev->cut_seed & 0xFF;
+}
+
 
 int flash_mock_write(flash_mock_t *dev, uint32_t sector, uint32_t addr, uint8_t *data, uint32_t size) {
     if (dev == NULL || dev->memory == NULL) {
@@ -51,6 +113,30 @@ int flash_mock_write(flash_mock_t *dev, uint32_t sector, uint32_t addr, uint8_t
         size = dev->memory_size_bytes - data_start_address;
     }
 
+    if (mock_power_op(dev) == false) {
+        return -1;
+    }
+
+    uint32_t torn = size;
+    if (dev->cut_armed == true && size > dev->cut_bytes) {
+        torn = dev->cut_bytes;
+    } else if (dev->cut_armed == true) {
+        dev->cut_bytes -= size;
+    }
+
+    if (torn < size) {
+        for (uint32_t i = 0; i < torn; ++i) {
+            dev->memory[data_start_address + i] &= data[i];
+        }
+        // Bits of the last byte are programmed at random
+        dev->memory[data_start_address + torn] &= data[torn] | mock_torn_bits(dev);
+        dev->power_lost = true;
+        return -1;
+    }
+
+    mock_wait(dev);
+    dev->now_ns += (uint64_t) size * dev->timing.program_ns_per_byte;
+
     int ret = 0;
     for (uint32_t i = 0; i < size; ++i) {
         if (i < dev->memory_size_bytes) {
@@ -76,6 +162,8 @@ int flash_mock_read(flash_mock_t *dev, uint32_t addr, uint8_t *data, uint32_t si
         size = dev->memory_size_bytes - addr - 1; // Minus one to start from 0
     }
 
+    mock_wait(dev);
+    dev->now_ns += (uint64_t) size * dev->timing.read_ns_per_byte;
     memcpy(data, dev->memory + addr, size);
 
     return size;
@@ -90,12 +178,76 @@ bool flash_mock_erase_sector(flash_mock_t * dev, uint32_t sector) {
         return false;
     }
 
+    if (mock_power_op(dev) == false) {
+        return false;
+    }
+
+    mock_wait(dev);
+    dev->now_ns += dev->timing.erase_ns;
     (void) memset(dev->memory + dev->sector_size_bytes * sector,
                     ERASED_BYTE, dev->sector_size_bytes);
     
     return true;
 }
 
+/**
+ * @brief Start erase and return, content is erased at once,
+ * device is busy for erase time
+ */
+bool flash_mock_erase_start(flash_mock_t *dev, uint32_t sector) {
+    if (dev == NULL || dev->memory == NULL) {
+        return false;
+    }
+
+    if (sector >= dev->memory_size_bytes / dev->sector_size_bytes || dev->suspended == true) {
+        return false;
+    }
+
+    if (mock_power_op(dev) == false) {
+        return false;
+    }
+
+    mock_wait(dev);
+    (void) memset(dev->memory + dev->sector_size_bytes * sector,
+                    ERASED_BYTE, dev->sector_size_bytes);
+    dev->busy_until_ns = dev->now_ns + dev->timing.erase_ns;
+
+    return true;
+}
+
+bool flash_mock_busy(flash_mock_t *dev) {
+    dev->now_ns += dev->timing.status_ns;
+    return dev->suspended == false && dev->now_ns < dev->busy_until_ns;
+}
+
+bool flash_mock_suspend(flash_mock_t *dev) {
+    if (dev->suspended == true || dev->now_ns >= dev->busy_until_ns) {
+        return false;
+    }
+
+    dev->now_ns += dev->timing.suspend_ns;
+    dev->remaining_ns = dev->busy_until_ns > dev->now_ns ? dev->busy_until_ns - dev->now_ns : 0;
+    dev->suspended = true;
+
+    return true;
+}
+
+bool flash_mock_resume(flash_mock_t *dev) {
+    if (dev->suspended == false) {
+        return false;
+    }
+
+    dev->busy_until_ns = dev->now_ns + dev->remaining_ns;
+    dev->suspended = false;
+
+    return true;
+}
+
+// Idle time of the application
+void flash_mock_advance(flash_mock_t *dev, uint64_t ns) {
+    dev->now_ns += ns;
+}
+
 bool flash_mock_deinit(flash_mock_t *dev) {
     if (dev == NULL || dev->memory == NULL) {
         return false;
@@ -15,16 +15,45 @@ typedef enum {
     SIZE_16MB = 16
 } flash_mock_size_t;
 
+// Timing model, every operation moves virtual clock, zero by default
+typedef struct {
+    uint32_t read_ns_per_byte;
+    uint32_t program_ns_per_byte;
+    uint32_t erase_ns;
+    uint32_t suspend_ns;    // Latency of erase suspend command
+    uint32_t status_ns;     // Status register poll
+} flash_mock_timing_t;
+
 typedef struct {
     uint32_t memory_size_bytes;
     uint32_t sector_size_bytes;
     uint8_t* memory;
+
+    flash_mock_timing_t timing;
+    uint64_t now_ns;
+    uint64_t busy_until_ns; // End of erase started with flash_mock_erase_start
+    uint64_t remaining_ns;  // Erase time left while suspended
+    bool suspended;
+
+    // Power loss injection, see flash_mock_cut_power
+    bool cut_armed;
+    uint32_t cut_bytes;     // Bytes programmed before power is lost
+    uint32_t cut_ops;       // Program and erase operations started before power is lost
+    uint32_t cut_seed;      // Random bits of torn byte
+    bool power_lost;        // Programs and erases fail until flash_mock_power_on
 } flash_mock_t;
 
 bool flash_mock_init(flash_mock_t *dev, flash_mock_size_t size, uint32_t sector_size_kb);
 int flash_mock_write(flash_mock_t *dev, uint32_t sector, uint32_t addr, uint8_t *data, uint32_t size);
 int flash_mock_read(flash_mock_t *dev, uint32_t addr, uint8_t *data, uint32_t size);
 bool flash_mock_erase_sector(flash_mock_t *dev, uint32_t ssector);
+bool flash_mock_erase_start(flash_mock_t *dev, uint32_t sector);
+bool flash_mock_busy(flash_mock_t *dev);
+bool flash_mock_suspend(flash_mock_t *dev);
+bool flash_mock_resume(flash_mock_t *dev);
+void flash_mock_advance(flash_mock_t *dev, uint64_t ns);
+void flash_mock_cut_power(flash_mock_t *dev, uint32_t bytes, uint32_t ops, uint32_t seed);
+void flash_mock_power_on(flash_mock_t *dev);
 bool flash_mock_deinit(flash_mock_t *dev);
 
 
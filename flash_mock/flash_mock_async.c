@@ -0,0 +1,202 @@
+#include <sched.h>
+#include <unistd.h>
+#include "flash_mock_async.h"
+
+static int mock_transfer(flash_mock_t *dev, uint8_t op, uint32_t address, uint8_t *buffer, uint32_t size) {
+    if (op == FLASH_MOCK_READ) {
+        return flash_mock_read(dev, address, buffer, size);
+    }
+
+    return flash_mock_write(dev, address / dev->sector_size_bytes, address % dev->sector_size_bytes,
+                            buffer, size);
+}
+
+static void *mock_worker(void *arg) {
+    flash_mock_async_t *async = (flash_mock_async_t *) arg;
+    (void) pthread_mutex_lock(&async->lock);
+    while (async->stop == false) {
+        if (async->executed == async->tail) {
+            (void) pthread_cond_wait(&async->wake, &async->lock);
+            continue;
+        }
+
+        // Transfer takes time on the bus, queue stays open meanwhile
+        uint32_t delay_us = async->delay_us;
+        (void) pthread_mutex_unlock(&async->lock);
+        if (delay_us > 0) {
+            (void) usleep(delay_us);
+        }
+        (void) pthread_mutex_lock(&async->lock);
+
+        flash_mock_transfer_t *transfer = &async->queue[async->executed % FLASH_MOCK_ASYNC_DEPTH];
+        transfer->result = mock_transfer(async->dev, transfer->op, transfer->address,
+                                         transfer->buffer, transfer->size);
+        async->executed += 1;
+    }
+    (void) pthread_mutex_unlock(&async->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Start worker thread which executes transfers of dev in submit order
+ *
+ * @param async
+ * @param dev initialized flash mock
+ * @param delay_us host time of every transfer
+ * @return true on success
+ */
+bool flash_mock_async_start(flash_mock_async_t *async, flash_mock_t *dev, uint32_t delay_us) {
+    if (async == NULL || dev == NULL) {
+        return false;
+    }
+
+    async->dev = dev;
+    async->delay_us = delay_us;
+    async->stop = false;
+    async->head = 0;
+    async->executed = 0;
+    async->tail = 0;
+    async->submitted = 0;
+    async->max_in_flight = 0;
+    if (pthread_mutex_init(&async->lock, NULL) != 0) {
+        return false;
+    }
+    if (pthread_cond_init(&async->wake, NULL) != 0) {
+        (void) pthread_mutex_destroy(&async->lock);
+        return false;
+    }
+    if (pthread_create(&async->worker, NULL, mock_worker, async) != 0) {
+        (void) pthread_cond_destroy(&async->wake);
+        (void) pthread_mutex_destroy(&async->lock);
+        return false;
+    }
+
+    return true;
+}
+
+void flash_mock_async_set_delay(flash_mock_async_t *async, uint32_t delay_us) {
+    (void) pthread_mutex_lock(&async->lock);
+    async->delay_us = delay_us;
+    (void) pthread_mutex_unlock(&async->lock);
+}
+
+// Transfers still queued are executed before the worker stops
+void flash_mock_async_stop(flash_mock_async_t *async) {
+    while (flash_mock_async_poll(async) == true) {
+    }
+
+    (void) pthread_mutex_lock(&async->lock);
+    async->stop = true;
+    (void) pthread_cond_signal(&async->wake);
+    (void) pthread_mutex_unlock(&async->lock);
+    (void) pthread_join(async->worker, NULL);
+    (void) pthread_cond_destroy(&async->wake);
+    (void) pthread_mutex_destroy(&async->lock);
+}
+
+// Submitted transfers not reported by poll yet
+uint32_t flash_mock_async_in_flight(flash_mock_async_t *async) {
+    (void) pthread_mutex_lock(&async->lock);
+    uint32_t in_flight = async->tail - async->head;
+    (void) pthread_mutex_unlock(&async->lock);
+
+    return in_flight;
+}
+
+/**
+ * @brief Queue transfer, returns at once, done is called from flash_mock_async_poll
+ *
+ * @param ctx flash_mock_async_t
+ * @param op flash_mock_op_t
+ * @param address
+ * @param buffer stays in use until done is called
+ * @param size
+ * @param done
+ * @param arg
+ * @return false if the queue is full
+ */
+bool flash_mock_async_submit(void *ctx, uint8_t op, uint32_t address, uint8_t *buffer, uint32_t size,
+                             flash_mock_done done, void *arg) {
+    flash_mock_async_t *async = (flash_mock_async_t *) ctx;
+    (void) pthread_mutex_lock(&async->lock);
+    if (async->tail - async->head >= FLASH_MOCK_ASYNC_DEPTH) {
+        (void) pthread_mutex_unlock(&async->lock);
+        return false;
+    }
+
+    flash_mock_transfer_t *transfer = &async->queue[async->tail % FLASH_MOCK_ASYNC_DEPTH];
+    transfer->op = op;
+    transfer->address = address;
+    transfer->buffer = buffer;
+    transfer->size = size;
+    transfer->done = done;
+    transfer->arg = arg;
+    async->tail += 1;
+    async->submitted += 1;
+    if (async->tail - async->head > async->max_in_flight) {
+        async->max_in_flight = async->tail - async->head;
+    }
+    (void) pthread_cond_signal(&async->wake);
+    (void) pthread_mutex_unlock(&async->lock);
+
+    return true;
+}
+
+/**
+ * @brief Call done of executed transfers in submit order
+ *
+ * @param ctx flash_mock_async_t
+ * @return true while transfers are in flight
+ */
+bool flash_mock_async_poll(void *ctx) {
+    flash_mock_async_t *async = (flash_mock_async_t *) ctx;
+    flash_mock_transfer_t finished[FLASH_MOCK_ASYNC_DEPTH];
+    uint32_t count = 0;
+
+    (void) pthread_mutex_lock(&async->lock);
+    for (; async->head != async->executed; ++async->head) {
+        finished[count++] = async->queue[async->head % FLASH_MOCK_ASYNC_DEPTH];
+    }
+    bool in_flight = async->tail != async->head;
+    (void) pthread_mutex_unlock(&async->lock);
+
+    if (count == 0 && in_flight == true) {
+        // Caller spins on poll, let the worker run on single core hosts
+        (void) sched_yield();
+    }
+
+    // Callbacks may submit again
+    for (uint32_t i = 0; i < count; ++i) {
+        finished[i].done(finished[i].arg, finished[i].result);
+    }
+
+    return in_flight;
+}
+
+bool flash_mock_async_erase(void *ctx, uint32_t sector) {
+    flash_mock_async_t *async = (flash_mock_async_t *) ctx;
+    (void) pthread_mutex_lock(&async->lock);
+    bool erased = flash_mock_erase_sector(async->dev, sector);
+    (void) pthread_mutex_unlock(&async->lock);
+
+    return erased;
+}
+
+int flash_mock_async_read(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    flash_mock_async_t *async = (flash_mock_async_t *) ctx;
+    (void) pthread_mutex_lock(&async->lock);
+    int ret = mock_transfer(async->dev, FLASH_MOCK_READ, address, buffer, size);
+    (void) pthread_mutex_unlock(&async->lock);
+
+    return ret;
+}
+
+int flash_mock_async_write(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    flash_mock_async_t *async = (flash_mock_async_t *) ctx;
+    (void) pthread_mutex_lock(&async->lock);
+    int ret = mock_transfer(async->dev, FLASH_MOCK_PROGRAM, address, buffer, size);
+    (void) pthread_mutex_unlock(&async->lock);
+
+    return ret;
+}
@@ -0,0 +1,60 @@
+#ifndef __FLASH_MOCK_ASYNC_H_
+#define __FLASH_MOCK_ASYNC_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "flash_mock.h"
+
+// Asynchronous front of flash_mock, submitted transfers are executed by a
+// worker thread like SPI DMA, completions are reported by flash_mock_async_poll
+
+#define FLASH_MOCK_ASYNC_DEPTH 8 // Transfers queued at once
+
+typedef enum {
+    FLASH_MOCK_READ = 0,    // Same values as sfs_io_op_t
+    FLASH_MOCK_PROGRAM,
+} flash_mock_op_t;
+
+typedef void(*flash_mock_done)(void *arg, int result);
+
+typedef struct {
+    uint8_t op;
+    uint32_t address;
+    uint8_t *buffer;
+    uint32_t size;
+    flash_mock_done done;
+    void *arg;
+    int result;
+} flash_mock_transfer_t;
+
+typedef struct {
+    flash_mock_t *dev;
+    uint32_t delay_us;      // Host time of every transfer, makes overlap visible
+    pthread_t worker;
+    pthread_mutex_t lock;   // Guards queue and flash memory
+    pthread_cond_t wake;
+    bool stop;
+
+    flash_mock_transfer_t queue[FLASH_MOCK_ASYNC_DEPTH];
+    uint32_t head;          // Next transfer reported by poll
+    uint32_t executed;      // Transfers done by worker, head <= executed <= tail
+    uint32_t tail;          // Submitted transfers
+
+    uint32_t submitted;     // Statistics
+    uint32_t max_in_flight;
+} flash_mock_async_t;
+
+bool flash_mock_async_start(flash_mock_async_t *async, flash_mock_t *dev, uint32_t delay_us);
+void flash_mock_async_stop(flash_mock_async_t *async);
+void flash_mock_async_set_delay(flash_mock_async_t *async, uint32_t delay_us);
+uint32_t flash_mock_async_in_flight(flash_mock_async_t *async);
+bool flash_mock_async_submit(void *ctx, uint8_t op, uint32_t address, uint8_t *buffer, uint32_t size,
+                             flash_mock_done done, void *arg);
+bool flash_mock_async_poll(void *ctx);
+bool flash_mock_async_erase(void *ctx, uint32_t sector);
+int flash_mock_async_read(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size);
+int flash_mock_async_write(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size);
+
+#endif
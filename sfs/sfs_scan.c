@@ -0,0 +1,142 @@
+#include "sfs_scan.h"
+
+#include <string.h>
+
+#if defined(SFS_SIMD_ON) && (defined(__SSE2__) || defined(__AVX2__))
+#include <immintrin.h>
+#define SCAN_X86
+#elif defined(SFS_SIMD_ON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SCAN_NEON
+#endif
+
+#define ERASED_BYTE 0xFFU
+#define ERASED_WORD UINT64_MAX
+
+static uint64_t load_word(const uint8_t *bytes) {
+    uint64_t word;
+    (void) memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+bool sfs_scan_equal(const uint8_t *a, const uint8_t *b, size_t size) {
+    return memcmp(a, b, size) == 0;
+}
+
+/**
+ * @brief Find first programmed byte
+ *
+ * @param data
+ * @param size
+ * @return size_t index of the first byte which is not 0xFF, size if all bytes are erased
+ */
+size_t sfs_scan_not_erased(const uint8_t *data, size_t size) {
+    size_t i = 0;
+#if defined(SCAN_X86) && defined(__AVX2__)
+    const __m256i erased = _mm256_set1_epi8((char) ERASED_BYTE);
+    for (; i + 32U <= size; i += 32U) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) &data[i]);
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, erased));
+        if (mask != UINT32_MAX) {
+            return i + (size_t) __builtin_ctz(~mask);
+        }
+    }
+#elif defined(SCAN_X86)
+    const __m128i erased = _mm_set1_epi8((char) ERASED_BYTE);
+    for (; i + 16U <= size; i += 16U) {
+        __m128i block = _mm_loadu_si128((const __m128i *) &data[i]);
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(block, erased));
+        if (mask != 0xFFFFU) {
+            return i + (size_t) __builtin_ctz(~mask);
+        }
+    }
+#elif defined(SCAN_NEON)
+    for (; i + 16U <= size; i += 16U) {
+        uint64x2_t block = vreinterpretq_u64_u8(vld1q_u8(&data[i]));
+        if ((vgetq_lane_u64(block, 0) & vgetq_lane_u64(block, 1)) != ERASED_WORD) {
+            // Byte is found by the loops below
+            break;
+        }
+    }
+#endif
+
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        if (load_word(&data[i]) != ERASED_WORD) {
+            break;
+        }
+    }
+
+    for (; i < size; ++i) {
+        if (data[i] != ERASED_BYTE) {
+            return i;
+        }
+    }
+
+    return size;
+}
+
+/**
+ * @brief Match first bytes of headers placed stride bytes apart, e.g. sector
+ * headers of memory mapped flash, SFS_SCAN_PATTERN_MAX bytes of every header are read
+ *
+ * @param base first header
+ * @param stride distance of headers, at least SFS_SCAN_PATTERN_MAX
+ * @param count number of headers
+ * @param pattern
+ * @param size pattern bytes, up to SFS_SCAN_PATTERN_MAX
+ * @param matches bit per header, set if header starts with pattern, (count + 7) / 8 bytes
+ * @return uint32_t number of matching headers
+ */
+uint32_t sfs_scan_headers(const uint8_t *base, uint32_t stride, uint32_t count,
+                          const uint8_t *pattern, uint32_t size, uint8_t *matches) {
+    uint32_t found = 0;
+    (void) memset(matches, 0, (count + 7U) / 8U);
+    if (size > SFS_SCAN_PATTERN_MAX || stride < SFS_SCAN_PATTERN_MAX) {
+        return 0;
+    }
+
+#if defined(SCAN_X86) || defined(SCAN_NEON)
+    uint8_t padded[SFS_SCAN_PATTERN_MAX] = {0};
+    (void) memcpy(padded, pattern, size);
+#endif
+#if defined(SCAN_X86)
+    const __m128i expected = _mm_loadu_si128((const __m128i *) padded);
+    const uint32_t wanted = (1U << size) - 1U;
+#elif defined(SCAN_NEON)
+    uint8_t select_bytes[SFS_SCAN_PATTERN_MAX] = {0};
+    (void) memset(select_bytes, 0xFF, size);
+    const uint8x16_t expected = vld1q_u8(padded);
+    const uint8x16_t select = vld1q_u8(select_bytes);
+#endif
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t *header = base + (size_t) i * stride;
+#if defined(SCAN_X86)
+        __m128i bytes = _mm_loadu_si128((const __m128i *) header);
+        bool match = ((uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, expected)) & wanted) == wanted;
+#elif defined(SCAN_NEON)
+        uint64x2_t diff = vreinterpretq_u64_u8(vandq_u8(veorq_u8(vld1q_u8(header), expected), select));
+        bool match = (vgetq_lane_u64(diff, 0) | vgetq_lane_u64(diff, 1)) == 0;
+#else
+        bool match = memcmp(header, pattern, size) == 0;
+#endif
+        if (match == true) {
+            matches[i / 8U] |= (uint8_t) (1U << (i % 8U));
+            found += 1;
+        }
+    }
+
+    return found;
+}
+
+const char *sfs_scan_kernel(void) {
+#if defined(SCAN_X86) && defined(__AVX2__)
+    return "avx2";
+#elif defined(SCAN_X86)
+    return "sse2";
+#elif defined(SCAN_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,20 @@
+#ifndef __SFS_SCAN_H_
+#define __SFS_SCAN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bulk kernels for sector header matching and erased byte detection.
+// Compile with SFS_SIMD_ON to use SSE2, AVX2 or NEON when the compiler
+// targets them, otherwise the portable word-at-a-time code is used.
+
+#define SFS_SCAN_PATTERN_MAX 16U // Header bytes matched by sfs_scan_headers
+
+bool sfs_scan_equal(const uint8_t *a, const uint8_t *b, size_t size);
+size_t sfs_scan_not_erased(const uint8_t *data, size_t size);
+uint32_t sfs_scan_headers(const uint8_t *base, uint32_t stride, uint32_t count,
+                          const uint8_t *pattern, uint32_t size, uint8_t *matches);
+const char *sfs_scan_kernel(void);
+
+#endif
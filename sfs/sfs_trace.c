@@ -0,0 +1,66 @@
+#include "sfs_trace.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static sfs_trace_t trace = {
+    .magic = SFS_TRACE_MAGIC,
+    .head = 0,
+    .entries = SFS_TRACE_ENTRIES,
+};
+
+static sfs_trace_clock trace_clock = NULL;
+
+void sfs_trace_set_clock(sfs_trace_clock clock) {
+    trace_clock = clock;
+}
+
+void sfs_trace_reset(void) {
+    (void) memset(trace.ring, 0, sizeof(trace.ring));
+    trace.head = 0;
+}
+
+/**
+ * @brief Store event in the ring, oldest event is overwritten,
+ * not safe to call from concurrent contexts
+ *
+ * @param event sfs_trace_event_t
+ * @param arg0
+ * @param arg1
+ */
+void sfs_trace_record(uint32_t event, uint32_t arg0, uint32_t arg1) {
+    sfs_trace_entry_t *entry = &trace.ring[trace.head & (SFS_TRACE_ENTRIES - 1U)];
+    entry->timestamp = trace_clock != NULL ? trace_clock() : trace.head;
+    entry->event = event;
+    entry->args[0] = arg0;
+    entry->args[1] = arg1;
+    trace.head += 1;
+}
+
+const sfs_trace_t *sfs_trace_get(void) {
+    return &trace;
+}
+
+const char *sfs_trace_event_name(uint32_t event) {
+    static const char *names[SFS_TRACE_EVENT_COUNT] = {
+        [SFS_TRACE_MOUNT] = "mount",
+        [SFS_TRACE_OPEN] = "open",
+        [SFS_TRACE_CREATE] = "create",
+        [SFS_TRACE_ALLOC] = "alloc",
+        [SFS_TRACE_ROLLOVER] = "rollover",
+        [SFS_TRACE_RECYCLE] = "recycle",
+        [SFS_TRACE_SCAN] = "scan",
+        [SFS_TRACE_ERROR] = "error",
+        [SFS_TRACE_ERASE_START] = "erase start",
+        [SFS_TRACE_ERASE_DONE] = "erase done",
+        [SFS_TRACE_SUSPEND] = "suspend",
+        [SFS_TRACE_RELINK] = "relink",
+        [SFS_TRACE_REPAIR] = "repair",
+    };
+
+    if (event >= SFS_TRACE_EVENT_COUNT || names[event] == NULL) {
+        return "unknown";
+    }
+
+    return names[event];
+}
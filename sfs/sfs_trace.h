@@ -0,0 +1,60 @@
+#ifndef __SFS_TRACE_H_
+#define __SFS_TRACE_H_
+
+#include <stdint.h>
+
+// Binary trace of file system events, fixed ring in RAM, every event
+// is a few stores, ring is drained and decoded on the host.
+// Compile with SFS_TRACE_ON to enable, otherwise SFS_TRACE is empty.
+
+#ifndef SFS_TRACE_ENTRIES
+#define SFS_TRACE_ENTRIES 64U // Has to be power of 2
+#endif
+
+#define SFS_TRACE_MAGIC 0x52544653U // "SFTR" in little endian dump
+
+typedef enum {
+    SFS_TRACE_MOUNT = 1,    // files, sectors
+    SFS_TRACE_OPEN,         // directory index, first sector
+    SFS_TRACE_CREATE,       // directory index, sector
+    SFS_TRACE_ALLOC,        // sector, 1 if taken from extent
+    SFS_TRACE_ROLLOVER,     // closed sector, new sector
+    SFS_TRACE_RECYCLE,      // erased sector, new first sector
+    SFS_TRACE_SCAN,         // sector, records
+    SFS_TRACE_ERROR,        // sfs_err_t, source line
+    SFS_TRACE_ERASE_START,  // sector, queued erases
+    SFS_TRACE_ERASE_DONE,   // sector
+    SFS_TRACE_SUSPEND,      // erased sector, accessed sector
+    SFS_TRACE_RELINK,       // sector with damaged link, next sector in sequence order
+    SFS_TRACE_REPAIR,       // sector, address of write torn by power loss
+    SFS_TRACE_EVENT_COUNT,
+} sfs_trace_event_t;
+
+typedef uint32_t(*sfs_trace_clock)(void);
+
+typedef struct {
+    uint32_t timestamp;     // sfs_trace_clock, event number if there is no clock
+    uint32_t event;         // sfs_trace_event_t
+    uint32_t args[2];
+} sfs_trace_entry_t;
+
+typedef struct {
+    uint32_t magic;         // SFS_TRACE_MAGIC, lets decoder find ring in RAM dump
+    uint32_t head;          // Events since reset, next entry is head % entries
+    uint32_t entries;       // SFS_TRACE_ENTRIES of the firmware
+    sfs_trace_entry_t ring[SFS_TRACE_ENTRIES];
+} sfs_trace_t;
+
+#ifdef SFS_TRACE_ON
+#define SFS_TRACE(event, arg0, arg1) sfs_trace_record(event, (uint32_t) (arg0), (uint32_t) (arg1))
+#else
+#define SFS_TRACE(event, arg0, arg1) ((void) 0)
+#endif
+
+void sfs_trace_set_clock(sfs_trace_clock clock);
+void sfs_trace_reset(void);
+void sfs_trace_record(uint32_t event, uint32_t arg0, uint32_t arg1);
+const sfs_trace_t *sfs_trace_get(void);
+const char *sfs_trace_event_name(uint32_t event);
+
+#endif
@@ -1,10 +1,134 @@
 #include "simple_file_system.h"
+#include "sfs_scan.h"
 
 #include <memory.h>
+#include <stddef.h>
 #include <string.h>
 
-uint8_t file_prefix[FILE_PREFIX_SIZE] = {0x53, 0x46, 0x53};
+#define FILE_MAGIC_SIZE 2U
+#define DATA_LEN_2B_FLAG 0x80
+#define DATA_LEN_4B_FLAG 0xC0
 
+uint8_t file_prefix[FILE_PREFIX_SIZE] = {0x53, 0x46, SFS_FORMAT_V2};
+
+#define HEADER_SIZE_OFFSET FILE_INFO_SIZE
+#define CONTINUATION_OFFSET (HEADER_SIZE_OFFSET + 1U)
+#define SEQUENCE_OFFSET (CONTINUATION_OFFSET + 4U)
+#define CREATED_OFFSET (SEQUENCE_OFFSET + 4U)
+#define RECORDS_OFFSET (CREATED_OFFSET + 4U)
+#define SIZE_OFFSET (RECORDS_OFFSET + 4U)
+#define RING_OFFSET (SIZE_OFFSET + 4U)
+#define EXTENT_OFFSET (RING_OFFSET + 4U)
+#define EXTENT_END_OFFSET (EXTENT_OFFSET + 4U)
+#define TIME_MIN_OFFSET (EXTENT_END_OFFSET + 4U)
+#define TIME_MAX_OFFSET (TIME_MIN_OFFSET + 4U)
+#define GENERATION_OFFSET (TIME_MAX_OFFSET + 4U)
+#define COMMIT_OFFSET (GENERATION_OFFSET + 4U)
+#define TAGS_OFFSET (COMMIT_OFFSET + 4U)
+#define ORIGIN_OFFSET (TAGS_OFFSET + 4U)
+#define KIND_OFFSET (ORIGIN_OFFSET + 4U)
+#define FILE_KINDS ((uint32_t) (SFS_OPEN_TIMED | SFS_OPEN_TAGGED | SFS_CURSOR_KIND))
+
+#define CHAIN_NO_OWNER 0xFFU
+#define MOUNT_SCAN_SECTORS 64U // Mapped sector headers matched per block on mount
+#define MATCH_BLOCK_RECORDS 64U // Fixed layout records compared per block by filtered read
+
+// Cursor record: | file name 8 | created 4 | sequence 4 | sector 4 | offset 4 | record index 4 | crc 4 |
+#define CURSOR_DATA_SIZE (MAX_FILE_NAME_SIZE + 6U * 4U)
+#define CURSOR_RECORD_SIZE (1U + CURSOR_DATA_SIZE)
+
+typedef struct {
+    uint8_t format;
+    uint8_t header_size;    // Offset of the first data byte
+    uint32_t continuation;  // Bytes of record started in previous sector
+    uint32_t sequence;      // SFS_UNSET if not stored
+    uint32_t created;
+    uint32_t records;       // SFS_UNSET until sector is closed
+    uint32_t size;
+    uint32_t ring_sectors;  // SFS_UNSET if file is not a ring
+    uint32_t extent_sectors; // SFS_UNSET if file has no extent
+    uint32_t extent_end;
+    uint32_t time_min;      // SFS_UNSET until sector with timed records is closed
+    uint32_t time_max;
+    uint32_t tags;          // SFS_UNSET until sector with tagged records is closed
+    uint32_t generation;    // SFS_UNSET for generation 0
+    uint32_t commit;        // SFS_UNSET unless sector is the first one of committed compacted copy
+    uint32_t origin;        // Length of the continued record, SFS_UNSET if not stored
+    uint32_t kind;          // SFS_UNSET if not stored
+} sector_header_t;
+
+
+/**
+ * @brief Bump allocation from caller arena, memory lives as long as sfs
+ * 
+ * @param sfs 
+ * @param size 
+ * @return void* NULL if budget is exhausted
+ */
+static void *arena_alloc(sfs_t *sfs, uint32_t size) {
+    uint32_t start = (sfs->arena_used + SFS_ARENA_ALIGN - 1U) & ~(SFS_ARENA_ALIGN - 1U);
+    if (sfs->arena == NULL || size == 0 || start > sfs->arena_size || size > sfs->arena_size - start) {
+        return NULL;
+    }
+
+    sfs->arena_used = start + size;
+    return &sfs->arena[start];
+}
+
+static uint32_t arena_free(sfs_t *sfs) {
+    uint32_t start = (sfs->arena_used + SFS_ARENA_ALIGN - 1U) & ~(SFS_ARENA_ALIGN - 1U);
+    return start < sfs->arena_size ? sfs->arena_size - start : 0;
+}
+
+static uint32_t number_of_sectors(sfs_t *sfs);
+
+/**
+ * @brief Sectors of the partition, partition_sectors or everything from
+ * partition_offset to the end of every device
+ */
+static uint32_t partition_sectors(const sfs_config_t *config) {
+    uint32_t devices = config->device_count > 1 ? config->device_count : 1U;
+    uint64_t device_size = (uint64_t) config->flash_size_mb * MB_TO_BITS(1U);
+    uint64_t sector_size = (uint64_t) config->flash_sector_kb * KB_TO_BITS(1U);
+    uint64_t available = config->partition_offset < device_size ?
+                         (device_size - config->partition_offset) / sector_size * devices : 0;
+    if (available > UINT32_MAX) {
+        available = UINT32_MAX;
+    }
+
+    return config->partition_sectors > 0 && config->partition_sectors < available ?
+           config->partition_sectors : (uint32_t) available;
+}
+
+/**
+ * @brief Report RAM which arena features need for configuration
+ * 
+ * @param config 
+ * @param usage 
+ * @return sfs_err_t 
+ */
+sfs_err_t sfs_ram_usage(const sfs_config_t *config, sfs_ram_usage_t *usage) {
+    if (config == NULL || usage == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (config->flash_sector_kb == 0) {
+        return SFS_INVALID_VALUE;
+    }
+
+    uint32_t sectors = partition_sectors(config);
+    usage->free_map = (sectors + 7U) / 8U;
+    usage->chain_index = sectors * sizeof(uint32_t) +
+                         ((sectors + SFS_ARENA_ALIGN - 1U) & ~(SFS_ARENA_ALIGN - 1U));
+    usage->burst = config->burst_buffer == NULL ? config->burst_size : 0;
+    usage->total = 0;
+    const uint32_t parts[] = {usage->free_map, usage->chain_index, usage->burst};
+    for (uint32_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i) {
+        usage->total += (parts[i] + SFS_ARENA_ALIGN - 1U) & ~(SFS_ARENA_ALIGN - 1U);
+    }
+
+    return SFS_OK;
+}
 
 sfs_err_t sfs_init(sfs_t *sfs, sfs_config_t *config) {
     if (sfs == NULL) {
@@ -15,13 +139,59 @@ sfs_err_t sfs_init(sfs_t *sfs, sfs_config_t *config) {
         return SFS_INVALID_VALUE;
     }
 
+    if (config->device_count > SFS_MAX_DEVICES ||
+        (config->device_count > 0 && config->devices == NULL)) {
+        return SFS_INVALID_VALUE;
+    }
+
+    if (config->device_count > 1 && config->map_base != NULL) {
+        // Striped sectors are not contiguous in any single mapping
+        return SFS_INVALID_VALUE;
+    }
+
+    if (config->arena == NULL && config->arena_size > 0) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (config->retention == NULL && config->retention_size > 0) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (config->retention != NULL && (config->retention_size < SFS_RETENTION_SIZE ||
+        (uintptr_t) config->retention % _Alignof(sfs_snapshot_t) != 0)) {
+        return SFS_BUFFER_SIZE;
+    }
+
     (void) memset(sfs, SFS_EMPTY_VALUE, sizeof(sfs_t));
     sfs->erase_fnc = config->erase_fnc;
     sfs->read_fnc = config->read_fnc;
     sfs->write_fnc = config->write_fnc;
+    sfs->device_count = config->device_count;
+    sfs->io_async = config->device_count > 0;
+    for (uint8_t i = 0; i < config->device_count; ++i) {
+        sfs->devices[i] = config->devices[i];
+        if (sfs->devices[i].submit_fnc == NULL || sfs->devices[i].poll_fnc == NULL) {
+            sfs->io_async = false;
+        }
+    }
+    sfs->map_base = config->map_base;
+    sfs->burst_buffer = config->burst_size > 0 ? config->burst_buffer : NULL;
+    sfs->burst_size = sfs->burst_buffer != NULL ? config->burst_size : 0;
+    sfs->burst_length = 0;
+    sfs->burst_spare_slot = -1;
+    sfs->io_scheduler = config->io_scheduler;
+    sfs->io_erasing = -1;
+
+    // Every device has flash_size_mb, addresses of all devices have to fit in 32 bits
+    uint64_t device_size = (uint64_t) config->flash_size_mb * MB_TO_BITS(1U);
+    uint64_t flash_size = device_size * (config->device_count > 1 ? config->device_count : 1U);
+    uint64_t sector_size = (uint64_t) config->flash_sector_kb * KB_TO_BITS(1U);
+    if (flash_size > UINT32_MAX || sector_size > UINT32_MAX) {
+        return SFS_INVALID_SIZE;
+    }
 
-    sfs->flash_size_bits = MB_TO_BITS(config->flash_size_mb);
-    sfs->flash_sector_bits = KB_TO_BITS(config->flash_sector_kb);
+    sfs->flash_size_bits = (uint32_t) flash_size;
+    sfs->flash_sector_bits = (uint32_t) sector_size;
 
     if (sfs->flash_size_bits < sfs->flash_sector_bits) {
         return SFS_INVALID_VALUE;
@@ -31,433 +201,4897 @@ sfs_err_t sfs_init(sfs_t *sfs, sfs_config_t *config) {
         return SFS_INVALID_SIZE;
     }
 
+    // Partition is at the same address on every device, scans and allocation stay inside it
+    if (config->partition_offset % sfs->flash_sector_bits != 0 ||
+        config->partition_offset >= device_size) {
+        return SFS_INVALID_VALUE;
+    }
+
+    uint32_t sectors = partition_sectors(config);
+    if (config->partition_sectors > sectors) {
+        return SFS_INVALID_SIZE;
+    }
+
+    sfs->partition_address = config->partition_offset;
+    sfs->flash_size_bits = sectors * sfs->flash_sector_bits;
+    if (sfs->map_base != NULL) {
+        sfs->map_base += config->partition_offset;
+    }
+
+    sfs->arena = config->arena;
+    sfs->arena_size = config->arena_size;
+    sfs->arena_used = 0;
+    sfs->retention = (sfs_snapshot_t *) (void *) config->retention;
+    sfs->snapshot_generation = 0;
+    sfs->free_sector_valid = false;
+
+    sfs_ram_usage_t usage = {0};
+    (void) sfs_ram_usage(config, &usage);
+    sfs->free_map = arena_alloc(sfs, usage.free_map);
+    if (usage.chain_index <= arena_free(sfs)) {
+        sfs->chain_sequence = arena_alloc(sfs, sectors * sizeof(uint32_t));
+        sfs->chain_owner = arena_alloc(sfs, sectors);
+    }
+    if (usage.burst > 0 && sfs->burst_buffer == NULL) {
+        // Smaller window than requested is still better than none
+        uint32_t size = usage.burst < arena_free(sfs) ? usage.burst : arena_free(sfs);
+        sfs->burst_buffer = arena_alloc(sfs, size);
+        sfs->burst_size = sfs->burst_buffer != NULL ? size : 0;
+    }
+    if (sfs->io_async == true && sfs->burst_size >= 2U) {
+        // Half of the window is read ahead while the other half is decoded
+        sfs->burst_size /= 2U;
+        sfs->burst_spare = sfs->burst_buffer + sfs->burst_size;
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Translate file system address to device, sectors are striped
+ * across devices, sector n is on device n % device_count
+ * 
+ * @param sfs 
+ * @param address file system address, updated to device address
+ * @return sfs_device_t* 
+ */
+static sfs_device_t *device_address(sfs_t *sfs, uint32_t *address) {
+    uint32_t sector = *address / sfs->flash_sector_bits;
+    uint32_t offset = *address % sfs->flash_sector_bits;
+    sfs_device_t *device = &sfs->devices[sector % sfs->device_count];
+    *address = sfs->partition_address + (sector / sfs->device_count) * sfs->flash_sector_bits + offset;
+
+    return device;
+}
+
+/**
+ * @brief Sector number on its device, partition starts at the same address on every device
+ */
+static uint32_t device_sector(sfs_t *sfs, uint32_t sector) {
+    uint32_t devices = sfs->device_count > 1 ? sfs->device_count : 1U;
+    return sfs->partition_address / sfs->flash_sector_bits + sector / devices;
+}
+
+static void io_done(void *arg, int result) {
+    sfs_io_slot_t *slot = (sfs_io_slot_t *) arg;
+    slot->result = result;
+    slot->state = SFS_IO_DONE;
+}
+
+/**
+ * @brief Let devices finish transfers, done callbacks are called from here
+ *
+ * @param sfs
+ * @return true while any transfer is in flight
+ */
+static bool io_poll(sfs_t *sfs) {
+    if (sfs->io_async == false) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < sfs->device_count; ++i) {
+        (void) sfs->devices[i].poll_fnc(sfs->devices[i].ctx);
+    }
+
+    for (uint8_t i = 0; i < SFS_IO_INFLIGHT; ++i) {
+        if (sfs->io_slots[i].state == SFS_IO_FLIGHT) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Wait until nothing is in flight, before erase, control or blocking calls
+ */
+static void io_quiesce(sfs_t *sfs) {
+    while (io_poll(sfs) == true) {
+    }
+}
+
+/**
+ * @brief Wait for transfer and release its slot
+ *
+ * @param sfs
+ * @param index slot returned by io_submit
+ * @return int transferred bytes, negative on error
+ */
+static int io_collect(sfs_t *sfs, int8_t index) {
+    sfs_io_slot_t *slot = &sfs->io_slots[index];
+    while (slot->state == SFS_IO_FLIGHT) {
+        (void) io_poll(sfs);
+    }
+
+    slot->state = SFS_IO_FREE;
+    return slot->result;
+}
+
+static void io_preempt(sfs_t *sfs, uint32_t sector, bool suspend);
+
+/**
+ * @brief Queue transfer on device, it runs while the caller continues,
+ * buffer has to stay valid until io_collect
+ *
+ * @param sfs
+ * @param op sfs_io_op_t
+ * @param address file system address, transfer never crosses sector boundary
+ * @param buffer
+ * @param size
+ * @return int8_t slot, -1 if all slots or the device queue are full
+ */
+static int8_t io_submit(sfs_t *sfs, uint8_t op, uint32_t address, uint8_t *buffer, uint32_t size) {
+    int8_t index = -1;
+    for (int8_t i = 0; i < (int8_t) SFS_IO_INFLIGHT; ++i) {
+        if (sfs->io_slots[i].state == SFS_IO_FREE) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) {
+        return -1;
+    }
+
+    io_preempt(sfs, address / sfs->flash_sector_bits, true);
+    sfs_device_t *device = device_address(sfs, &address);
+    sfs_io_slot_t *slot = &sfs->io_slots[index];
+    slot->state = SFS_IO_FLIGHT;
+    if (device->submit_fnc(device->ctx, op, address, buffer, size, io_done, slot) == false) {
+        slot->state = SFS_IO_FREE;
+        return -1;
+    }
+
+    return index;
+}
+
+static void io_erase_done(sfs_t *sfs) {
+    SFS_TRACE(SFS_TRACE_ERASE_DONE, sfs->io_erasing, 0);
+    sfs->io_erasing = -1;
+    sfs->io_suspended = false;
+}
+
+/**
+ * @brief Wait for the end of background erase
+ */
+static void io_finish_erase(sfs_t *sfs) {
+    if (sfs->io_erasing < 0) {
+        return;
+    }
+
+    io_quiesce(sfs);
+    sfs_device_t *device = &sfs->devices[sfs->io_erasing % sfs->device_count];
+    if (sfs->io_suspended == true) {
+        (void) device->resume_fnc(device->ctx);
+        sfs->io_suspended = false;
+    }
+
+    while (device->busy_fnc(device->ctx) == true) {
+    }
+
+    io_erase_done(sfs);
+}
+
+/**
+ * @brief Foreground access to device with background erase, erase is suspended
+ * if device supports it, otherwise access waits for the end of erase
+ * 
+ * @param sfs 
+ * @param sector accessed sector
+ * @param suspend false if access can not run during suspended erase (other erase)
+ */
+static void io_preempt(sfs_t *sfs, uint32_t sector, bool suspend) {
+    if (sfs->io_erasing < 0 ||
+        (uint32_t) sfs->io_erasing % sfs->device_count != sector % sfs->device_count) {
+        return;
+    }
+
+    sfs_device_t *device = &sfs->devices[sfs->io_erasing % sfs->device_count];
+    if (suspend == false || device->suspend_fnc == NULL || device->resume_fnc == NULL) {
+        io_finish_erase(sfs);
+        return;
+    }
+
+    if (sfs->io_suspended == true) {
+        return;
+    }
+
+    io_quiesce(sfs);
+    if (device->suspend_fnc(device->ctx) == true) {
+        SFS_TRACE(SFS_TRACE_SUSPEND, sfs->io_erasing, sector);
+        sfs->io_suspended = true;
+    } else {
+        // Nothing to suspend, erase has finished
+        io_erase_done(sfs);
+    }
+}
+
+/**
+ * @brief Read from flash, reads crossing sector boundary are split between devices
+ */
+static sfs_err_t device_read(sfs_t *sfs, uint32_t address, uint8_t *buffer, uint32_t size) {
+    if (sfs->device_count == 0) {
+        int ret_size = sfs->read_fnc(sfs->partition_address + address, buffer, size);
+        return ret_size < 0 || (uint32_t) ret_size != size ? SFS_FLASH_READ : SFS_OK;
+    }
+
+    // Asynchronous reads of striped sectors run on their devices at once
+    int8_t slots[SFS_IO_INFLIGHT];
+    uint32_t sizes[SFS_IO_INFLIGHT];
+    uint8_t count = 0;
+    sfs_err_t ret = SFS_OK;
+    while (size > 0 && ret == SFS_OK) {
+        uint32_t chunk = sfs->flash_sector_bits - address % sfs->flash_sector_bits;
+        if (chunk > size) {
+            chunk = size;
+        }
+
+        int8_t slot = sfs->io_async == true ? io_submit(sfs, SFS_IO_READ, address, buffer, chunk) : -1;
+        if (slot >= 0) {
+            slots[count] = slot;
+            sizes[count] = chunk;
+            count += 1;
+        } else {
+            io_quiesce(sfs);
+            uint32_t device_addr = address;
+            io_preempt(sfs, address / sfs->flash_sector_bits, true);
+            sfs_device_t *device = device_address(sfs, &device_addr);
+            int ret_size = device->read_fnc(device->ctx, device_addr, buffer, chunk);
+            if (ret_size < 0 || (uint32_t) ret_size != chunk) {
+                ret = SFS_FLASH_READ;
+            }
+        }
+
+        address += chunk;
+        buffer += chunk;
+        size -= chunk;
+    }
+
+    for (uint8_t i = 0; i < count; ++i) {
+        int ret_size = io_collect(sfs, slots[i]);
+        if (ret_size < 0 || (uint32_t) ret_size != sizes[i]) {
+            ret = SFS_FLASH_READ;
+        }
+    }
+
+    return ret;
+}
+
+static void burst_invalidate(sfs_t *sfs, uint32_t address, uint32_t size);
+
+static void burst_program(sfs_t *sfs, uint32_t address, const uint8_t *data, uint32_t size);
+
+/**
+ * @brief Start program, write never crosses sector boundary, with asynchronous
+ * devices the program runs while the caller continues and data has to stay
+ * valid until device_write_end
+ *
+ * @param sfs
+ * @param address
+ * @param data
+ * @param size
+ * @param slot transfer in flight, -1 if the program is already done
+ * @return sfs_err_t
+ */
+static sfs_err_t device_write_start(sfs_t *sfs, uint32_t address, uint8_t *data, uint32_t size,
+                                    int8_t *slot) {
+    int ret_size;
+    uint32_t burst_address = address;
+    burst_program(sfs, address, data, size);
+    *slot = sfs->io_async == true ? io_submit(sfs, SFS_IO_PROGRAM, address, data, size) : -1;
+    if (*slot >= 0) {
+        return SFS_OK;
+    }
+
+    if (sfs->device_count == 0) {
+        ret_size = sfs->write_fnc(sfs->partition_address + address, data, size);
+    } else {
+        io_quiesce(sfs);
+        io_preempt(sfs, address / sfs->flash_sector_bits, true);
+        sfs_device_t *device = device_address(sfs, &address);
+        ret_size = device->write_fnc(device->ctx, address, data, size);
+    }
+
+    if (ret_size < 0 || (uint32_t) ret_size != size) {
+        burst_invalidate(sfs, burst_address, size);
+        return SFS_FLASH_WRITE;
+    }
+
+    return SFS_OK;
+}
+
+static sfs_err_t device_write_end(sfs_t *sfs, int8_t slot, uint32_t address, uint32_t size) {
+    if (slot < 0) {
+        return SFS_OK;
+    }
+
+    int ret_size = io_collect(sfs, slot);
+    if (ret_size < 0 || (uint32_t) ret_size != size) {
+        burst_invalidate(sfs, address, size);
+        return SFS_FLASH_WRITE;
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Program bytes, write never crosses sector boundary
+ */
+static sfs_err_t device_write(sfs_t *sfs, uint32_t address, uint8_t *data, uint32_t size) {
+    int8_t slot = -1;
+    sfs_err_t ret = device_write_start(sfs, address, data, size, &slot);
+    SFS_RETURN_ON_ERR(ret);
+
+    return device_write_end(sfs, slot, address, size);
+}
+
+static void free_map_set(sfs_t *sfs, uint32_t sector, bool used) {
+    if (sfs->free_map == NULL) {
+        return;
+    }
+
+    if (used == true) {
+        sfs->free_map[sector / 8U] |= (uint8_t) (1U << (sector % 8U));
+    } else {
+        sfs->free_map[sector / 8U] &= (uint8_t) ~(1U << (sector % 8U));
+    }
+}
+
+static void chain_set(sfs_t *sfs, uint32_t sector, uint8_t owner, uint32_t sequence) {
+    if (sfs->chain_owner == NULL) {
+        return;
+    }
+
+    sfs->chain_owner[sector] = owner;
+    sfs->chain_sequence[sector] = sequence;
+}
+
+/**
+ * @brief Find sector of file by its sequence number, RAM only
+ * 
+ * @param sfs 
+ * @param owner directory index of the file
+ * @param sequence 
+ * @return int32_t sector, -1 if index is not built or there is no such sector
+ */
+static int32_t chain_find(sfs_t *sfs, uint8_t owner, uint32_t sequence) {
+    if (sfs->chain_valid == false || sequence == SFS_UNSET) {
+        return -1;
+    }
+
+    for (uint32_t sector = 0; sector < number_of_sectors(sfs); ++sector) {
+        if (sfs->chain_owner[sector] == owner && sfs->chain_sequence[sector] == sequence) {
+            return (int32_t) sector;
+        }
+    }
+
+    return -1;
+}
+
+static sfs_err_t device_erase(sfs_t *sfs, uint32_t sector) {
+    bool erased = false;
+    io_quiesce(sfs);
+    burst_invalidate(sfs, sector * sfs->flash_sector_bits, sfs->flash_sector_bits);
+    if (sfs->device_count == 0) {
+        erased = sfs->erase_fnc != NULL && sfs->erase_fnc(device_sector(sfs, sector));
+    } else {
+        io_preempt(sfs, sector, false);
+        sfs_device_t *device = &sfs->devices[sector % sfs->device_count];
+        erased = device->erase_fnc != NULL &&
+                 device->erase_fnc(device->ctx, device_sector(sfs, sector));
+    }
+
+    if (erased == false) {
+        return SFS_FLASH_ERASE;
+    }
+
+    free_map_set(sfs, sector, false);
+    chain_set(sfs, sector, CHAIN_NO_OWNER, SFS_UNSET);
+    return SFS_OK;
+}
+
+static bool burst_contains(sfs_t *sfs, uint32_t address, uint32_t size) {
+    return address >= sfs->burst_address &&
+           address + size <= sfs->burst_address + sfs->burst_length;
+}
+
+/**
+ * @brief Read the window after the current one into the spare half, records
+ * of the current window are decoded while the transfer runs
+ */
+static void burst_read_ahead(sfs_t *sfs) {
+    if (sfs->burst_spare == NULL || sfs->burst_spare_slot >= 0 || sfs->burst_length == 0) {
+        return;
+    }
+
+    uint32_t address = sfs->burst_address + sfs->burst_length;
+    if (address >= sfs->flash_size_bits) {
+        return;
+    }
+
+    // One transfer stays on one device
+    uint32_t length = sfs->flash_sector_bits - address % sfs->flash_sector_bits;
+    if (length > sfs->burst_size) {
+        length = sfs->burst_size;
+    }
+
+    sfs->burst_spare_address = address;
+    sfs->burst_spare_length = length;
+    sfs->burst_spare_stale = false;
+    sfs->burst_spare_slot = io_submit(sfs, SFS_IO_READ, address, sfs->burst_spare, length);
+}
+
+/**
+ * @brief Make the spare half the window when it holds the requested bytes,
+ * spare transfer is finished either way, so the half can be filled again
+ *
+ * @return true if the window moved
+ */
+static bool burst_take_spare(sfs_t *sfs, uint32_t address, uint32_t size) {
+    if (sfs->burst_spare_slot < 0) {
+        return false;
+    }
+
+    int ret_size = io_collect(sfs, sfs->burst_spare_slot);
+    sfs->burst_spare_slot = -1;
+    if (sfs->burst_spare_stale == true || ret_size < 0 || (uint32_t) ret_size != sfs->burst_spare_length ||
+        address < sfs->burst_spare_address ||
+        address + size > sfs->burst_spare_address + sfs->burst_spare_length) {
+        return false;
+    }
+
+    uint8_t *window = sfs->burst_buffer;
+    sfs->burst_buffer = sfs->burst_spare;
+    sfs->burst_spare = window;
+    sfs->burst_address = sfs->burst_spare_address;
+    sfs->burst_length = sfs->burst_spare_length;
+
+    return true;
+}
+
+/**
+ * @brief Load burst window at address unless it already holds the requested bytes,
+ * only the record read path calls it, so header scans do not pull whole windows
+ * 
+ * @param sfs 
+ * @param address 
+ * @param size bytes which will be read from address
+ * @return sfs_err_t 
+ */
+static sfs_err_t burst_prefetch(sfs_t *sfs, uint32_t address, uint32_t size) {
+    if (sfs->map_base != NULL || sfs->burst_buffer == NULL || size > sfs->burst_size ||
+        burst_contains(sfs, address, size) == true) {
+        return SFS_OK;
+    }
+
+    if (burst_take_spare(sfs, address, size) == true) {
+        burst_read_ahead(sfs);
+        return SFS_OK;
+    }
+
+    uint32_t length = sfs->burst_size;
+    if (length > sfs->flash_size_bits - address) {
+        length = sfs->flash_size_bits - address;
+    }
+
+    sfs->burst_length = 0;
+    sfs_err_t ret = device_read(sfs, address, sfs->burst_buffer, length);
+    SFS_RETURN_ON_ERR(ret);
+
+    sfs->burst_address = address;
+    sfs->burst_length = length;
+    burst_read_ahead(sfs);
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Drop burst window if it overlaps programmed or erased bytes
+ */
+static void burst_invalidate(sfs_t *sfs, uint32_t address, uint32_t size) {
+    if (sfs->burst_length != 0 && address < sfs->burst_address + sfs->burst_length &&
+        sfs->burst_address < address + size) {
+        sfs->burst_length = 0;
+    }
+
+    if (sfs->burst_spare_slot >= 0 && address < sfs->burst_spare_address + sfs->burst_spare_length &&
+        sfs->burst_spare_address < address + size) {
+        sfs->burst_spare_stale = true;
+    }
+}
+
+/**
+ * @brief Apply programmed bytes to burst window, so reader which follows
+ * the writer gets fresh records from RAM, partly covered write drops the window
+ */
+static void burst_program(sfs_t *sfs, uint32_t address, const uint8_t *data, uint32_t size) {
+    if (burst_contains(sfs, address, size) == false) {
+        burst_invalidate(sfs, address, size);
+        return;
+    }
+
+    uint8_t *window = &sfs->burst_buffer[address - sfs->burst_address];
+    for (uint32_t i = 0; i < size; ++i) {
+        // Program clears bits only
+        window[i] &= data[i];
+    }
+}
+
+static sfs_err_t flash_read(sfs_t *sfs, uint32_t address, uint8_t *buffer, uint32_t size) {
+    if (sfs->map_base != NULL) {
+        (void) memcpy(buffer, sfs->map_base + address, size);
+        return SFS_OK;
+    }
+
+    if (burst_contains(sfs, address, size) == true) {
+        (void) memcpy(buffer, &sfs->burst_buffer[address - sfs->burst_address], size);
+        return SFS_OK;
+    }
+
+    return device_read(sfs, address, buffer, size);
+}
+
+/**
+ * @brief Get pointer to flash content, without copy when flash is mapped
+ * 
+ * @param sfs 
+ * @param address flash address
+ * @param scratch buffer used when flash is not mapped, at least size bytes
+ * @param size 
+ * @return const uint8_t* pointer to data, NULL on read error
+ */
+static const uint8_t *flash_view(sfs_t *sfs, uint32_t address, uint8_t *scratch, uint32_t size) {
+    if (sfs->map_base != NULL) {
+        return sfs->map_base + address;
+    }
+
+    if (burst_contains(sfs, address, size) == true) {
+        return &sfs->burst_buffer[address - sfs->burst_address];
+    }
+
+    if (flash_read(sfs, address, scratch, size) != SFS_OK) {
+        return NULL;
+    }
+
+    return scratch;
+}
+
+static uint32_t read_be(const uint8_t *bytes, uint8_t size) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < size; ++i) {
+        value = (value << 8) | bytes[i];
+    }
+
+    return value;
+}
+
+static void write_be(uint8_t *bytes, uint32_t value, uint8_t size) {
+    for (uint8_t i = size; i > 0; --i) {
+        bytes[i - 1] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+/**
+ * @brief Commit bit of v2 length follows the size flags, it is set while
+ * record data is written
+ */
+static uint8_t data_len_commit_bit(uint8_t first) {
+    if (first < DATA_LEN_2B_FLAG) {
+        return 0x40;
+    }
+
+    return (first & 0xC0) == DATA_LEN_2B_FLAG ? 0x20 : 0x10;
+}
+
+static bool data_len_committed(uint8_t format, uint8_t first) {
+    return format != SFS_FORMAT_V2 || (first & data_len_commit_bit(first)) == 0;
+}
+
+/**
+ * @brief Encode v2 record length, 6 bits in 1 byte (0cxxxxxx), 13 bits in
+ * 2 bytes (10cxxxxx), 28 bits in 4 bytes (110cxxxx), c is the commit bit.
+ * First byte is never FLASH_NO_DATA nor SFS_PADDING
+ * 
+ * @param len record length, not zero
+ * @param committed false to leave commit bit set
+ * @param bytes output, at least DATA_LEN_MAX_SIZE
+ * @return uint8_t number of bytes used
+ */
+static uint8_t encode_data_len(uint32_t len, bool committed, uint8_t *bytes) {
+    uint8_t size = SFS_DATA_LEN_SIZE(len);
+    write_be(bytes, len, size);
+
+    if (size == 2) {
+        bytes[0] |= DATA_LEN_2B_FLAG;
+    } else if (size == 4) {
+        bytes[0] |= DATA_LEN_4B_FLAG;
+    }
+
+    if (committed == false) {
+        bytes[0] |= data_len_commit_bit(bytes[0]);
+    }
+
+    return size;
+}
+
+/**
+ * @brief Decode record length, v1 lengths have 7, 14 or 29 bits and no commit
+ * bit, commit bit of v2 is not part of the length
+ */
+static sfs_err_t decode_data_len(uint8_t format, const uint8_t *bytes, uint32_t *len, uint8_t *size) {
+    bool v2 = format == SFS_FORMAT_V2;
+    if (bytes[0] < DATA_LEN_2B_FLAG) {
+        *size = 1;
+        *len = bytes[0] & (v2 == true ? 0x3F : 0x7F);
+    } else if ((bytes[0] & 0xC0) == DATA_LEN_2B_FLAG) {
+        *size = 2;
+        *len = read_be(bytes, *size) & (v2 == true ? 0x1FFF : 0x3FFF);
+    } else if ((bytes[0] & 0xE0) == DATA_LEN_4B_FLAG) {
+        *size = 4;
+        *len = read_be(bytes, *size) & (v2 == true ? SFS_MAX_RECORD_SIZE : 0x1FFFFFFFU);
+    } else {
+        return SFS_DATA_CORRUPTED;
+    }
+
+    if (*len == 0) {
+        return SFS_DATA_SIZE_ZERO;
+    }
+
+    return SFS_OK;
+}
+
+// static bool check_file_name(uint8_t *file_name, size_t file_name_size) {
+//     if (file_name_size != MAX_FILE_NAME_SIZE) {
+//         return false;
+//     }
+
+//     if (file_name[MAX_FILE_NAME_SIZE - 1] != '\0') {
+//         return false;
+//     }
+
+//     return true;
+// }
+
+static sfs_err_t set_file_name(sfs_file_t *file, char *file_name) {
+    if (file == NULL || file_name == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (strlen(file_name) > MAX_FILE_NAME_SIZE) {
+        return SFS_INVALID_FILE_NAME;
+    }
+
+    (void) memset(file->name, 0xFF, sizeof(file->name));
+    (void) memcpy(file->name, file_name, strlen(file_name));
+    file->name[MAX_FILE_NAME_SIZE - 1] = '\0';
+
+    return SFS_OK;
+}
+
+static uint32_t number_of_sectors(sfs_t *sfs) {
+    return sfs->flash_size_bits / sfs->flash_sector_bits;
+}
+
+static uint32_t sector_to_address(sfs_t *sfs, uint32_t sector) {
+    return sector * sfs->flash_sector_bits;
+}
+
+static uint32_t address_to_sector(sfs_t *sfs, uint32_t address) {
+    return address / sfs->flash_sector_bits;
+}
+
+static uint32_t end_of_sector_size(uint8_t format) {
+    return format == SFS_FORMAT_LEGACY ? LEGACY_END_OF_SECTOR_SIZE : END_OF_SECTOR_SIZE;
+}
+
+/**
+ * @brief Get address of the first byte after data area of the sector, where
+ * the next sector number is stored
+ * 
+ * @param sfs 
+ * @param address any address inside sector
+ * @param format sector format
+ * @return uint32_t 
+ */
+static uint32_t sector_data_end(sfs_t *sfs, uint32_t address, uint8_t format) {
+    return sector_to_address(sfs, address_to_sector(sfs, address) + 1) - end_of_sector_size(format);
+}
+
+static uint32_t sector_data_capacity(sfs_t *sfs) {
+    return sfs->flash_sector_bits - SECTOR_HEADER_SIZE - END_OF_SECTOR_SIZE;
+}
+
+static uint32_t read_header_field(const uint8_t *bytes, uint8_t header_size, uint32_t offset) {
+    if (offset + 4U > header_size) {
+        return SFS_UNSET;
+    }
+
+    return read_be(&bytes[offset], 4);
+}
+
+static sfs_err_t parse_sector_header(sfs_t *sfs, const uint8_t *bytes, sector_header_t *header) {
+    if (sfs_scan_equal(bytes, file_prefix, FILE_MAGIC_SIZE) == false) {
+        return SFS_INVALID_PREFIX;
+    }
+
+    header->format = bytes[FILE_MAGIC_SIZE];
+    if (header->format == SFS_FORMAT_LEGACY) {
+        header->header_size = FILE_INFO_SIZE;
+        header->continuation = 0;
+    } else if (header->format == SFS_FORMAT_V1 || header->format == SFS_FORMAT_V2) {
+        header->header_size = bytes[HEADER_SIZE_OFFSET];
+        header->continuation = read_be(&bytes[CONTINUATION_OFFSET], 4);
+        if (header->header_size < SEQUENCE_OFFSET ||
+            header->header_size + header->continuation > sfs->flash_sector_bits - END_OF_SECTOR_SIZE) {
+            return SFS_DATA_CORRUPTED;
+        }
+    } else {
+        return SFS_INVALID_PREFIX;
+    }
+
+    // Headers written by older versions can be shorter
+    uint8_t header_size = header->format == SFS_FORMAT_LEGACY ? 0 : header->header_size;
+    if (header_size > SECTOR_HEADER_SIZE) {
+        header_size = SECTOR_HEADER_SIZE;
+    }
+
+    header->sequence = read_header_field(bytes, header_size, SEQUENCE_OFFSET);
+    header->created = read_header_field(bytes, header_size, CREATED_OFFSET);
+    header->records = read_header_field(bytes, header_size, RECORDS_OFFSET);
+    header->size = read_header_field(bytes, header_size, SIZE_OFFSET);
+    header->ring_sectors = read_header_field(bytes, header_size, RING_OFFSET);
+    header->extent_sectors = read_header_field(bytes, header_size, EXTENT_OFFSET);
+    header->extent_end = read_header_field(bytes, header_size, EXTENT_END_OFFSET);
+    header->time_min = read_header_field(bytes, header_size, TIME_MIN_OFFSET);
+    header->time_max = read_header_field(bytes, header_size, TIME_MAX_OFFSET);
+    header->generation = read_header_field(bytes, header_size, GENERATION_OFFSET);
+    header->commit = read_header_field(bytes, header_size, COMMIT_OFFSET);
+    header->tags = read_header_field(bytes, header_size, TAGS_OFFSET);
+    header->origin = read_header_field(bytes, header_size, ORIGIN_OFFSET);
+    header->kind = read_header_field(bytes, header_size, KIND_OFFSET);
+
+    return SFS_OK;
+}
+
+static sfs_err_t read_sector_header(sfs_t *sfs, uint32_t sector, sector_header_t *header) {
+    uint8_t scratch[SECTOR_HEADER_SIZE];
+    const uint8_t *bytes = flash_view(sfs, sector_to_address(sfs, sector), scratch, sizeof(scratch));
+    if (bytes == NULL) {
+        return SFS_FLASH_READ;
+    }
+
+    return parse_sector_header(sfs, bytes, header);
+}
+
+/**
+ * @brief Check if sector is reserved in extent of any file
+ */
+static bool sector_reserved(sfs_t *sfs, uint32_t sector) {
+    for (uint8_t i = 0; i < sfs->dir_count; ++i) {
+        if (sector >= sfs->dir[i].extent_next && sector < sfs->dir[i].extent_end) {
+            return true;
+        }
+
+        if (sfs->dir[i].ring_spare == (int32_t) sector) {
+            return true;
+        }
+    }
+
+    if (sfs->compact_phase == SFS_COMPACT_COPY && sector >= sfs->compact_base && sector < sfs->compact_end) {
+        return true;
+    }
+
+    return false;
+}
+
+static sfs_err_t sector_is_free(sfs_t *sfs, uint32_t sector, bool *free) {
+    if (sfs->free_map_valid == true) {
+        *free = (sfs->free_map[sector / 8U] & (1U << (sector % 8U))) == 0;
+        return SFS_OK;
+    }
+
+    uint8_t scratch = 0;
+    const uint8_t *sector_first_element = flash_view(sfs, sector_to_address(sfs, sector),
+                                                     &scratch, sizeof(scratch));
+
+    if (sector_first_element == NULL) {
+        return SFS_FLASH_READ;
+    }
+
+    *free = *sector_first_element == FLASH_NO_DATA;
+    return SFS_OK;
+}
+
+/**
+ * @brief Check sectors of free sector scan, scan state is in sfs
+ * 
+ * @param sfs 
+ * @param count number of sectors to check
+ * @return sfs_err_t 
+ */
+static sfs_err_t scan_free_sectors(sfs_t *sfs, uint32_t count) {
+    uint32_t sectors = number_of_sectors(sfs);
+    bool free = false;
+
+    for (; count > 0 && sfs->io_scan_next < sectors; --count, ++sfs->io_scan_next) {
+        uint32_t i = sfs->io_scan_next;
+        sfs_err_t ret = sector_is_free(sfs, i, &free);
+        SFS_RETURN_ON_ERR(ret);
+
+        // Sectors reserved for other files count as used
+        if (free == false || sector_reserved(sfs, i) == true) {
+            sfs->io_scan_last_used = i;
+        } else if (sfs->io_scan_first_free < 0) {
+            sfs->io_scan_first_free = i;
+        }
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief CRC-32 (IEEE 802.3), table of nibbles keeps it small
+ */
+static uint32_t crc32(const uint8_t *data, size_t size) {
+    static const uint32_t table[16] = {
+        0x00000000U, 0x1DB71064U, 0x3B6E20C8U, 0x26D930ACU, 0x76DC4190U, 0x6B6B51F4U, 0x4DB26158U, 0x5005713CU,
+        0xEDB88320U, 0xF00F9344U, 0xD6D6A3E8U, 0xCB61B38CU, 0x9B64C2B0U, 0x86D3D2D4U, 0xA00AE278U, 0xBDBDF21CU,
+    };
+    uint32_t crc = 0xFFFFFFFFU;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0x0FU] ^ (crc >> 4);
+        crc = table[(crc ^ (data[i] >> 4)) & 0x0FU] ^ (crc >> 4);
+    }
+
+    return ~crc;
+}
+
+static uint32_t snapshot_crc(const sfs_snapshot_t *snapshot) {
+    size_t start = offsetof(sfs_snapshot_t, generation);
+    size_t end = offsetof(sfs_snapshot_t, dir) + snapshot->dir_count * sizeof(sfs_dir_entry_t);
+    return crc32((const uint8_t *) snapshot + start, end - start);
+}
+
+/**
+ * @brief Drop both copies of mount state, next mount scans flash, done before
+ * sectors are added to or removed from files
+ */
+static void snapshot_invalidate(sfs_t *sfs) {
+    if (sfs->retention != NULL) {
+        sfs->retention[0].magic = 0;
+        sfs->retention[1].magic = 0;
+    }
+}
+
+/**
+ * @brief Save mount state into the older copy in retention RAM, the other
+ * copy stays valid if reset comes during save
+ */
+static void snapshot_save(sfs_t *sfs) {
+    if (sfs->retention == NULL || sfs->mounted == false) {
+        return;
+    }
+
+    if (sfs->compact_phase != SFS_COMPACT_IDLE) {
+        // Files are switched to their copies, only scan finds out how far it got
+        snapshot_invalidate(sfs);
+        return;
+    }
+
+    sfs->snapshot_generation += 1;
+    sfs_snapshot_t *snapshot = &sfs->retention[sfs->snapshot_generation % 2U];
+    snapshot->magic = 0;
+    snapshot->generation = sfs->snapshot_generation;
+    snapshot->flash_size_bits = sfs->flash_size_bits;
+    snapshot->flash_sector_bits = sfs->flash_sector_bits;
+    snapshot->partition_address = sfs->partition_address;
+    snapshot->device_count = sfs->device_count;
+    snapshot->dir_count = sfs->dir_count;
+    snapshot->next_free_sector = sfs->io_scan_pending == true ? -1 : sfs->next_free_sector;
+    snapshot->next_created = sfs->next_created;
+    (void) memcpy(snapshot->dir, sfs->dir, sfs->dir_count * sizeof(sfs_dir_entry_t));
+    for (uint8_t i = 0; i < sfs->dir_count; ++i) {
+        // Readers do not survive reset
+        snapshot->dir[i].tail_fnc = NULL;
+        snapshot->dir[i].tail_arg = NULL;
+    }
+    snapshot->crc = snapshot_crc(snapshot);
+    snapshot->magic = SFS_SNAPSHOT_MAGIC;
+}
+
+static void start_free_scan(sfs_t *sfs) {
+    sfs->io_scan_pending = true;
+    sfs->io_scan_next = 0;
+    sfs->io_scan_last_used = -1;
+    sfs->io_scan_first_free = -1;
+}
+
+/**
+ * @brief Finish free sector scan and pick next free sector
+ */
+static sfs_err_t finish_free_scan(sfs_t *sfs) {
+    sfs_err_t ret = scan_free_sectors(sfs, UINT32_MAX);
+    SFS_RETURN_ON_ERR(ret);
+
+    // TO DO Check wear leveling
+    if ((uint32_t) (sfs->io_scan_last_used + 1) == number_of_sectors(sfs)) {
+        // Last sector has data, go to firts sector without data
+        sfs->next_free_sector = sfs->io_scan_first_free;
+    } else {
+        // Last sector with data is not at the end 
+        sfs->next_free_sector = sfs->io_scan_last_used + 1;
+    }
+    sfs->io_scan_pending = false;
+    sfs->free_sector_valid = true;
+    snapshot_save(sfs);
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Scan whole flash for next free sector
+ */
+static sfs_err_t update_free_sector(sfs_t *sfs) {
+    start_free_scan(sfs);
+    return finish_free_scan(sfs);
+}
+
+/**
+ * @brief Find run of free sectors, search starts at next free sector so extents
+ * follow the same order as single sectors
+ * 
+ * @param sfs 
+ * @param count 
+ * @param sector first sector of the run, -1 if there is none
+ * @return sfs_err_t 
+ */
+static sfs_err_t find_free_extent(sfs_t *sfs, uint32_t count, int32_t *sector) {
+    uint32_t sectors = number_of_sectors(sfs);
+    uint32_t start = sfs->next_free_sector > 0 ? (uint32_t) sfs->next_free_sector : 0;
+    uint32_t run = 0;
+    bool free = false;
+
+    *sector = -1;
+    for (uint32_t n = 0; n < sectors; ++n) {
+        uint32_t i = (start + n) % sectors;
+        if (i == 0) {
+            // Extent can not wrap around the end of flash
+            run = 0;
+        }
+
+        sfs_err_t ret = sector_is_free(sfs, i, &free);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (free == false || sector_reserved(sfs, i) == true) {
+            run = 0;
+            continue;
+        }
+
+        run += 1;
+        if (run == count) {
+            *sector = i + 1 - count;
+            return SFS_OK;
+        }
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Take next sector for the file, from its extent when there is one left,
+ * new extent is reserved if file uses extents, otherwise next free sector
+ * 
+ * @param sfs 
+ * @param entry 
+ * @param sector 
+ * @return sfs_err_t 
+ */
+static sfs_err_t allocate_sector(sfs_t *sfs, sfs_dir_entry_t *entry, int32_t *sector) {
+    bool free = false;
+    sfs_err_t ret;
+    if (sfs->io_scan_pending == true) {
+        ret = finish_free_scan(sfs);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    if (entry->extent_next < entry->extent_end) {
+        ret = sector_is_free(sfs, entry->extent_next, &free);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (free == true) {
+            *sector = entry->extent_next;
+            entry->extent_next += 1;
+            SFS_TRACE(SFS_TRACE_ALLOC, *sector, 1);
+            return SFS_OK;
+        }
+
+        // Extent was overwritten, drop the reservation
+        entry->extent_next = entry->extent_end;
+    }
+
+    if (sfs->free_sector_valid == false) {
+        // File was opened without the scan, see open_attached
+        ret = update_free_sector(sfs);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    *sector = sfs->next_free_sector;
+    if (entry->extent_sectors > 1) {
+        int32_t extent = -1;
+        ret = find_free_extent(sfs, entry->extent_sectors, &extent);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (extent >= 0) {
+            // Fall back to single sector if there is no room for extent
+            *sector = extent;
+            entry->extent_next = extent + 1;
+            entry->extent_end = extent + entry->extent_sectors;
+        }
+    }
+
+    SFS_TRACE(SFS_TRACE_ALLOC, *sector, 0);
+    return SFS_OK;
+}
+
+static sfs_err_t write_bytes(sfs_t *sfs, sfs_file_t *file, uint8_t *data, uint32_t size) {
+    sfs_err_t ret = device_write(sfs, file->end_address, data, size);
+    SFS_RETURN_ON_ERR(ret);
+
+    file->end_address += size;
+    return SFS_OK;
+}
+
+/**
+ * @brief Write sector header, set file address 
+ * 
+ * @param sfs 
+ * @param file 
+ * @param entry file directory entry, sequence and creation number are taken from it
+ * @param sector 
+ * @param continuation bytes of the current record that will be placed in this sector
+ * @return sfs_err_t 
+ */
+static sfs_err_t create_file(sfs_t *sfs, sfs_file_t *file, sfs_dir_entry_t *entry,
+                             int32_t sector, uint32_t continuation) {
+    if (sector < 0) {
+        return SFS_UNKNOWN;
+    }
+
+    uint8_t header[SECTOR_HEADER_SIZE];
+    (void) memset(header, FLASH_NO_DATA, sizeof(header));
+    (void) memcpy(header, file_prefix, sizeof(file_prefix));
+    (void) memcpy(&header[FILE_PREFIX_SIZE], file->name, sizeof(file->name));
+    header[HEADER_SIZE_OFFSET] = SECTOR_HEADER_SIZE;
+    write_be(&header[CONTINUATION_OFFSET], continuation, 4);
+    write_be(&header[SEQUENCE_OFFSET], entry->last_sequence, 4);
+    if (entry->ring_sectors != 0) {
+        write_be(&header[RING_OFFSET], entry->ring_sectors, 4);
+    }
+    if (entry->extent_next < entry->extent_end) {
+        write_be(&header[EXTENT_OFFSET], entry->extent_sectors, 4);
+        write_be(&header[EXTENT_END_OFFSET], entry->extent_end, 4);
+    }
+    if (entry->generation > 0) {
+        write_be(&header[GENERATION_OFFSET], entry->generation, 4);
+    }
+    if (continuation > 0) {
+        write_be(&header[ORIGIN_OFFSET], entry->pending_record, 4);
+    }
+    if (entry->kind != SFS_UNSET) {
+        write_be(&header[KIND_OFFSET], entry->kind, 4);
+    }
+
+    // Partly programmed header still makes sector used
+    free_map_set(sfs, sector, true);
+    chain_set(sfs, sector, (uint8_t) (entry - sfs->dir), entry->last_sequence);
+    sfs_err_t ret = device_write(sfs, sector_to_address(sfs, sector), header, sizeof(header));
+    SFS_RETURN_ON_ERR(ret);
+
+    // Creation number is programmed last, header torn by power loss is found
+    // by mount without it
+    uint8_t created[4];
+    write_be(created, entry->created, sizeof(created));
+    ret = device_write(sfs, sector_to_address(sfs, sector) + CREATED_OFFSET, created, sizeof(created));
+    SFS_RETURN_ON_ERR(ret);
+
+    file->start_address = sector_to_address(sfs, sector);
+    file->end_address = file->start_address + SECTOR_HEADER_SIZE;
+    file->address_pointer = file->end_address;
+    file->read_format = SFS_FORMAT_V2;
+    file->write_format = SFS_FORMAT_V2;
+    entry->last_format = SFS_FORMAT_V2;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Walk records in sector, find first free byte and summarize data
+ * 
+ * @param sfs 
+ * @param sector 
+ * @param header sector header
+ * @param end first free byte, data end if the sector is full
+ * @param records records started in this sector
+ * @param size data bytes stored in this sector
+ * @param open_record start of the record which does not end in this sector,
+ * is not committed or has damaged length, SFS_UNSET if there is none, can be NULL
+ * @return sfs_err_t 
+ */
+static sfs_err_t scan_sector_data(sfs_t *sfs, uint32_t sector, sector_header_t *header,
+                                  uint32_t *end, uint32_t *records, uint32_t *size,
+                                  uint32_t *open_record) {
+    uint32_t cursor = sector_to_address(sfs, sector) + header->header_size + header->continuation;
+    uint32_t data_end = sector_data_end(sfs, cursor, header->format);
+    uint8_t scratch[DATA_LEN_MAX_SIZE];
+    uint32_t data_len = 0;
+    uint8_t len_size = 0;
+    uint32_t record = SFS_UNSET;
+    bool pending = false;
+
+    sfs_err_t ret = SFS_OK;
+    *records = 0;
+    *size = header->continuation;
+    while (cursor < data_end) {
+        record = cursor;
+        const uint8_t *len_bytes = flash_view(sfs, cursor, scratch, sizeof(scratch));
+        if (len_bytes == NULL) {
+            return SFS_FLASH_READ;
+        }
+
+        if (header->format == SFS_FORMAT_LEGACY) {
+            data_len = read_be(len_bytes, LEGACY_DATA_LEN_SIZE);
+            len_size = LEGACY_DATA_LEN_SIZE;
+            if (data_len == 0) {
+                ret = SFS_DATA_SIZE_ZERO;
+                break;
+            }
+
+            if (data_len == NO_MORE_DATA) {
+                break;
+            }
+        } else {
+            if (len_bytes[0] == FLASH_NO_DATA) {
+                break;
+            }
+
+            if (len_bytes[0] == SFS_PADDING) {
+                cursor = data_end;
+                break;
+            }
+
+            ret = decode_data_len(header->format, len_bytes, &data_len, &len_size);
+            if (ret != SFS_OK) {
+                break;
+            }
+
+            if (data_len_committed(header->format, len_bytes[0]) == false) {
+                // Record is being written, or power was lost before its commit
+                pending = true;
+                break;
+            }
+        }
+
+        cursor += len_size;
+        *records += 1;
+        // Last record can continue in the next sector
+        *size += cursor + data_len > data_end ? data_end - cursor : data_len;
+        cursor += data_len;
+    }
+
+    if (open_record != NULL) {
+        *open_record = ret != SFS_OK || pending == true || cursor > data_end ? record : SFS_UNSET;
+    }
+    *end = cursor > data_end ? data_end : cursor;
+    SFS_TRACE(SFS_TRACE_SCAN, sector, *records);
+
+    return ret;
+}
+
+static int32_t dir_find(sfs_t *sfs, const uint8_t *name) {
+    for (int32_t i = 0; i < sfs->dir_count; ++i) {
+        if (sfs_scan_equal(sfs->dir[i].name, name, MAX_FILE_NAME_SIZE) == true) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static sfs_err_t dir_add(sfs_t *sfs, const uint8_t *name, int32_t *index) {
+    if (sfs->dir_count >= SFS_MAX_FILES) {
+        return SFS_DIR_FULL;
+    }
+
+    *index = sfs->dir_count;
+    sfs_dir_entry_t *entry = &sfs->dir[*index];
+    (void) memset(entry, SFS_EMPTY_VALUE, sizeof(sfs_dir_entry_t));
+    (void) memcpy(entry->name, name, MAX_FILE_NAME_SIZE);
+    entry->ring_spare = -1;
+    entry->pending_record = SFS_UNSET;
+    entry->pending_sector = SFS_UNSET;
+    sfs->dir_count += 1;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Sectors without sequence number (legacy) go first in address order
+ */
+static uint64_t sector_order(sector_header_t *header, uint32_t sector) {
+    if (header->sequence == SFS_UNSET) {
+        return sector;
+    }
+
+    return ((uint64_t) 1 << 32) | header->sequence;
+}
+
+/**
+ * @brief Repairs done by mount need write access, extraction tools mount without it
+ */
+static bool flash_writable(sfs_t *sfs) {
+    if (sfs->device_count == 0) {
+        return sfs->write_fnc != NULL && sfs->erase_fnc != NULL;
+    }
+
+    return sfs->devices[0].write_fnc != NULL && sfs->devices[0].erase_fnc != NULL;
+}
+
+/**
+ * @brief Header programmed only partly before power loss, creation number
+ * is the last field every header has, data is never written before the
+ * header is complete
+ */
+static bool header_torn(sector_header_t *header, sfs_err_t status) {
+    if (status == SFS_DATA_CORRUPTED) {
+        // Only sizes of V1 and V2 headers are checked
+        return true;
+    }
+
+    return status == SFS_OK && header->format != SFS_FORMAT_LEGACY &&
+           header->header_size >= CREATED_OFFSET + 4U && header->created == SFS_UNSET;
+}
+
+/**
+ * @brief Records and data bytes of sector, closed sector has them in header,
+ * open one is scanned, corrupted data does not stop mount, file ends before it
+ */
+static sfs_err_t sector_stats(sfs_t *sfs, uint32_t sector, sector_header_t *header,
+                              uint32_t *end, uint32_t *records, uint32_t *size) {
+    *end = sector_data_end(sfs, sector_to_address(sfs, sector), header->format);
+    *records = header->records;
+    *size = header->size;
+    if (*records == SFS_UNSET || *size == SFS_UNSET) {
+        // Sector is open or written without summary
+        sfs_err_t ret = scan_sector_data(sfs, sector, header, end, records, size, NULL);
+        if (ret != SFS_OK && ret != SFS_DATA_CORRUPTED && ret != SFS_DATA_SIZE_ZERO) {
+            return ret;
+        }
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Take append position and extent of the file from its last sector
+ */
+static void set_last_sector(sfs_t *sfs, sfs_dir_entry_t *entry, uint32_t sector, sector_header_t *header,
+                            uint32_t records, uint32_t size, uint32_t end) {
+    entry->last_order = sector_order(header, sector);
+    entry->last_sector = sector;
+    entry->last_sequence = header->sequence;
+    entry->last_format = header->format;
+    entry->last_records = records;
+    entry->last_size = size;
+    entry->end_address = end;
+    entry->ring_sectors = header->ring_sectors == SFS_UNSET ? 0 : header->ring_sectors;
+    entry->extent_sectors = header->extent_sectors == SFS_UNSET ? 0 : header->extent_sectors;
+    // Times of records already in open sector are unknown, zone has to cover everything
+    entry->last_time_min = records > 0 ? 0 : SFS_UNSET;
+    entry->last_time_max = records > 0 ? UINT32_MAX : 0;
+    entry->last_tags = records > 0 ? SFS_UNSET : 0;
+    entry->extent_next = sector + 1;
+    entry->extent_end = sector + 1;
+    if (header->extent_end != SFS_UNSET && header->extent_end > sector &&
+        header->extent_end <= number_of_sectors(sfs)) {
+        // Rest of the extent stays reserved
+        entry->extent_end = header->extent_end;
+    }
+}
+
+static sfs_err_t mount_sector(sfs_t *sfs, uint32_t sector) {
+    uint8_t scratch[FILE_INFO_SIZE];
+    sector_header_t header;
+    sfs_err_t ret = read_sector_header(sfs, sector, &header);
+    if ((ret == SFS_OK || ret == SFS_DATA_CORRUPTED) && flash_writable(sfs) == true &&
+        header_torn(&header, ret) == true) {
+        // Sector of a file that was never created
+        SFS_TRACE(SFS_TRACE_REPAIR, sector, sector_to_address(sfs, sector));
+        return device_erase(sfs, sector);
+    }
+    if (ret == SFS_INVALID_PREFIX || ret == SFS_DATA_CORRUPTED) {
+        // Not a file sector
+        return SFS_OK;
+    }
+    SFS_RETURN_ON_ERR(ret);
+
+    const uint8_t *file_info = flash_view(sfs, sector_to_address(sfs, sector), scratch, sizeof(scratch));
+    if (file_info == NULL) {
+        return SFS_FLASH_READ;
+    }
+
+    int32_t index = dir_find(sfs, &file_info[FILE_PREFIX_SIZE]);
+    if (index < 0) {
+        ret = dir_add(sfs, &file_info[FILE_PREFIX_SIZE], &index);
+        SFS_RETURN_ON_ERR(ret);
+
+        sfs->dir[index].created = header.created == SFS_UNSET ? 0 : header.created;
+        sfs->dir[index].kind = header.kind;
+        sfs->dir[index].first_order = UINT64_MAX;
+        sfs->dir[index].generation_low = UINT32_MAX;
+        sfs->dir[index].prev_sector = SFS_UNSET;
+    }
+
+    sfs_dir_entry_t *entry = &sfs->dir[index];
+    uint64_t order = sector_order(&header, sector);
+    chain_set(sfs, sector, (uint8_t) index, header.sequence);
+    entry->sectors += 1;
+
+    uint32_t generation = header.generation == SFS_UNSET ? 0 : header.generation;
+    if (generation > entry->generation) {
+        entry->generation = generation;
+    }
+    if (generation < entry->generation_low) {
+        entry->generation_low = generation;
+    }
+    if (header.commit != SFS_UNSET && generation > entry->generation_committed) {
+        entry->generation_committed = generation;
+    }
+    if (order < entry->first_order) {
+        entry->first_order = order;
+        entry->first_sector = sector;
+    }
+
+    uint32_t end = 0;
+    uint32_t records = 0;
+    uint32_t size = 0;
+    ret = sector_stats(sfs, sector, &header, &end, &records, &size);
+    SFS_RETURN_ON_ERR(ret);
+
+    entry->records += records;
+    entry->size += size;
+    if (entry->sectors > 1 && order > entry->last_order) {
+        entry->prev_order = entry->last_order;
+        entry->prev_sector = entry->last_sector;
+    } else if (entry->sectors > 1 && (entry->prev_sector == SFS_UNSET || order > entry->prev_order)) {
+        entry->prev_order = order;
+        entry->prev_sector = sector;
+    }
+
+    if (entry->sectors == 1 || order > entry->last_order) {
+        set_last_sector(sfs, entry, sector, &header, records, size, end);
+    }
+
+    if (entry->created >= sfs->next_created) {
+        sfs->next_created = entry->created + 1;
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Generation of the file which survives interrupted compaction,
+ * compacted copy wins once its commit is programmed
+ */
+static uint32_t live_generation(sfs_dir_entry_t *entry) {
+    return entry->generation_committed > entry->generation_low ? entry->generation_committed :
+                                                                 entry->generation_low;
+}
+
+/**
+ * @brief Erase sectors of the generation which lost, files with sectors of
+ * two generations were interrupted during compaction
+ * 
+ * @param sfs 
+ * @param erased set if any sector was erased, directory has to be built again
+ * @return sfs_err_t 
+ */
+static sfs_err_t recover_compaction(sfs_t *sfs, bool *erased) {
+    uint8_t scratch[FILE_INFO_SIZE];
+    sector_header_t header;
+    sfs_err_t ret;
+
+    *erased = false;
+    for (uint32_t sector = 0; sector < number_of_sectors(sfs); ++sector) {
+        ret = read_sector_header(sfs, sector, &header);
+        if (ret == SFS_INVALID_PREFIX || ret == SFS_DATA_CORRUPTED) {
+            continue;
+        }
+        SFS_RETURN_ON_ERR(ret);
+
+        const uint8_t *file_info = flash_view(sfs, sector_to_address(sfs, sector), scratch, sizeof(scratch));
+        if (file_info == NULL) {
+            return SFS_FLASH_READ;
+        }
+
+        int32_t index = dir_find(sfs, &file_info[FILE_PREFIX_SIZE]);
+        if (index < 0 || sfs->dir[index].generation == sfs->dir[index].generation_low) {
+            continue;
+        }
+
+        uint32_t generation = header.generation == SFS_UNSET ? 0 : header.generation;
+        if (generation != live_generation(&sfs->dir[index])) {
+            ret = device_erase(sfs, sector);
+            SFS_RETURN_ON_ERR(ret);
+            *erased = true;
+        }
+    }
+
+    return SFS_OK;
+}
+
+static sfs_err_t read_next_sector(sfs_t *sfs, uint32_t address, uint8_t format, uint32_t *sector);
+
+static sfs_err_t write_next_sector(sfs_t *sfs, uint32_t sector, uint8_t format, uint32_t next_sector);
+
+static sfs_err_t chain_next(sfs_t *sfs, uint32_t sector, uint8_t format, uint32_t *next_sector);
+
+static sfs_err_t sector_owned(sfs_t *sfs, uint32_t sector, const sfs_dir_entry_t *entry,
+                              sector_header_t *header, bool *owned);
+
+/**
+ * @brief Program link of the sector before the last one again, rollover
+ * interrupted after the new sector was created leaves the link erased or
+ * torn, programming the same value clears only the extra bits of torn link
+ */
+static sfs_err_t recover_link(sfs_t *sfs, sfs_dir_entry_t *entry) {
+    if (entry->prev_sector == SFS_UNSET || entry->prev_order < ((uint64_t) 1 << 32) ||
+        entry->prev_order + 1U != entry->last_order) {
+        // Legacy sectors or gap in sequence numbers
+        return SFS_OK;
+    }
+
+    sector_header_t header;
+    sfs_err_t ret = read_sector_header(sfs, entry->prev_sector, &header);
+    SFS_RETURN_ON_ERR(ret);
+
+    uint32_t next_sector = NO_NEXT_SECTOR;
+    ret = read_next_sector(sfs, sector_to_address(sfs, entry->prev_sector), header.format, &next_sector);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (next_sector == entry->last_sector || (next_sector & entry->last_sector) != entry->last_sector) {
+        // Linked, or link which can not be fixed by programming
+        return SFS_OK;
+    }
+
+    SFS_TRACE(SFS_TRACE_REPAIR, entry->prev_sector, entry->last_sector);
+    return write_next_sector(sfs, entry->prev_sector, header.format, entry->last_sector);
+}
+
+/**
+ * @brief Check that everything after the last record of the file is erased
+ *
+ * @param sfs
+ * @param address first free byte
+ * @param end data end of the sector
+ * @param programmed first byte which is not erased, end if there is none
+ * @return sfs_err_t
+ */
+static sfs_err_t find_programmed(sfs_t *sfs, uint32_t address, uint32_t end, uint32_t *programmed) {
+    uint8_t scratch[SFS_COPY_CHUNK];
+    while (address < end) {
+        uint32_t chunk = end - address;
+        if (sfs->map_base == NULL && chunk > sizeof(scratch)) {
+            chunk = sizeof(scratch);
+        }
+
+        const uint8_t *bytes = flash_view(sfs, address, scratch, chunk);
+        if (bytes == NULL) {
+            return SFS_FLASH_READ;
+        }
+
+        size_t index = sfs_scan_not_erased(bytes, chunk);
+        if (index < chunk) {
+            *programmed = address + (uint32_t) index;
+            return SFS_OK;
+        }
+        address += chunk;
+    }
+
+    *programmed = end;
+    return SFS_OK;
+}
+
+/**
+ * @brief Program records and size of the sector summary
+ */
+static sfs_err_t write_sector_counts(sfs_t *sfs, uint32_t sector, const sector_header_t *header,
+                                     uint32_t records, uint32_t size) {
+    if (header->format == SFS_FORMAT_LEGACY || header->header_size < SIZE_OFFSET + 4U) {
+        // Sector without summary fields
+        return SFS_OK;
+    }
+
+    uint8_t summary[8];
+    write_be(summary, records, 4);
+    write_be(&summary[4], size, 4);
+    return device_write(sfs, sector_to_address(sfs, sector) + RECORDS_OFFSET, summary, sizeof(summary));
+}
+
+/**
+ * @brief Count records and data bytes of the file again from its sectors,
+ * counters are kept if the chain can not be followed to the last sector
+ */
+static sfs_err_t recount_file(sfs_t *sfs, sfs_dir_entry_t *entry) {
+    uint32_t sector = entry->first_sector;
+    uint32_t file_records = 0;
+    uint32_t file_size = 0;
+    for (uint32_t i = 0; i < entry->sectors && sector < number_of_sectors(sfs); ++i) {
+        sector_header_t header;
+        sfs_err_t ret = read_sector_header(sfs, sector, &header);
+        if (ret == SFS_INVALID_PREFIX || ret == SFS_DATA_CORRUPTED) {
+            return SFS_OK;
+        }
+        SFS_RETURN_ON_ERR(ret);
+
+        uint32_t end = 0;
+        uint32_t records = 0;
+        uint32_t size = 0;
+        ret = sector_stats(sfs, sector, &header, &end, &records, &size);
+        SFS_RETURN_ON_ERR(ret);
+
+        file_records += records;
+        file_size += size;
+        if (sector == entry->last_sector) {
+            entry->records = file_records;
+            entry->size = file_size;
+            set_last_sector(sfs, entry, sector, &header, records, size, end);
+            return SFS_OK;
+        }
+
+        ret = chain_next(sfs, sector, header.format, &sector);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Drop record continued in the last sector of the file when power was
+ * lost before its commit, its length is covered by padding and sectors after
+ * its start are closed without data, next record starts in a new sector
+ *
+ * @param sfs
+ * @param entry
+ * @param header last sector of the file
+ * @param dropped true if the record was dropped
+ * @return sfs_err_t
+ */
+static sfs_err_t drop_continued_record(sfs_t *sfs, sfs_dir_entry_t *entry, const sector_header_t *header,
+                                       bool *dropped) {
+    *dropped = false;
+    uint32_t origin = address_to_sector(sfs, header->origin);
+    if (header->format != SFS_FORMAT_V2 || header->continuation == 0 || header->origin == SFS_UNSET ||
+        origin >= number_of_sectors(sfs) || origin == entry->last_sector) {
+        return SFS_OK;
+    }
+
+    sector_header_t current;
+    bool owned = false;
+    sfs_err_t ret = sector_owned(sfs, origin, entry, &current, &owned);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (owned == false || current.format != SFS_FORMAT_V2 || current.sequence >= header->sequence) {
+        // Start of the record was recycled
+        return SFS_OK;
+    }
+
+    uint8_t scratch[1];
+    const uint8_t *len_bytes = flash_view(sfs, header->origin, scratch, sizeof(scratch));
+    if (len_bytes == NULL) {
+        return SFS_FLASH_READ;
+    }
+
+    uint8_t first = len_bytes[0];
+    if (first == FLASH_NO_DATA || (first != SFS_PADDING && data_len_committed(SFS_FORMAT_V2, first) == true) ||
+        (first == SFS_PADDING && header->records != SFS_UNSET)) {
+        // Committed, or dropped by earlier mount
+        return SFS_OK;
+    }
+
+    SFS_TRACE(SFS_TRACE_REPAIR, origin, header->origin);
+    if (first != SFS_PADDING) {
+        uint8_t padding = SFS_PADDING;
+        ret = device_write(sfs, header->origin, &padding, sizeof(padding));
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    // Summaries of these sectors wait for the commit, they are programmed now
+    uint32_t sector = origin;
+    for (uint32_t i = 0; i < entry->sectors; ++i) {
+        if (current.records == SFS_UNSET) {
+            uint32_t end = 0;
+            uint32_t records = 0;
+            uint32_t size = 0;
+            if (sector == origin) {
+                ret = scan_sector_data(sfs, sector, &current, &end, &records, &size, NULL);
+                if (ret != SFS_OK && ret != SFS_DATA_CORRUPTED && ret != SFS_DATA_SIZE_ZERO) {
+                    return ret;
+                }
+            }
+
+            ret = write_sector_counts(sfs, sector, &current, records, size);
+            SFS_RETURN_ON_ERR(ret);
+        }
+
+        if (sector == entry->last_sector) {
+            break;
+        }
+
+        ret = chain_next(sfs, sector, current.format, &sector);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (sector >= number_of_sectors(sfs)) {
+            return SFS_DATA_CORRUPTED;
+        }
+
+        ret = read_sector_header(sfs, sector, &current);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    *dropped = true;
+    return recount_file(sfs, entry);
+}
+
+/**
+ * @brief Finish writes interrupted by power loss in the last sector of a
+ * file, record torn or not committed before it was completed or linked to the
+ * next sector is covered by padding, next record starts in a new sector
+ */
+static sfs_err_t recover_tail(sfs_t *sfs, sfs_dir_entry_t *entry) {
+    sfs_err_t ret = recover_link(sfs, entry);
+    SFS_RETURN_ON_ERR(ret);
+
+    sector_header_t header;
+    ret = read_sector_header(sfs, entry->last_sector, &header);
+    SFS_RETURN_ON_ERR(ret);
+
+    bool dropped = false;
+    ret = drop_continued_record(sfs, entry, &header, &dropped);
+    SFS_RETURN_ON_ERR(ret);
+
+    uint32_t address = sector_to_address(sfs, entry->last_sector);
+    uint32_t data_end = sector_data_end(sfs, address, header.format);
+    if (dropped == true || header.format == SFS_FORMAT_LEGACY || header.records != SFS_UNSET ||
+        address + header.header_size + header.continuation >= data_end) {
+        // Closed or full sector
+        return SFS_OK;
+    }
+
+    uint32_t end = data_end;
+    uint32_t records = 0;
+    uint32_t size = 0;
+    uint32_t torn = SFS_UNSET;
+    ret = scan_sector_data(sfs, entry->last_sector, &header, &end, &records, &size, &torn);
+    if (ret != SFS_OK && ret != SFS_DATA_CORRUPTED && ret != SFS_DATA_SIZE_ZERO) {
+        return ret;
+    }
+
+    if (torn == SFS_UNSET && end < data_end) {
+        uint32_t programmed = data_end;
+        ret = find_programmed(sfs, end, data_end, &programmed);
+        SFS_RETURN_ON_ERR(ret);
+
+        torn = programmed < data_end ? end : SFS_UNSET;
+    }
+
+    if (torn == SFS_UNSET) {
+        return SFS_OK;
+    }
+
+    SFS_TRACE(SFS_TRACE_REPAIR, entry->last_sector, torn);
+    uint8_t padding = SFS_PADDING;
+    ret = device_write(sfs, torn, &padding, sizeof(padding));
+    SFS_RETURN_ON_ERR(ret);
+
+    uint32_t kept_records = 0;
+    uint32_t kept_size = 0;
+    ret = scan_sector_data(sfs, entry->last_sector, &header, &end, &kept_records, &kept_size, NULL);
+    SFS_RETURN_ON_ERR(ret);
+
+    entry->records -= records - kept_records;
+    entry->size -= size - kept_size;
+    entry->last_records = kept_records;
+    entry->last_size = kept_size;
+    entry->end_address = end;
+
+    return SFS_OK;
+}
+
+static sfs_err_t recover_tails(sfs_t *sfs) {
+    if (flash_writable(sfs) == false) {
+        return SFS_OK;
+    }
+
+    for (uint8_t i = 0; i < sfs->dir_count; ++i) {
+        sfs_err_t ret = recover_tail(sfs, &sfs->dir[i]);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    return SFS_OK;
+}
+
+static sfs_err_t mount_sectors(sfs_t *sfs) {
+    sfs->dir_count = 0;
+    sfs->next_created = 0;
+    sfs->free_map_valid = false;
+    sfs->chain_valid = false;
+
+    sfs_err_t ret;
+    bool free = false;
+    uint8_t matches[MOUNT_SCAN_SECTORS / 8U] = {0};
+    uint32_t sectors = number_of_sectors(sfs);
+    for (uint32_t sector = 0; sector < sectors; ++sector) {
+        if (sfs->map_base != NULL && sector % MOUNT_SCAN_SECTORS == 0) {
+            // Mapped flash, match magic of a block of headers at once
+            uint32_t count = sectors - sector < MOUNT_SCAN_SECTORS ? sectors - sector : MOUNT_SCAN_SECTORS;
+            (void) sfs_scan_headers(sfs->map_base + sector_to_address(sfs, sector), sfs->flash_sector_bits,
+                                    count, file_prefix, FILE_MAGIC_SIZE, matches);
+        }
+
+        chain_set(sfs, sector, CHAIN_NO_OWNER, SFS_UNSET);
+        uint32_t bit = sector % MOUNT_SCAN_SECTORS;
+        if (sfs->map_base == NULL || (matches[bit / 8U] & (1U << (bit % 8U))) != 0) {
+            ret = mount_sector(sfs, sector);
+            SFS_RETURN_ON_ERR(ret);
+        }
+
+        if (sfs->free_map != NULL) {
+            ret = sector_is_free(sfs, sector, &free);
+            SFS_RETURN_ON_ERR(ret);
+            free_map_set(sfs, sector, !free);
+        }
+    }
+    sfs->free_map_valid = sfs->free_map != NULL;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Newer valid copy of mount state, NULL if retention RAM holds
+ * none for this geometry
+ */
+static const sfs_snapshot_t *snapshot_find(sfs_t *sfs) {
+    const sfs_snapshot_t *found = NULL;
+    for (uint8_t i = 0; i < 2U; ++i) {
+        const sfs_snapshot_t *snapshot = &sfs->retention[i];
+        if (snapshot->magic != SFS_SNAPSHOT_MAGIC || snapshot->dir_count > SFS_MAX_FILES ||
+            snapshot->flash_size_bits != sfs->flash_size_bits ||
+            snapshot->flash_sector_bits != sfs->flash_sector_bits ||
+            snapshot->partition_address != sfs->partition_address ||
+            snapshot->device_count != sfs->device_count || snapshot_crc(snapshot) != snapshot->crc) {
+            continue;
+        }
+
+        if (found == NULL || snapshot->generation > found->generation) {
+            found = snapshot;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * @brief Check that sector header carries name of the file
+ */
+static sfs_err_t sector_owned(sfs_t *sfs, uint32_t sector, const sfs_dir_entry_t *entry,
+                              sector_header_t *header, bool *owned) {
+    *owned = false;
+    // File name is a part of the header, one read covers both
+    uint8_t scratch[SECTOR_HEADER_SIZE];
+    const uint8_t *bytes = flash_view(sfs, sector_to_address(sfs, sector), scratch, sizeof(scratch));
+    if (bytes == NULL) {
+        return SFS_FLASH_READ;
+    }
+
+    sfs_err_t ret = parse_sector_header(sfs, bytes, header);
+    if (ret == SFS_INVALID_PREFIX || ret == SFS_DATA_CORRUPTED) {
+        return SFS_OK;
+    }
+    SFS_RETURN_ON_ERR(ret);
+
+    *owned = header_torn(header, ret) == false &&
+             sfs_scan_equal(&bytes[FILE_PREFIX_SIZE], entry->name, MAX_FILE_NAME_SIZE) == true;
+    return SFS_OK;
+}
+
+/**
+ * @brief Check file from snapshot against flash, sectors are added only
+ * after the snapshot is dropped, so first and last sector have to be the
+ * same, records appended since the snapshot are counted again
+ *
+ * @param sfs
+ * @param entry
+ * @param valid false if flash does not match the snapshot
+ * @return sfs_err_t
+ */
+static sfs_err_t adopt_entry(sfs_t *sfs, sfs_dir_entry_t *entry, bool *valid) {
+    *valid = false;
+    uint32_t sectors = number_of_sectors(sfs);
+    if (entry->first_sector >= sectors || entry->last_sector >= sectors ||
+        (entry->ring_spare >= 0 && (uint32_t) entry->ring_spare >= sectors)) {
+        return SFS_OK;
+    }
+
+    sector_header_t header;
+    bool owned = false;
+    sfs_err_t ret = sector_owned(sfs, entry->first_sector, entry, &header, &owned);
+    SFS_RETURN_ON_ERR(ret);
+
+    uint32_t generation = header.generation == SFS_UNSET ? 0 : header.generation;
+    if (owned == false || generation != entry->generation) {
+        return SFS_OK;
+    }
+
+    ret = sector_owned(sfs, entry->last_sector, entry, &header, &owned);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (owned == false || (header.sequence != SFS_UNSET && header.sequence != entry->last_sequence)) {
+        return SFS_OK;
+    }
+
+    uint32_t next_sector = NO_NEXT_SECTOR;
+    ret = read_next_sector(sfs, sector_to_address(sfs, entry->last_sector), header.format, &next_sector);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (next_sector != NO_NEXT_SECTOR) {
+        // Rollover the snapshot does not know about
+        return SFS_OK;
+    }
+
+    uint32_t end = 0;
+    uint32_t records = 0;
+    uint32_t size = 0;
+    ret = sector_stats(sfs, entry->last_sector, &header, &end, &records, &size);
+    SFS_RETURN_ON_ERR(ret);
+
+    entry->records = entry->records - entry->last_records + records;
+    entry->size = entry->size - entry->last_size + size;
+    set_last_sector(sfs, entry, entry->last_sector, &header, records, size, end);
+    entry->prev_sector = SFS_UNSET;
+    entry->pending_record = SFS_UNSET;
+    entry->pending_sector = SFS_UNSET;
+    *valid = true;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Take mount state from retention RAM instead of scanning flash,
+ * only first and last sector of every file are read
+ *
+ * @param sfs
+ * @param adopted false if there is no valid snapshot or flash does not match it
+ * @return sfs_err_t
+ */
+static sfs_err_t snapshot_adopt(sfs_t *sfs, bool *adopted) {
+    *adopted = false;
+    const sfs_snapshot_t *snapshot = snapshot_find(sfs);
+    if (snapshot == NULL) {
+        return SFS_OK;
+    }
+
+    sfs->snapshot_generation = snapshot->generation;
+    sfs->dir_count = snapshot->dir_count;
+    sfs->next_created = snapshot->next_created;
+    sfs->next_free_sector = snapshot->next_free_sector;
+    sfs->free_map_valid = false;
+    sfs->chain_valid = false;
+    (void) memcpy(sfs->dir, snapshot->dir, snapshot->dir_count * sizeof(sfs_dir_entry_t));
+
+    sfs_err_t ret;
+    bool valid = true;
+    for (uint8_t i = 0; i < sfs->dir_count && valid == true; ++i) {
+        ret = adopt_entry(sfs, &sfs->dir[i], &valid);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    if (valid == false) {
+        return SFS_OK;
+    }
+
+    bool free = false;
+    for (uint8_t i = 0; i < sfs->dir_count; ++i) {
+        if (sfs->dir[i].ring_spare < 0) {
+            continue;
+        }
+
+        // Background erase of the detached sector was lost with reset
+        uint32_t sector = (uint32_t) sfs->dir[i].ring_spare;
+        ret = sector_is_free(sfs, sector, &free);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (free == true) {
+            continue;
+        } else if (sfs->io_count < SFS_IO_QUEUE_SIZE) {
+            sfs->io_queue[sfs->io_count] = sector;
+            sfs->io_count += 1;
+        } else {
+            ret = device_erase(sfs, sector);
+            SFS_RETURN_ON_ERR(ret);
+        }
+    }
+
+    free = false;
+    if (sfs->next_free_sector >= 0 && (uint32_t) sfs->next_free_sector < number_of_sectors(sfs)) {
+        ret = sector_is_free(sfs, sfs->next_free_sector, &free);
+        SFS_RETURN_ON_ERR(ret);
+    }
+    sfs->free_sector_valid = free;
+    *adopted = true;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Read every sector header once and build file directory,
+ * leftovers of interrupted compaction are erased
+ */
+static sfs_err_t mount_scan(sfs_t *sfs) {
+    sfs_err_t ret = mount_sectors(sfs);
+    SFS_RETURN_ON_ERR(ret);
+
+    bool erased = false;
+    ret = recover_compaction(sfs, &erased);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (erased == true) {
+        ret = mount_sectors(sfs);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    ret = recover_tails(sfs);
+    SFS_RETURN_ON_ERR(ret);
+
+    uint32_t sectors = number_of_sectors(sfs);
+
+    // Keep directory in creation order
+    uint8_t mount_index[SFS_MAX_FILES];
+    for (uint8_t i = 0; i < sfs->dir_count; ++i) {
+        mount_index[i] = i;
+    }
+    for (uint8_t i = 1; i < sfs->dir_count; ++i) {
+        sfs_dir_entry_t entry = sfs->dir[i];
+        uint8_t index = mount_index[i];
+        uint8_t j = i;
+        while (j > 0 && (sfs->dir[j - 1].created > entry.created ||
+               (sfs->dir[j - 1].created == entry.created &&
+                sfs->dir[j - 1].first_sector > entry.first_sector))) {
+            sfs->dir[j] = sfs->dir[j - 1];
+            mount_index[j] = mount_index[j - 1];
+            --j;
+        }
+        sfs->dir[j] = entry;
+        mount_index[j] = index;
+    }
+
+    if (sfs->chain_owner != NULL) {
+        // Owners were stored with directory index from before sorting
+        uint8_t sorted_index[SFS_MAX_FILES];
+        for (uint8_t i = 0; i < sfs->dir_count; ++i) {
+            sorted_index[mount_index[i]] = i;
+        }
+        for (uint32_t sector = 0; sector < sectors; ++sector) {
+            if (sfs->chain_owner[sector] != CHAIN_NO_OWNER) {
+                sfs->chain_owner[sector] = sorted_index[sfs->chain_owner[sector]];
+            }
+        }
+        sfs->chain_valid = true;
+    }
+
+    sfs->free_sector_valid = false;
+    return SFS_OK;
+}
+
+/**
+ * @brief Build file directory, from mount state in retention RAM if it
+ * matches flash, otherwise by reading every sector header once
+ * 
+ * @param sfs 
+ * @return sfs_err_t 
+ */
+sfs_err_t sfs_mount(sfs_t *sfs) {
+    if (sfs == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    // Queued sectors were not erased yet, they are found again as head of their files
+    io_finish_erase(sfs);
+    sfs->io_count = 0;
+    sfs->io_scan_pending = false;
+    sfs->compact_phase = SFS_COMPACT_IDLE;
+    sfs->mounted = false;
+
+    bool adopted = false;
+    sfs_err_t ret;
+    if (sfs->retention != NULL) {
+        ret = snapshot_adopt(sfs, &adopted);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    if (adopted == true) {
+        ret = recover_tails(sfs);
+    } else {
+        ret = mount_scan(sfs);
+    }
+    SFS_RETURN_ON_ERR(ret);
+
+    for (uint8_t i = 0; i < sfs->dir_count; ++i) {
+        if (sfs->dir[i].last_order < ((uint64_t) 1 << 32)) {
+            // Legacy last sector, new sectors continue after existing ones
+            sfs->dir[i].last_sequence = sfs->dir[i].sectors - 1;
+        }
+    }
+
+    sfs->mounted = true;
+    // Both copies hold the mounted state
+    snapshot_save(sfs);
+    snapshot_save(sfs);
+    SFS_TRACE(SFS_TRACE_MOUNT, sfs->dir_count, number_of_sectors(sfs));
+
+    return SFS_OK;
+}
+
+static sfs_err_t mount_if_needed(sfs_t *sfs) {
+    if (sfs->mounted == true) {
+        return SFS_OK;
+    }
+
+    return sfs_mount(sfs);
+}
+
+/**
+ * @brief Take the file from its directory entry without flash reads, read
+ * pointer is left at the end of file
+ */
+static void attach_file(sfs_t *sfs, sfs_file_t *file, uint8_t index) {
+    sfs_dir_entry_t *entry = &sfs->dir[index];
+    file->file_descriptor = index;
+    file->generation = entry->generation;
+    file->start_address = sector_to_address(sfs, entry->first_sector);
+    file->end_address = entry->end_address;
+    file->write_format = entry->last_format;
+    file->address_pointer = entry->end_address;
+    file->read_format = entry->last_format;
+}
+
+/**
+ * @brief Move read pointer to the first record of the file, record index
+ * starts again at 0
+ */
+static sfs_err_t rewind_file(sfs_t *sfs, sfs_file_t *file) {
+    sector_header_t header;
+    sfs_err_t ret = read_sector_header(sfs, address_to_sector(sfs, file->start_address), &header);
+    SFS_RETURN_ON_ERR(ret);
+
+    file->address_pointer = file->start_address + header.header_size + header.continuation;
+    file->read_format = header.format;
+    file->record_index = 0;
+
+    return SFS_OK;
+}
+
+static sfs_err_t new_file(sfs_t *sfs, sfs_file_t *file, const sfs_file_config_t *config,
+                          int32_t *index) {
+    int32_t sector = -1;
+    sfs_err_t ret;
+    if (sfs->free_sector_valid == false) {
+        // State from mount, next free sector was not looked for yet
+        ret = update_free_sector(sfs);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    ret = dir_add(sfs, file->name, index);
+    SFS_RETURN_ON_ERR(ret);
+
+    snapshot_invalidate(sfs);
+    sfs_dir_entry_t *entry = &sfs->dir[*index];
+    entry->created = sfs->next_created;
+    entry->ring_sectors = config != NULL ? config->ring_sectors : 0;
+    entry->extent_sectors = config != NULL ? config->extent_sectors : 0;
+    entry->extent_next = 0;
+    entry->extent_end = 0;
+    entry->kind = config != NULL ? config->flags & FILE_KINDS : 0;
+    entry->last_time_min = SFS_UNSET;
+    entry->last_time_max = 0;
+    entry->last_tags = 0;
+    ret = allocate_sector(sfs, entry, &sector);
+    if (ret == SFS_OK && sector < 0) {
+        ret = SFS_FLASH_FULL;
+    }
+
+    if (ret == SFS_OK) {
+        entry->first_sector = sector;
+        entry->last_sector = sector;
+        entry->sectors = 1;
+        ret = create_file(sfs, file, entry, sector, 0);
+    }
+
+    if (ret != SFS_OK) {
+        sfs->dir_count -= 1;
+        return ret;
+    }
+
+    entry->end_address = file->end_address;
+    sfs->next_created += 1;
+    SFS_TRACE(SFS_TRACE_CREATE, *index, sector);
+
+    if (sector != sfs->next_free_sector) {
+        // Sector came from extent, free sector is still valid
+        return SFS_OK;
+    }
+
+    if (sfs->io_scheduler == true) {
+        start_free_scan(sfs);
+        snapshot_save(sfs);
+        return SFS_OK;
+    }
+
+    return update_free_sector(sfs);
+}
+
+sfs_err_t sfs_open_ex(sfs_t *sfs, sfs_file_t *file, char *file_name, const sfs_file_config_t *config) {
+    sfs_err_t ret;
+    
+    ret = set_file_name(file, file_name);
+    SFS_RETURN_ON_ERR(ret);
+
+    file->tail = false;
+    file->tags = 0;
+    file->record_index = 0;
+    ret = mount_if_needed(sfs);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (config != NULL && config->ring_sectors == 1) {
+        return SFS_INVALID_VALUE;
+    }
+
+    int32_t index = dir_find(sfs, file->name);
+    bool created = index < 0;
+    uint32_t kind = config != NULL ? config->flags & FILE_KINDS : 0;
+    if (index >= 0 && kind != 0 && sfs->dir[index].kind != SFS_UNSET && sfs->dir[index].kind != kind) {
+        // File was created for other records
+        return SFS_INVALID_VALUE;
+    }
+
+    if (index >= 0) {
+        attach_file(sfs, file, (uint8_t) index);
+        ret = rewind_file(sfs, file);
+        SFS_RETURN_ON_ERR(ret);
+    } else if (config != NULL && (config->flags & SFS_OPEN_NO_CREATE) != 0) {
+        return SFS_FILE_NOT_FOUND;
+    } else {
+        ret = new_file(sfs, file, config, &index);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    if (config != NULL && config->ring_sectors != 0) {
+        // Budget of existing file changes for sectors created from now
+        sfs->dir[index].ring_sectors = config->ring_sectors;
+    }
+
+    if (config != NULL && config->extent_sectors != 0) {
+        // Takes effect when current extent is used up
+        sfs->dir[index].extent_sectors = config->extent_sectors;
+    }
+
+    file->file_descriptor = index;
+    file->generation = sfs->dir[index].generation;
+    SFS_TRACE(SFS_TRACE_OPEN, index, sfs->dir[index].first_sector);
+
+    // New file refreshed free sector after taking it
+    if (created == false && sfs->free_sector_valid == false) {
+        ret = update_free_sector(sfs);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    return SFS_OK;
+}
+
+sfs_err_t sfs_open(sfs_t *sfs, sfs_file_t *file, char *file_name) {
+    return sfs_open_ex(sfs, file, file_name, NULL);
+}
+
+/**
+ * @brief Open existing file from its directory entry, without flash reads and
+ * without free sector scan (done by allocation when needed), read pointer is
+ * left at the end of file, missing file is handled by sfs_open_ex
+ */
+static sfs_err_t open_attached(sfs_t *sfs, sfs_file_t *file, char *file_name,
+                               const sfs_file_config_t *config) {
+    sfs_err_t ret = set_file_name(file, file_name);
+    SFS_RETURN_ON_ERR(ret);
+
+    ret = mount_if_needed(sfs);
+    SFS_RETURN_ON_ERR(ret);
+
+    int32_t index = dir_find(sfs, file->name);
+    if (index < 0) {
+        return sfs_open_ex(sfs, file, file_name, config);
+    }
+
+    file->tail = false;
+    file->tags = 0;
+    file->record_index = 0;
+    attach_file(sfs, file, (uint8_t) index);
+    return SFS_OK;
+}
+
+bool is_open(sfs_file_t *file) {
+    (void) file;
+    return true;
+}
+
+static sfs_err_t read_next_sector(sfs_t *sfs, uint32_t address, uint8_t format, uint32_t *sector) {
+    uint8_t scratch[END_OF_SECTOR_SIZE];
+    uint32_t link_size = end_of_sector_size(format);
+    const uint8_t *link = flash_view(sfs, sector_data_end(sfs, address, format), scratch, link_size);
+    if (link == NULL) {
+        return SFS_FLASH_READ;
+    }
+
+    *sector = read_be(link, link_size);
+    if (format == SFS_FORMAT_LEGACY && *sector == NO_MORE_DATA) {
+        *sector = NO_NEXT_SECTOR;
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Next sector of the file, with chain index the link is checked
+ * against sequence order, damaged link or link lost by power cut during
+ * rollover is replaced by the sector with the next sequence number
+ * 
+ * @param sfs 
+ * @param sector 
+ * @param format format of sector
+ * @param next_sector NO_NEXT_SECTOR if sector is the last one
+ * @return sfs_err_t 
+ */
+static sfs_err_t chain_next(sfs_t *sfs, uint32_t sector, uint8_t format, uint32_t *next_sector) {
+    sfs_err_t ret = read_next_sector(sfs, sector_to_address(sfs, sector), format, next_sector);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (sfs->chain_valid == false || sfs->chain_owner[sector] == CHAIN_NO_OWNER ||
+        sfs->chain_sequence[sector] == SFS_UNSET) {
+        // Legacy sector or no index, link is the only source
+        return SFS_OK;
+    }
+
+    int32_t indexed = chain_find(sfs, sfs->chain_owner[sector], sfs->chain_sequence[sector] + 1U);
+    uint32_t expected = indexed >= 0 ? (uint32_t) indexed : NO_NEXT_SECTOR;
+    if (expected != *next_sector) {
+        SFS_TRACE(SFS_TRACE_RELINK, sector, expected);
+        *next_sector = expected;
+    }
+
+    return SFS_OK;
+}
+
+static sfs_err_t write_next_sector(sfs_t *sfs, uint32_t sector, uint8_t format, uint32_t next_sector) {
+    uint32_t link_size = end_of_sector_size(format);
+    uint8_t link[END_OF_SECTOR_SIZE];
+    write_be(link, next_sector, link_size);
+
+    uint32_t address = sector_data_end(sfs, sector_to_address(sfs, sector), format);
+    return device_write(sfs, address, link, link_size);
+}
+
+/**
+ * @brief Program summary of the sector into its header, so mount
+ * does not have to walk records of closed sectors and time seek
+ * can skip sectors outside of the requested time
+ * 
+ * @param sfs 
+ * @param sector 
+ * @param entry last_* counters of the file describe the sector
+ * @param counts false to leave records and size for commit of the pending record
+ * @return sfs_err_t 
+ */
+static sfs_err_t write_sector_summary(sfs_t *sfs, uint32_t sector, sfs_dir_entry_t *entry, bool counts) {
+    sector_header_t header;
+    sfs_err_t ret = read_sector_header(sfs, sector, &header);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (header.format == SFS_FORMAT_LEGACY || header.header_size < SIZE_OFFSET + 4U) {
+        // Sector without summary fields
+        return SFS_OK;
+    }
+
+    if (counts == true) {
+        ret = write_sector_counts(sfs, sector, &header, entry->last_records, entry->last_size);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    uint8_t summary[8];
+    uint32_t address;
+    if (entry->last_time_min <= entry->last_time_max && header.header_size >= TIME_MAX_OFFSET + 4U) {
+        write_be(summary, entry->last_time_min, 4);
+        write_be(&summary[4], entry->last_time_max, 4);
+        address = sector_to_address(sfs, sector) + TIME_MIN_OFFSET;
+        ret = device_write(sfs, address, summary, sizeof(summary));
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    if (entry->last_tags == 0 || entry->last_tags == SFS_UNSET || header.header_size < TAGS_OFFSET + 4U) {
+        // No tagged records in sector, or tags of reopened sector are unknown
+        return SFS_OK;
+    }
+
+    write_be(summary, entry->last_tags, 4);
+    address = sector_to_address(sfs, sector) + TAGS_OFFSET;
+    return device_write(sfs, address, summary, 4);
+}
+
+/**
+ * @brief Remove the oldest sector from ring file and move file head to the next one,
+ * sector still has to be erased
+ * 
+ * @param sfs 
+ * @param file writer, its start address follows the head
+ * @param sector removed sector
+ * @return sfs_err_t 
+ */
+static sfs_err_t detach_first_sector(sfs_t *sfs, sfs_file_t *file, int32_t *sector) {
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    sector_header_t header;
+    sfs_err_t ret = read_sector_header(sfs, entry->first_sector, &header);
+    SFS_RETURN_ON_ERR(ret);
+
+    uint32_t records = header.records;
+    uint32_t size = header.size;
+    if (records == SFS_UNSET || size == SFS_UNSET) {
+        uint32_t end;
+        ret = scan_sector_data(sfs, entry->first_sector, &header, &end, &records, &size, NULL);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    uint32_t next_sector;
+    ret = chain_next(sfs, entry->first_sector, header.format, &next_sector);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (next_sector >= number_of_sectors(sfs)) {
+        return SFS_DATA_CORRUPTED;
+    }
+
+    SFS_TRACE(SFS_TRACE_RECYCLE, entry->first_sector, next_sector);
+    chain_set(sfs, entry->first_sector, CHAIN_NO_OWNER, SFS_UNSET);
+    *sector = entry->first_sector;
+    entry->first_sector = next_sector;
+    entry->sectors -= 1;
+    entry->records -= records;
+    entry->size -= size;
+    if (file->start_address == sector_to_address(sfs, *sector)) {
+        file->start_address = sector_to_address(sfs, next_sector);
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Make sure sector from background queue is erased, erase it now if
+ * sfs_poll did not get to it yet
+ */
+static sfs_err_t io_wait_erase(sfs_t *sfs, uint32_t sector) {
+    if (sfs->io_erasing == (int32_t) sector) {
+        io_finish_erase(sfs);
+        return SFS_OK;
+    }
+
+    for (uint8_t i = 0; i < sfs->io_count; ++i) {
+        if (sfs->io_queue[i] == sector) {
+            sfs->io_count -= 1;
+            (void) memmove(&sfs->io_queue[i], &sfs->io_queue[i + 1],
+                           (sfs->io_count - i) * sizeof(sfs->io_queue[0]));
+            return device_erase(sfs, sector);
+        }
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Detach the oldest sector of ring file which reached its budget
+ * and queue it for background erase, it becomes the next sector of the file
+ */
+static sfs_err_t prepare_ring_spare(sfs_t *sfs, sfs_file_t *file) {
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    if (entry->ring_sectors == 0 || entry->sectors < entry->ring_sectors ||
+        entry->ring_spare >= 0 || sfs->io_count >= SFS_IO_QUEUE_SIZE) {
+        return SFS_OK;
+    }
+
+    int32_t sector;
+    sfs_err_t ret = detach_first_sector(sfs, file, &sector);
+    SFS_RETURN_ON_ERR(ret);
+
+    sfs->io_queue[sfs->io_count] = sector;
+    sfs->io_count += 1;
+    entry->ring_spare = sector;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Create next sector of the file, then close and link the current one,
+ * ring files reuse their oldest sector when budget is reached or flash is full
+ * 
+ * @param sfs 
+ * @param file 
+ * @param remaining bytes of the current record which have to be written to new sector
+ * @return sfs_err_t 
+ */
+static sfs_err_t open_next_sector(sfs_t *sfs, sfs_file_t *file, uint32_t remaining) {
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    int32_t next_sector = -1;
+    uint32_t tail_sector = entry->last_sector;
+    uint8_t tail_format = file->write_format;
+    sfs_err_t ret;
+
+    snapshot_invalidate(sfs);
+    bool ring = entry->ring_sectors != 0 && entry->sectors > 1;
+    bool recycle = ring == true && entry->sectors >= entry->ring_sectors;
+    bool spare = entry->ring_spare >= 0;
+    if (spare == true) {
+        // Oldest sector was erased in background
+        next_sector = entry->ring_spare;
+        entry->ring_spare = -1;
+        ret = io_wait_erase(sfs, next_sector);
+        SFS_RETURN_ON_ERR(ret);
+        recycle = false;
+    } else if (recycle == false) {
+        ret = allocate_sector(sfs, entry, &next_sector);
+        SFS_RETURN_ON_ERR(ret);
+
+        recycle = ring == true && next_sector < 0;
+    }
+
+    if (recycle == true) {
+        ret = detach_first_sector(sfs, file, &next_sector);
+        SFS_RETURN_ON_ERR(ret);
+
+        ret = device_erase(sfs, next_sector);
+        SFS_RETURN_ON_ERR(ret);
+    } else if (next_sector < 0) {
+        return SFS_FLASH_FULL;
+    }
+
+    if (tail_format == SFS_FORMAT_LEGACY && next_sector >= NO_MORE_DATA) {
+        return SFS_INVALID_VALUE;
+    }
+
+    SFS_TRACE(SFS_TRACE_ROLLOVER, tail_sector, next_sector);
+    
+    // open new sector, sector is created before it is linked, so interrupted
+    // rollover never leaves a link to an erased sector
+    uint32_t continuation = remaining;
+    if (continuation > sector_data_capacity(sfs)) {
+        continuation = sector_data_capacity(sfs);
+    }
+
+    entry->last_sequence += 1;
+    uint32_t file_start_address = file->start_address;
+    uint32_t file_address_pointer = file->address_pointer;
+    uint8_t file_read_format = file->read_format;
+    ret = create_file(sfs, file, entry, next_sector, continuation);
+    
+    file->start_address = file_start_address;
+    file->address_pointer = file_address_pointer;
+    file->read_format = file_read_format;
+    SFS_RETURN_ON_ERR(ret);
+
+    // Record which continues in the new sector is not committed yet, mount
+    // must not count it if it never is
+    if (remaining > 0 && entry->pending_sector == SFS_UNSET) {
+        entry->pending_sector = tail_sector;
+        entry->pending_records = entry->last_records;
+        entry->pending_size = entry->last_size;
+    }
+    ret = write_sector_summary(sfs, tail_sector, entry, remaining == 0);
+    SFS_RETURN_ON_ERR(ret);
+
+    ret = write_next_sector(sfs, tail_sector, tail_format, next_sector);
+    SFS_RETURN_ON_ERR(ret);
+
+    entry->last_sector = next_sector;
+    entry->sectors += 1;
+    entry->last_records = 0;
+    entry->last_size = 0;
+    entry->last_time_min = SFS_UNSET;
+    entry->last_time_max = 0;
+    entry->last_tags = 0;
+    entry->end_address = file->end_address;
+
+    if (sfs->io_scheduler == true) {
+        ret = prepare_ring_spare(sfs, file);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    if (recycle == true || spare == true || (next_sector != sfs->next_free_sector &&
+                            sector_reserved(sfs, sfs->next_free_sector) == false)) {
+        // Sector came from extent, free sector is still valid
+        snapshot_save(sfs);
+        return SFS_OK;
+    }
+
+    if (sfs->io_scheduler == true) {
+        // Scan is done in slices by sfs_poll, or on next allocation
+        start_free_scan(sfs);
+        snapshot_save(sfs);
+        return SFS_OK;
+    }
+
+    // find new free sector
+    ret = update_free_sector(sfs);
+    SFS_RETURN_ON_ERR(ret);
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Write part of record data, new sectors are opened when current one is full
+ * 
+ * @param sfs 
+ * @param file 
+ * @param data 
+ * @param size 
+ * @param after record bytes which follow this part
+ * @return sfs_err_t 
+ */
+static sfs_err_t write_record_data(sfs_t *sfs, sfs_file_t *file, uint8_t *data, uint32_t size,
+                                   uint32_t after) {
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    sfs_err_t ret;
+    while (size > 0) {
+        uint32_t write_size = sector_data_end(sfs, file->end_address, file->write_format) -
+                              file->end_address;
+        if (write_size == 0) {
+            // end of sector
+            ret = open_next_sector(sfs, file, size + after);
+            SFS_RETURN_ON_ERR(ret);
+            continue;
+        }
+
+        if (write_size > size) {
+            write_size = size;
+        }
+
+        ret = write_bytes(sfs, file, data, write_size);
+        SFS_RETURN_ON_ERR(ret);
+
+        entry->size += write_size;
+        entry->last_size += write_size;
+        entry->end_address = file->end_address;
+        data += write_size;
+        size -= write_size;
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Write length of record of size bytes, record data follows by write_record_data
+ * 
+ * @param sfs 
+ * @param file open file
+ * @param size record data size including time and tag
+ * @return sfs_err_t 
+ */
+static sfs_err_t begin_record(sfs_t *sfs, sfs_file_t *file, uint32_t size) {
+    sfs_err_t ret;
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    if (file->generation != entry->generation) {
+        // File was compacted, writer continues at the end of the copy,
+        // read position stays stale until seek
+        file->end_address = entry->end_address;
+        file->write_format = SFS_FORMAT_V2;
+    }
+
+    uint8_t len_bytes[DATA_LEN_MAX_SIZE];
+    uint8_t len_size = encode_data_len(size, false, len_bytes);
+
+    // Length has to fit in one sector with at least one byte of data,
+    // sectors of older formats are only closed, new data always goes to the new format
+    uint32_t sector_free_size = sector_data_end(sfs, file->end_address, file->write_format) -
+                                file->end_address;
+    if (file->write_format != SFS_FORMAT_V2 || sector_free_size < len_size + 1U) {
+        if (file->write_format != SFS_FORMAT_LEGACY && sector_free_size > 0) {
+            uint8_t padding = SFS_PADDING;
+            ret = write_bytes(sfs, file, &padding, sizeof(padding));
+            SFS_RETURN_ON_ERR(ret);
+        }
+
+        ret = open_next_sector(sfs, file, 0);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    entry->pending_record = file->end_address;
+    entry->pending_commit = len_bytes[0] & (uint8_t) ~data_len_commit_bit(len_bytes[0]);
+    ret = write_bytes(sfs, file, len_bytes, len_size);
+    SFS_RETURN_ON_ERR(ret);
+
+    entry->records += 1;
+    entry->last_records += 1;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Clear commit bit of the record started by begin_record once all its
+ * data is programmed, then program summaries of sectors closed in the middle
+ * of the record, the first one with counters from its close, the rest hold
+ * only continuation
+ */
+static sfs_err_t commit_record(sfs_t *sfs, sfs_dir_entry_t *entry) {
+    if (entry->pending_record == SFS_UNSET) {
+        return SFS_OK;
+    }
+
+    sfs_err_t ret = device_write(sfs, entry->pending_record, &entry->pending_commit, 1);
+    SFS_RETURN_ON_ERR(ret);
+
+    uint32_t sector = entry->pending_sector;
+    entry->pending_record = SFS_UNSET;
+    entry->pending_sector = SFS_UNSET;
+    bool first = true;
+    while (sector != SFS_UNSET && sector != entry->last_sector && sector < number_of_sectors(sfs)) {
+        sector_header_t header;
+        ret = read_sector_header(sfs, sector, &header);
+        SFS_RETURN_ON_ERR(ret);
+
+        ret = write_sector_counts(sfs, sector, &header, first == true ? entry->pending_records : 0,
+                                  first == true ? entry->pending_size : header.continuation);
+        SFS_RETURN_ON_ERR(ret);
+
+        ret = chain_next(sfs, sector, header.format, &sector);
+        SFS_RETURN_ON_ERR(ret);
+        first = false;
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Write record, timed records start with 4 byte timestamp,
+ * tagged records with 1 byte tag
+ * 
+ * @param sfs 
+ * @param file 
+ * @param time timestamp, NULL for regular record
+ * @param tag stream tag, NULL for untagged record
+ * @param data 
+ * @param size 
+ * @return sfs_err_t 
+ */
+static sfs_err_t write_record(sfs_t *sfs, sfs_file_t *file, const uint32_t *time, const uint8_t *tag,
+                              uint8_t *data, uint32_t size) {
+    uint8_t time_bytes[SFS_TIME_SIZE];
+    uint32_t prefix_size = (time != NULL ? SFS_TIME_SIZE : 0) + (tag != NULL ? SFS_TAG_SIZE : 0);
+    if (is_open(file) == false) {
+        return SFS_FILE_NOT_OPEN;
+    }
+
+    if (size == 0) {
+        return SFS_DATA_SIZE_ZERO;
+    }
+
+    if (size > SFS_MAX_RECORD_SIZE - prefix_size) {
+        return SFS_INVALID_SIZE;
+    }
+
+    sfs_err_t ret = begin_record(sfs, file, size + prefix_size);
+    SFS_RETURN_ON_ERR(ret);
+
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    if (time != NULL) {
+        // Record belongs to the zone of sector where it starts
+        if (*time < entry->last_time_min) {
+            entry->last_time_min = *time;
+        }
+        if (*time > entry->last_time_max) {
+            entry->last_time_max = *time;
+        }
+
+        write_be(time_bytes, *time, SFS_TIME_SIZE);
+        ret = write_record_data(sfs, file, time_bytes, SFS_TIME_SIZE, size + prefix_size - SFS_TIME_SIZE);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    if (tag != NULL) {
+        // Unknown tags of reopened sector stay unknown
+        if (entry->last_tags != SFS_UNSET) {
+            entry->last_tags |= SFS_TAG(*tag);
+        }
+
+        ret = write_record_data(sfs, file, (uint8_t *) tag, SFS_TAG_SIZE, size);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    ret = write_record_data(sfs, file, data, size, 0);
+    SFS_RETURN_ON_ERR(ret);
+
+    ret = commit_record(sfs, entry);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (entry->tail_fnc != NULL) {
+        entry->tail_fnc(entry->tail_arg);
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Check that file takes records of kind, files written before kinds
+ * were stored take any record
+ */
+static sfs_err_t check_kind(sfs_t *sfs, sfs_file_t *file, uint32_t kind) {
+    uint32_t file_kind = sfs->dir[file->file_descriptor].kind;
+    if (file_kind != SFS_UNSET && file_kind != kind) {
+        return SFS_INVALID_VALUE;
+    }
+
+    return SFS_OK;
+}
+
+sfs_err_t sfs_write(sfs_t *sfs, sfs_file_t *file, uint8_t *data, uint32_t size) {
+    sfs_err_t ret = check_kind(sfs, file, 0);
+    SFS_RETURN_ON_ERR(ret);
+
+    return write_record(sfs, file, NULL, NULL, data, size);
+}
+
+/**
+ * @brief Write record with timestamp, record data read back starts with
+ * 4 byte big endian timestamp, file has to be opened with SFS_OPEN_TIMED,
+ * so every record of it is timed
+ * 
+ * @param sfs 
+ * @param file 
+ * @param time 
+ * @param data 
+ * @param size 
+ * @return sfs_err_t SFS_INVALID_VALUE if file takes other records
+ */
+sfs_err_t sfs_write_timed(sfs_t *sfs, sfs_file_t *file, uint32_t time, uint8_t *data, uint32_t size) {
+    sfs_err_t ret = check_kind(sfs, file, SFS_OPEN_TIMED);
+    SFS_RETURN_ON_ERR(ret);
+
+    return write_record(sfs, file, &time, NULL, data, size);
+}
+
+/**
+ * @brief Write record of one of multiplexed streams of the file, record data
+ * read back starts with the tag, sectors keep bitmap of tags of their records
+ * so reads filtered by sfs_select_tags skip sectors without selected streams,
+ * file has to be opened with SFS_OPEN_TAGGED, so every record of it is tagged
+ * 
+ * @param sfs 
+ * @param file 
+ * @param tag stream, less than SFS_MAX_TAGS
+ * @param data 
+ * @param size 
+ * @return sfs_err_t SFS_INVALID_VALUE if file takes other records
+ */
+sfs_err_t sfs_write_tagged(sfs_t *sfs, sfs_file_t *file, uint8_t tag, uint8_t *data, uint32_t size) {
+    if (tag >= SFS_MAX_TAGS) {
+        return SFS_INVALID_VALUE;
+    }
+
+    sfs_err_t ret = check_kind(sfs, file, SFS_OPEN_TAGGED);
+    SFS_RETURN_ON_ERR(ret);
+
+    return write_record(sfs, file, NULL, &tag, data, size);
+}
+
+/**
+ * @brief Start record of size bytes whose data is given by sfs_object_append,
+ * the file takes no other record until sfs_object_end
+ * 
+ * @param sfs 
+ * @param file 
+ * @param object buffer and buffer_size set by caller, rest is initialized
+ * @param size object data size, length is written first so it has to be known
+ * @return sfs_err_t 
+ */
+sfs_err_t sfs_object_begin(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object, uint32_t size) {
+    if (sfs == NULL || file == NULL || object == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (is_open(file) == false) {
+        return SFS_FILE_NOT_OPEN;
+    }
+
+    if (object->buffer == NULL && object->buffer_size > 0) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (size == 0) {
+        return SFS_DATA_SIZE_ZERO;
+    }
+
+    if (size > SFS_MAX_RECORD_SIZE) {
+        return SFS_INVALID_SIZE;
+    }
+
+    sfs_err_t ret = check_kind(sfs, file, 0);
+    SFS_RETURN_ON_ERR(ret);
+
+    ret = begin_record(sfs, file, size);
+    SFS_RETURN_ON_ERR(ret);
+
+    object->size = size;
+    object->offset = 0;
+    object->buffered = 0;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Bytes of object which go to flash in one program, up to the end of
+ * the buffer_size block or of the sector, sector is opened when current one is full
+ */
+static sfs_err_t object_piece(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object, uint32_t *piece) {
+    uint32_t data_end = sector_data_end(sfs, file->end_address, file->write_format);
+    if (file->end_address == data_end) {
+        // Nothing is buffered at sector end, continuation is the whole rest
+        sfs_err_t ret = open_next_sector(sfs, file, object->size - object->offset);
+        SFS_RETURN_ON_ERR(ret);
+
+        data_end = sector_data_end(sfs, file->end_address, file->write_format);
+    }
+
+    *piece = data_end - file->end_address;
+    if (object->buffer_size > 0) {
+        uint32_t block_left = object->buffer_size - file->end_address % object->buffer_size;
+        if (block_left < *piece) {
+            *piece = block_left;
+        }
+    }
+
+    return SFS_OK;
+}
+
+static sfs_err_t object_flush(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object) {
+    sfs_err_t ret = write_record_data(sfs, file, object->buffer, object->buffered,
+                                      object->size - object->offset);
+    SFS_RETURN_ON_ERR(ret);
+
+    object->buffered = 0;
+    return SFS_OK;
+}
+
+/**
+ * @brief Add data to object started by sfs_object_begin, with buffer every
+ * program but the last one fills flash up to buffer_size boundary, pieces
+ * which cover a whole block are programmed from data without copy
+ * 
+ * @param sfs 
+ * @param file 
+ * @param object 
+ * @param data 
+ * @param size 
+ * @return sfs_err_t SFS_INVALID_SIZE if data does not fit in object size
+ */
+sfs_err_t sfs_object_append(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object, const uint8_t *data,
+                            uint32_t size) {
+    if (sfs == NULL || file == NULL || object == NULL || data == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (is_open(file) == false) {
+        return SFS_FILE_NOT_OPEN;
+    }
+
+    if (size > object->size - object->offset) {
+        return SFS_INVALID_SIZE;
+    }
+
+    sfs_err_t ret;
+    while (size > 0) {
+        uint32_t piece;
+        ret = object_piece(sfs, file, object, &piece);
+        SFS_RETURN_ON_ERR(ret);
+
+        uint32_t part;
+        if (object->buffer == NULL || (object->buffered == 0 && size >= piece)) {
+            part = size < piece ? size : piece;
+            ret = write_record_data(sfs, file, (uint8_t *) data, part, object->size - object->offset - part);
+            SFS_RETURN_ON_ERR(ret);
+
+            object->offset += part;
+        } else {
+            part = piece - object->buffered;
+            if (part > size) {
+                part = size;
+            }
+            memcpy(object->buffer + object->buffered, data, part);
+            object->buffered += part;
+            object->offset += part;
+            if (object->buffered == piece) {
+                ret = object_flush(sfs, file, object);
+                SFS_RETURN_ON_ERR(ret);
+            }
+        }
+
+        data += part;
+        size -= part;
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Program buffered rest of object, commit it and notify tail readers
+ * 
+ * @param sfs 
+ * @param file 
+ * @param object 
+ * @return sfs_err_t SFS_INVALID_SIZE if less than object size was appended
+ */
+sfs_err_t sfs_object_end(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object) {
+    if (sfs == NULL || file == NULL || object == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (is_open(file) == false) {
+        return SFS_FILE_NOT_OPEN;
+    }
+
+    if (object->offset != object->size) {
+        return SFS_INVALID_SIZE;
+    }
+
+    sfs_err_t ret;
+    if (object->buffered > 0) {
+        ret = object_flush(sfs, file, object);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    ret = commit_record(sfs, entry);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (entry->tail_fnc != NULL) {
+        entry->tail_fnc(entry->tail_arg);
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Move cursor to the first data byte of the next sector in chain
+ * 
+ * @param sfs 
+ * @param cursor address in current sector
+ * @param format current sector format, set to next sector format
+ * @param record_start cursor is between records, continuation is skipped, it
+ * is left only by record dropped by mount
+ * @return sfs_err_t SFS_EOF if there is no next sector
+ */
+static sfs_err_t move_ptr_to_next_sector(sfs_t *sfs, uint32_t *cursor, uint8_t *format, bool record_start) {
+    uint32_t sector;
+    sfs_err_t ret = chain_next(sfs, address_to_sector(sfs, *cursor), *format, &sector);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (sector == NO_NEXT_SECTOR) {
+        return SFS_EOF;
+    }
+
+    if (sector >= number_of_sectors(sfs)) {
+        return SFS_DATA_CORRUPTED;
+    }
+
+    sector_header_t header;
+    ret = read_sector_header(sfs, sector, &header);
+    if (ret == SFS_INVALID_PREFIX) {
+        return SFS_DATA_CORRUPTED;
+    }
+    SFS_RETURN_ON_ERR(ret);
+
+    *cursor = sector_to_address(sfs, sector) + header.header_size;
+    *cursor += record_start == true ? header.continuation : 0;
+    *format = header.format;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Read length of the record under cursor, move cursor to record data
+ * 
+ * @param sfs 
+ * @param cursor 
+ * @param format 
+ * @param size record length
+ * @return sfs_err_t SFS_EOF if there are no more records
+ */
+static sfs_err_t read_data_len(sfs_t *sfs, uint32_t *cursor, uint8_t *format, uint32_t *size) {
+    uint8_t scratch[DATA_LEN_MAX_SIZE];
+    uint8_t len_size;
+    sfs_err_t ret;
+
+    while (true) {
+        uint32_t data_end = sector_data_end(sfs, *cursor, *format);
+        if (*cursor > data_end) {
+            return SFS_DATA_CORRUPTED;
+        }
+
+        if (*cursor == data_end) {
+            ret = move_ptr_to_next_sector(sfs, cursor, format, true);
+            SFS_RETURN_ON_ERR(ret);
+            continue;
+        }
+
+        uint32_t view_size = *format == SFS_FORMAT_LEGACY ? LEGACY_DATA_LEN_SIZE : DATA_LEN_MAX_SIZE;
+        ret = burst_prefetch(sfs, *cursor, view_size);
+        SFS_RETURN_ON_ERR(ret);
+
+        const uint8_t *len_bytes = flash_view(sfs, *cursor, scratch, view_size);
+        if (len_bytes == NULL) {
+            return SFS_FLASH_READ;
+        }
+
+        if (*format == SFS_FORMAT_LEGACY) {
+            *size = read_be(len_bytes, LEGACY_DATA_LEN_SIZE);
+            len_size = LEGACY_DATA_LEN_SIZE;
+            if (*size == 0) {
+                return SFS_DATA_CORRUPTED;
+            }
+
+            if (*size == NO_MORE_DATA) {
+                // Sector could be closed before it was full
+                ret = move_ptr_to_next_sector(sfs, cursor, format, true);
+                SFS_RETURN_ON_ERR(ret);
+                continue;
+            }
+        } else {
+            if (len_bytes[0] == FLASH_NO_DATA) {
+                ret = move_ptr_to_next_sector(sfs, cursor, format, true);
+                SFS_RETURN_ON_ERR(ret);
+                continue;
+            }
+
+            if (len_bytes[0] == SFS_PADDING) {
+                *cursor = data_end;
+                continue;
+            }
+
+            ret = decode_data_len(*format, len_bytes, size, &len_size);
+            if (ret != SFS_OK) {
+                return SFS_DATA_CORRUPTED;
+            }
+
+            if (data_len_committed(*format, len_bytes[0]) == false) {
+                // Record is still being written
+                return SFS_EOF;
+            }
+        }
+
+        if (*cursor + len_size > data_end) {
+            return SFS_DATA_CORRUPTED;
+        }
+
+        *cursor += len_size;
+        return SFS_OK;
+    }
+}
+
+/**
+ * @brief Read record data, which can span multiple sectors
+ * 
+ * @param sfs 
+ * @param cursor 
+ * @param format 
+ * @param buffer NULL to skip data
+ * @param size 
+ * @return sfs_err_t 
+ */
+static sfs_err_t read_data(sfs_t *sfs, uint32_t *cursor, uint8_t *format, uint8_t *buffer, uint32_t size) {
+    sfs_err_t ret;
+    while (size > 0) {
+        uint32_t data_end = sector_data_end(sfs, *cursor, *format);
+        if (*cursor == data_end) {
+            ret = move_ptr_to_next_sector(sfs, cursor, format, false);
+            if (ret == SFS_EOF) {
+                return SFS_DATA_CORRUPTED;
+            }
+            SFS_RETURN_ON_ERR(ret);
+
+            if (*format == SFS_FORMAT_LEGACY) {
+                return SFS_DATA_CORRUPTED;
+            }
+            continue;
+        }
+
+        if (*format == SFS_FORMAT_LEGACY && *cursor + size > data_end) {
+            return SFS_DATA_CORRUPTED;
+        }
+
+        uint32_t read_size = data_end - *cursor;
+        if (read_size > size) {
+            read_size = size;
+        }
+
+        if (buffer != NULL) {
+            ret = burst_prefetch(sfs, *cursor, read_size);
+            SFS_RETURN_ON_ERR(ret);
+
+            ret = flash_read(sfs, *cursor, buffer, read_size);
+            SFS_RETURN_ON_ERR(ret);
+            buffer += read_size;
+        }
+
+        *cursor += read_size;
+        size -= read_size;
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Decode sector header, for tools which inspect flash images
+ * 
+ * @param sfs 
+ * @param sector 
+ * @param info 
+ * @return sfs_err_t SFS_INVALID_PREFIX if sector does not belong to any file
+ */
+sfs_err_t sfs_sector_info(sfs_t *sfs, uint32_t sector, sfs_sector_info_t *info) {
+    if (sfs == NULL || info == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (sector >= number_of_sectors(sfs)) {
+        return SFS_INVALID_VALUE;
+    }
+
+    sector_header_t header;
+    sfs_err_t ret = read_sector_header(sfs, sector, &header);
+    SFS_RETURN_ON_ERR(ret);
+
+    uint8_t name[MAX_FILE_NAME_SIZE];
+    ret = flash_read(sfs, sector_to_address(sfs, sector) + FILE_PREFIX_SIZE, name, sizeof(name));
+    SFS_RETURN_ON_ERR(ret);
+
+    (void) memset(info, SFS_EMPTY_VALUE, sizeof(sfs_sector_info_t));
+    for (uint8_t i = 0; i < MAX_FILE_NAME_SIZE - 1; ++i) {
+        if (name[i] == FLASH_NO_DATA || name[i] == '\0') {
+            break;
+        }
+        info->name[i] = (char) name[i];
+    }
+
+    info->format = header.format;
+    info->sequence = header.sequence;
+    info->created = header.created;
+    info->first_record = sector_to_address(sfs, sector) + header.header_size + header.continuation;
+    info->tags = header.tags;
+
+    return read_next_sector(sfs, info->first_record, header.format, &info->next_sector);
+}
+
+/**
+ * @brief Move file read pointer to the first record which starts in sector,
+ * record index of file is reset to 0, records before sector are not counted
+ * 
+ * @param sfs 
+ * @param file 
+ * @param sector sector which belongs to file
+ * @return sfs_err_t SFS_INVALID_FILE_NAME if sector belongs to other file
+ */
+sfs_err_t sfs_seek_sector(sfs_t *sfs, sfs_file_t *file, uint32_t sector) {
+    if (sfs == NULL || file == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (sector >= number_of_sectors(sfs)) {
+        return SFS_INVALID_VALUE;
+    }
+
+    sector_header_t header;
+    sfs_err_t ret = read_sector_header(sfs, sector, &header);
+    SFS_RETURN_ON_ERR(ret);
+
+    uint8_t name[MAX_FILE_NAME_SIZE];
+    ret = flash_read(sfs, sector_to_address(sfs, sector) + FILE_PREFIX_SIZE, name, sizeof(name));
+    SFS_RETURN_ON_ERR(ret);
+
+    if (sfs_scan_equal(name, file->name, sizeof(name)) == false) {
+        return SFS_INVALID_FILE_NAME;
+    }
+
+    file->address_pointer = sector_to_address(sfs, sector) + header.header_size + header.continuation;
+    file->read_format = header.format;
+    file->generation = sfs->dir[file->file_descriptor].generation;
+    file->record_index = 0;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Find first timed record in sector with timestamp at or after time
+ * 
+ * @param sfs 
+ * @param file read pointer is set to found record
+ * @param sector 
+ * @param header 
+ * @param time 
+ * @return sfs_err_t SFS_EOF if no record which starts in sector matches
+ */
+static sfs_err_t seek_time_in_sector(sfs_t *sfs, sfs_file_t *file, uint32_t sector,
+                                     sector_header_t *header, uint32_t time) {
+    uint8_t scratch[DATA_LEN_MAX_SIZE];
+    uint8_t time_bytes[SFS_TIME_SIZE];
+    uint32_t cursor = sector_to_address(sfs, sector) + header->header_size + header->continuation;
+    uint32_t data_end = sector_data_end(sfs, cursor, header->format);
+    sfs_err_t ret;
+
+    if (header->format == SFS_FORMAT_LEGACY) {
+        // Timed records are never written to legacy sectors
+        return SFS_EOF;
+    }
+
+    while (cursor < data_end) {
+        ret = burst_prefetch(sfs, cursor, sizeof(scratch));
+        SFS_RETURN_ON_ERR(ret);
+
+        const uint8_t *len_bytes = flash_view(sfs, cursor, scratch, 1);
+        if (len_bytes == NULL) {
+            return SFS_FLASH_READ;
+        }
+
+        if (len_bytes[0] == FLASH_NO_DATA || len_bytes[0] == SFS_PADDING) {
+            return SFS_EOF;
+        }
+
+        uint32_t record_cursor = cursor;
+        uint8_t format = header->format;
+        uint32_t record_size;
+        ret = read_data_len(sfs, &record_cursor, &format, &record_size);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (record_size < SFS_TIME_SIZE) {
+            return SFS_DATA_CORRUPTED;
+        }
+
+        ret = read_data(sfs, &record_cursor, &format, time_bytes, sizeof(time_bytes));
+        SFS_RETURN_ON_ERR(ret);
+
+        if (read_be(time_bytes, SFS_TIME_SIZE) >= time) {
+            file->address_pointer = cursor;
+            file->read_format = header->format;
+            file->generation = sfs->dir[file->file_descriptor].generation;
+            return SFS_OK;
+        }
+
+        ret = read_data(sfs, &record_cursor, &format, NULL, record_size - SFS_TIME_SIZE);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (address_to_sector(sfs, record_cursor) != sector) {
+            // Record continues in the next sector, no more records start here
+            return SFS_EOF;
+        }
+        cursor = record_cursor;
+    }
+
+    return SFS_EOF;
+}
+
+/**
+ * @brief Find sector at position of the file chain, chain index is used
+ * when it is built, links are followed otherwise
+ * 
+ * @param sfs 
+ * @param file 
+ * @param position 0 for the first sector of the file
+ * @param sector 
+ * @return sfs_err_t SFS_DATA_CORRUPTED if chain is shorter than position
+ */
+static sfs_err_t chain_position(sfs_t *sfs, sfs_file_t *file, uint32_t position, uint32_t *sector) {
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    *sector = entry->first_sector;
+    if (sfs->chain_valid == true && sfs->chain_sequence[*sector] != SFS_UNSET) {
+        // Sequence numbers of the file are consecutive
+        int32_t found = chain_find(sfs, file->file_descriptor, sfs->chain_sequence[*sector] + position);
+        if (found < 0) {
+            return SFS_DATA_CORRUPTED;
+        }
+
+        *sector = (uint32_t) found;
+        return SFS_OK;
+    }
+
+    sector_header_t header;
+    sfs_err_t ret;
+    for (uint32_t i = 0; i < position; ++i) {
+        ret = read_sector_header(sfs, *sector, &header);
+        SFS_RETURN_ON_ERR(ret);
+
+        ret = chain_next(sfs, *sector, header.format, sector);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (*sector >= number_of_sectors(sfs)) {
+            return SFS_DATA_CORRUPTED;
+        }
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Move file read pointer to the first record which starts in sector
+ * at position of the file, sectors before it are not read when chain
+ * index is built, record index of file is reset to 0 as by sfs_seek_sector
+ * 
+ * @param sfs 
+ * @param file 
+ * @param position 0 for the first sector of the file
+ * @return sfs_err_t SFS_INVALID_VALUE if file has less sectors
+ */
+sfs_err_t sfs_seek_position(sfs_t *sfs, sfs_file_t *file, uint32_t position) {
+    if (sfs == NULL || file == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (position >= sfs->dir[file->file_descriptor].sectors) {
+        return SFS_INVALID_VALUE;
+    }
+
+    uint32_t sector;
+    sfs_err_t ret = chain_position(sfs, file, position, &sector);
+    SFS_RETURN_ON_ERR(ret);
+
+    return sfs_seek_sector(sfs, file, sector);
+}
+
+/**
+ * @brief Move file read pointer to the first timed record with timestamp
+ * at or after time, closed sectors whose time range ends before time are
+ * skipped without reading their records, with chain index the first
+ * candidate sector is found by binary search, records have to be written
+ * in time order, record index of file is reset to 0
+ * 
+ * @param sfs 
+ * @param file 
+ * @param time 
+ * @return sfs_err_t SFS_EOF if there is no such record, read pointer is at the end of file,
+ * SFS_INVALID_VALUE if file was not opened with SFS_OPEN_TIMED
+ */
+sfs_err_t sfs_seek_time(sfs_t *sfs, sfs_file_t *file, uint32_t time) {
+    if (sfs == NULL || file == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    sfs_err_t ret = check_kind(sfs, file, SFS_OPEN_TIMED);
+    SFS_RETURN_ON_ERR(ret);
+
+    // Records skipped by the seek are not counted
+    file->record_index = 0;
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    uint32_t sector = entry->first_sector;
+    sector_header_t header;
+
+    if (sfs->chain_valid == true && sfs->chain_sequence[sector] != SFS_UNSET) {
+        // Sector before low ends before time, open sector and sectors
+        // without time range are never skipped
+        uint32_t low = 0;
+        uint32_t high = entry->sectors - 1U;
+        while (low < high) {
+            uint32_t middle = low + (high - low) / 2U;
+            ret = chain_position(sfs, file, middle, &sector);
+            SFS_RETURN_ON_ERR(ret);
+
+            ret = read_sector_header(sfs, sector, &header);
+            SFS_RETURN_ON_ERR(ret);
+
+            if (header.time_max != SFS_UNSET && header.time_max < time) {
+                low = middle + 1U;
+            } else {
+                high = middle;
+            }
+        }
+
+        ret = chain_position(sfs, file, low, &sector);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    // Chain can not be longer than flash, guard against link loops
+    for (uint32_t i = 0; i < number_of_sectors(sfs); ++i) {
+        ret = read_sector_header(sfs, sector, &header);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (header.time_max == SFS_UNSET || header.time_max >= time) {
+            ret = seek_time_in_sector(sfs, file, sector, &header, time);
+            if (ret != SFS_EOF) {
+                return ret;
+            }
+        }
+
+        uint32_t next_sector;
+        ret = chain_next(sfs, sector, header.format, &next_sector);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (next_sector == NO_NEXT_SECTOR) {
+            file->address_pointer = entry->end_address;
+            file->read_format = header.format;
+            file->generation = entry->generation;
+            return SFS_EOF;
+        }
+
+        if (next_sector >= number_of_sectors(sfs)) {
+            return SFS_DATA_CORRUPTED;
+        }
+        sector = next_sector;
+    }
+
+    return SFS_DATA_CORRUPTED;
+}
+
+/**
+ * @brief Follow writer of the same file, reader end of file is taken from
+ * directory in RAM, so reader waiting for new records does not poll flash,
+ * burst window keeps records programmed after the reader's last read
+ * 
+ * @param sfs 
+ * @param reader opened handle of the file
+ * @param notify called after every record written to the file, e.g. to
+ * signal condition variable of reading task, NULL to poll, runs in writer
+ * context, registration is dropped by sfs_mount
+ * @param arg notify argument
+ * @return sfs_err_t 
+ */
+sfs_err_t sfs_tail(sfs_t *sfs, sfs_file_t *reader, sfs_tail_notify notify, void *arg) {
+    if (sfs == NULL || reader == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (reader->file_descriptor >= sfs->dir_count) {
+        return SFS_FILE_NOT_OPEN;
+    }
+
+    sfs_dir_entry_t *entry = &sfs->dir[reader->file_descriptor];
+    entry->tail_fnc = notify;
+    entry->tail_arg = arg;
+    reader->tail = true;
+
+    return SFS_OK;
+}
+
+static bool tail_at_end(sfs_t *sfs, sfs_file_t *file) {
+    return file->tail == true && file->address_pointer == sfs->dir[file->file_descriptor].end_address;
+}
+
+static bool file_moved(sfs_t *sfs, sfs_file_t *file) {
+    return file->generation != sfs->dir[file->file_descriptor].generation;
+}
+
+/**
+ * @brief Read only records of selected streams, see sfs_write_tagged
+ * 
+ * @param sfs 
+ * @param file 
+ * @param tags SFS_TAG bits of streams, 0 to read every record
+ * @return sfs_err_t SFS_INVALID_VALUE if tags are selected in file not
+ * opened with SFS_OPEN_TAGGED, first byte of its records is not a tag
+ */
+sfs_err_t sfs_select_tags(sfs_t *sfs, sfs_file_t *file, uint32_t tags) {
+    if (sfs == NULL || file == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (tags != 0) {
+        sfs_err_t ret = check_kind(sfs, file, SFS_OPEN_TAGGED);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    file->tags = tags;
+    return SFS_OK;
+}
+
+static sfs_err_t sector_tags(sfs_t *sfs, sfs_file_t *file, uint32_t sector, uint32_t *tags) {
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    if (sector == entry->last_sector) {
+        *tags = entry->last_tags;
+        return SFS_OK;
+    }
+
+    sector_header_t header;
+    sfs_err_t ret = read_sector_header(sfs, sector, &header);
+    SFS_RETURN_ON_ERR(ret);
+
+    *tags = header.tags;
+    return SFS_OK;
+}
+
+/**
+ * @brief Move cursor to the first record which starts after sector,
+ * sectors filled by continuation of a record are passed
+ * 
+ * @param sfs 
+ * @param sector 
+ * @param cursor 
+ * @param format 
+ * @return sfs_err_t SFS_EOF if there is no next sector
+ */
+static sfs_err_t skip_sector(sfs_t *sfs, uint32_t sector, uint32_t *cursor, uint8_t *format) {
+    while (true) {
+        uint32_t next;
+        sfs_err_t ret = chain_next(sfs, sector, *format, &next);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (next == NO_NEXT_SECTOR) {
+            return SFS_EOF;
+        }
+
+        if (next >= number_of_sectors(sfs)) {
+            return SFS_DATA_CORRUPTED;
+        }
+
+        sector_header_t header;
+        ret = read_sector_header(sfs, next, &header);
+        if (ret == SFS_INVALID_PREFIX) {
+            return SFS_DATA_CORRUPTED;
+        }
+        SFS_RETURN_ON_ERR(ret);
+
+        *cursor = sector_to_address(sfs, next) + header.header_size + header.continuation;
+        *format = header.format;
+        if (*cursor < sector_data_end(sfs, *cursor, *format)) {
+            return SFS_OK;
+        }
+        sector = next;
+    }
+}
+
+/**
+ * @brief Read length of the next record selected by tag filter of the handle,
+ * sectors whose tag bitmap has none of the selected tags are skipped without
+ * reading their records, file pointer is moved over skipped records
+ * 
+ * @param sfs 
+ * @param file 
+ * @param cursor file pointer, set to record data
+ * @param format 
+ * @param size record length
+ * @return sfs_err_t SFS_EOF if there are no more selected records
+ */
+static sfs_err_t read_selected_len(sfs_t *sfs, sfs_file_t *file, uint32_t *cursor, uint8_t *format,
+                                   uint32_t *size) {
+    uint32_t checked_sector = SFS_UNSET;
+    sfs_err_t ret;
+    while (true) {
+        ret = read_data_len(sfs, cursor, format, size);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (file->tags == 0) {
+            return SFS_OK;
+        }
+
+        // Length is in the sector where record starts
+        uint32_t sector = address_to_sector(sfs, *cursor);
+        if (sector != checked_sector) {
+            checked_sector = sector;
+            uint32_t tags;
+            ret = sector_tags(sfs, file, sector, &tags);
+            SFS_RETURN_ON_ERR(ret);
+
+            if ((tags & file->tags) == 0) {
+                ret = skip_sector(sfs, sector, cursor, format);
+                SFS_RETURN_ON_ERR(ret);
+
+                file->address_pointer = *cursor;
+                file->read_format = *format;
+                continue;
+            }
+        }
+
+        uint8_t tag;
+        uint32_t tag_cursor = *cursor;
+        uint8_t tag_format = *format;
+        ret = read_data(sfs, &tag_cursor, &tag_format, &tag, sizeof(tag));
+        SFS_RETURN_ON_ERR(ret);
+
+        if (tag < SFS_MAX_TAGS && (file->tags & SFS_TAG(tag)) != 0) {
+            return SFS_OK;
+        }
+
+        ret = read_data(sfs, cursor, format, NULL, *size);
+        SFS_RETURN_ON_ERR(ret);
+
+        file->address_pointer = *cursor;
+        file->read_format = *format;
+    }
+}
+
+sfs_err_t sfs_read_record(sfs_t *sfs, sfs_file_t *file, uint8_t *buffer, uint32_t buffer_size,
+                          uint32_t *size) {
+    if (file_moved(sfs, file) == true) {
+        return SFS_FILE_MOVED;
+    }
+
+    if (tail_at_end(sfs, file) == true) {
+        return SFS_EOF;
+    }
+
+    uint32_t cursor = file->address_pointer;
+    uint8_t format = file->read_format;
+    uint32_t record_size;
+
+    sfs_err_t ret = read_selected_len(sfs, file, &cursor, &format, &record_size);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (size != NULL) {
+        *size = record_size;
+    }
+
+    if (record_size > buffer_size) {
+        return SFS_BUFFER_SIZE;
+    }
+
+    ret = read_data(sfs, &cursor, &format, buffer, record_size);
+    SFS_RETURN_ON_ERR(ret);
+
+    file->address_pointer = cursor;
+    file->read_format = format;
+    file->record_index += 1;
+
+    return SFS_OK;
+}
+
+sfs_err_t sfs_read_line(sfs_t *sfs, sfs_file_t *file, uint8_t *buffer, uint32_t buffer_size) {
+    return sfs_read_record(sfs, file, buffer, buffer_size, NULL);
+}
+
+/**
+ * @brief Start reading next record in pieces by sfs_object_read, for records
+ * larger than any buffer, file pointer stays inside the record until it is read
+ * 
+ * @param sfs 
+ * @param file 
+ * @param object size is set to record data size
+ * @return sfs_err_t SFS_EOF if there are no more records
+ */
+sfs_err_t sfs_object_read_begin(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object) {
+    if (sfs == NULL || file == NULL || object == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (file_moved(sfs, file) == true) {
+        return SFS_FILE_MOVED;
+    }
+
+    if (tail_at_end(sfs, file) == true) {
+        return SFS_EOF;
+    }
+
+    uint32_t cursor = file->address_pointer;
+    uint8_t format = file->read_format;
+    uint32_t record_size;
+
+    sfs_err_t ret = read_selected_len(sfs, file, &cursor, &format, &record_size);
+    SFS_RETURN_ON_ERR(ret);
+
+    file->address_pointer = cursor;
+    file->read_format = format;
+    file->record_index += 1;
+    object->size = record_size;
+    object->offset = 0;
+    object->buffered = 0;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Read next piece of record started by sfs_object_read_begin
+ * 
+ * @param sfs 
+ * @param file 
+ * @param object 
+ * @param buffer NULL to skip bytes
+ * @param buffer_size 
+ * @param size bytes read, less than buffer_size at the end of record
+ * @return sfs_err_t SFS_EOF when whole record was read
+ */
+sfs_err_t sfs_object_read(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object, uint8_t *buffer,
+                          uint32_t buffer_size, uint32_t *size) {
+    if (sfs == NULL || file == NULL || object == NULL || size == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (file_moved(sfs, file) == true) {
+        return SFS_FILE_MOVED;
+    }
+
+    *size = 0;
+    uint32_t part = object->size - object->offset;
+    if (part == 0) {
+        return SFS_EOF;
+    }
+
+    if (part > buffer_size) {
+        part = buffer_size;
+    }
+
+    uint32_t cursor = file->address_pointer;
+    uint8_t format = file->read_format;
+    sfs_err_t ret = read_data(sfs, &cursor, &format, buffer, part);
+    SFS_RETURN_ON_ERR(ret);
+
+    file->address_pointer = cursor;
+    file->read_format = format;
+    object->offset += part;
+    *size = part;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Compare byte range of record under cursor with filter value, only
+ * the range is read, from mapped flash or burst window when available
+ */
+static sfs_err_t match_range(sfs_t *sfs, const sfs_filter_t *filter, uint32_t cursor, uint8_t format,
+                             uint32_t record_size, bool *match) {
+    uint8_t bytes[SFS_MATCH_MAX_SIZE];
+    *match = false;
+    if (filter->offset > record_size || filter->size > record_size - filter->offset) {
+        return SFS_OK;
+    }
+
+    sfs_err_t ret = read_data(sfs, &cursor, &format, NULL, filter->offset);
+    SFS_RETURN_ON_ERR(ret);
+
+    ret = read_data(sfs, &cursor, &format, bytes, filter->size);
+    SFS_RETURN_ON_ERR(ret);
+
+    int order = memcmp(bytes, filter->value, filter->size);
+    if (filter->op == SFS_MATCH_EQ) {
+        *match = order == 0;
+    } else if (filter->op == SFS_MATCH_NE) {
+        *match = order != 0;
+    } else if (filter->op == SFS_MATCH_LT) {
+        *match = order < 0;
+    } else if (filter->op == SFS_MATCH_LE) {
+        *match = order <= 0;
+    } else if (filter->op == SFS_MATCH_GT) {
+        *match = order > 0;
+    } else {
+        *match = order >= 0;
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Call filter with record under cursor, record which lies in one sector
+ * is passed from mapped flash or burst window, other records are read to buffer
+ * 
+ * @param copied set if record was read to buffer
+ * @return sfs_err_t SFS_BUFFER_SIZE if record has to be read and does not fit to buffer
+ */
+static sfs_err_t match_callback(sfs_t *sfs, const sfs_filter_t *filter, uint32_t cursor, uint8_t format,
+                                uint32_t record_size, uint8_t *buffer, uint32_t buffer_size,
+                                bool *match, bool *copied) {
+    const uint8_t *data = NULL;
+    sfs_err_t ret;
+    *copied = false;
+    if (cursor + record_size <= sector_data_end(sfs, cursor, format)) {
+        ret = burst_prefetch(sfs, cursor, record_size);
+        SFS_RETURN_ON_ERR(ret);
+
+        if (sfs->map_base != NULL) {
+            data = sfs->map_base + cursor;
+        } else if (burst_contains(sfs, cursor, record_size) == true) {
+            data = &sfs->burst_buffer[cursor - sfs->burst_address];
+        }
+    }
+
+    if (data == NULL) {
+        if (record_size > buffer_size) {
+            return SFS_BUFFER_SIZE;
+        }
+
+        ret = read_data(sfs, &cursor, &format, buffer, record_size);
+        SFS_RETURN_ON_ERR(ret);
+        data = buffer;
+        *copied = true;
+    }
+
+    *match = filter->fnc(data, record_size, filter->arg);
+    return SFS_OK;
+}
+
+static uint32_t first_bit(const uint8_t *bits, uint32_t count, bool set) {
+    for (uint32_t i = 0; i < count; ++i) {
+        if (((bits[i / 8U] & (1U << (i % 8U))) != 0) == set) {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Move cursor over fixed layout records whose byte range differs from
+ * filter value, records of a sector are compared in blocks directly in mapped
+ * flash or burst window, block ends at the first record of other length
+ * 
+ * @param sfs 
+ * @param file 
+ * @param filter SFS_MATCH_EQ with record_size
+ * @param cursor start of record, moved to the first record which has to be checked
+ * @param format 
+ * @return sfs_err_t 
+ */
+static sfs_err_t skip_unmatched_records(sfs_t *sfs, sfs_file_t *file, const sfs_filter_t *filter,
+                                        uint32_t *cursor, uint8_t format) {
+    uint8_t len_bytes[DATA_LEN_MAX_SIZE];
+    uint8_t len_size = encode_data_len(filter->record_size, true, len_bytes);
+    uint32_t stride = len_size + filter->record_size;
+    // Kernel reads whole pattern window at the range of every record
+    uint32_t window = len_size + filter->offset + SFS_SCAN_PATTERN_MAX;
+    if (format != SFS_FORMAT_V2 || stride < SFS_SCAN_PATTERN_MAX ||
+        filter->offset > filter->record_size || filter->size > filter->record_size - filter->offset) {
+        return SFS_OK;
+    }
+
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    uint32_t sector = address_to_sector(sfs, *cursor);
+    uint32_t sector_end = sector_to_address(sfs, sector) + sfs->flash_sector_bits;
+    uint32_t limit = sector == entry->last_sector ? entry->end_address : sector_data_end(sfs, *cursor, format);
+    uint8_t lengths[MATCH_BLOCK_RECORDS / 8U];
+    uint8_t matches[MATCH_BLOCK_RECORDS / 8U];
+    while (*cursor < limit) {
+        const uint8_t *view;
+        uint32_t readable;
+        if (sfs->map_base != NULL) {
+            view = sfs->map_base + *cursor;
+            readable = sector_end - *cursor;
+        } else {
+            uint32_t size = sector_end - *cursor;
+            sfs_err_t ret = burst_prefetch(sfs, *cursor, size < sfs->burst_size ? size : sfs->burst_size);
+            SFS_RETURN_ON_ERR(ret);
+
+            if (sfs->burst_length == 0 || burst_contains(sfs, *cursor, 1) == false) {
+                return SFS_OK;
+            }
+            view = &sfs->burst_buffer[*cursor - sfs->burst_address];
+            readable = sfs->burst_address + sfs->burst_length - *cursor;
+            if (readable > sector_end - *cursor) {
+                readable = sector_end - *cursor;
+            }
+        }
+
+        uint32_t count = (limit - *cursor) / stride;
+        if (readable < window) {
+            return SFS_OK;
+        }
+        if (count > (readable - window) / stride + 1U) {
+            count = (readable - window) / stride + 1U;
+        }
+        if (count > MATCH_BLOCK_RECORDS) {
+            count = MATCH_BLOCK_RECORDS;
+        }
+
+        (void) sfs_scan_headers(view, stride, count, len_bytes, len_size, lengths);
+        count = first_bit(lengths, count, false);
+        if (count == 0) {
+            return SFS_OK;
+        }
+
+        (void) sfs_scan_headers(view + len_size + filter->offset, stride, count,
+                                filter->value, filter->size, matches);
+        uint32_t found = first_bit(matches, count, true);
+        *cursor += found * stride;
+        if (found < count) {
+            return SFS_OK;
+        }
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Read next record accepted by filter, records are checked where they
+ * are read, in mapped flash or burst window, only accepted record is copied to
+ * buffer, fixed layout records are compared for equality a block at a time,
+ * tag filter of the handle is applied first
+ * 
+ * @param sfs 
+ * @param file 
+ * @param filter callback or byte range match
+ * @param buffer 
+ * @param buffer_size 
+ * @param size record size, can be NULL
+ * @return sfs_err_t SFS_EOF if no more records are accepted, file pointer is
+ * moved over rejected records
+ */
+sfs_err_t sfs_read_filtered(sfs_t *sfs, sfs_file_t *file, const sfs_filter_t *filter,
+                            uint8_t *buffer, uint32_t buffer_size, uint32_t *size) {
+    if (sfs == NULL || file == NULL || filter == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (filter->fnc == NULL && (filter->size == 0 || filter->size > SFS_MATCH_MAX_SIZE ||
+                                filter->op > SFS_MATCH_GE)) {
+        return SFS_INVALID_VALUE;
+    }
+
+    if (file_moved(sfs, file) == true) {
+        return SFS_FILE_MOVED;
+    }
+
+    bool block = filter->fnc == NULL && filter->op == SFS_MATCH_EQ && filter->record_size != 0;
+    sfs_err_t ret;
+    while (tail_at_end(sfs, file) == false) {
+        uint32_t cursor = file->address_pointer;
+        uint8_t format = file->read_format;
+        if (block == true) {
+            ret = skip_unmatched_records(sfs, file, filter, &cursor, format);
+            SFS_RETURN_ON_ERR(ret);
+            file->address_pointer = cursor;
+        }
+
+        uint32_t record_size;
+        ret = read_selected_len(sfs, file, &cursor, &format, &record_size);
+        SFS_RETURN_ON_ERR(ret);
+
+        bool match = false;
+        bool copied = false;
+        if (filter->fnc != NULL) {
+            ret = match_callback(sfs, filter, cursor, format, record_size, buffer, buffer_size,
+                                 &match, &copied);
+        } else {
+            ret = match_range(sfs, filter, cursor, format, record_size, &match);
+        }
+        if (ret == SFS_BUFFER_SIZE && size != NULL) {
+            *size = record_size;
+        }
+        SFS_RETURN_ON_ERR(ret);
+
+        if (match == true) {
+            if (size != NULL) {
+                *size = record_size;
+            }
+
+            if (copied == false && record_size > buffer_size) {
+                return SFS_BUFFER_SIZE;
+            }
+
+            ret = read_data(sfs, &cursor, &format, copied == true ? NULL : buffer, record_size);
+            SFS_RETURN_ON_ERR(ret);
+
+            file->address_pointer = cursor;
+            file->read_format = format;
+            file->record_index += 1;
+            return SFS_OK;
+        }
+
+        ret = read_data(sfs, &cursor, &format, NULL, record_size);
+        SFS_RETURN_ON_ERR(ret);
+
+        file->address_pointer = cursor;
+        file->read_format = format;
+    }
+
+    return SFS_EOF;
+}
+
+/**
+ * @brief Read line without copy, data points into mapped flash
+ * 
+ * @param sfs 
+ * @param file 
+ * @param data pointer to line data, valid as long as flash is mapped
+ * @param size line size
+ * @return sfs_err_t SFS_NOT_MAPPED if flash is not mapped, SFS_NOT_CONTIGUOUS
+ * if line spans sectors, file pointer is not moved, use sfs_read_line instead
+ */
+sfs_err_t sfs_read_line_ptr(sfs_t *sfs, sfs_file_t *file, const uint8_t **data, uint32_t *size) {
+    if (sfs == NULL || file == NULL || data == NULL || size == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (sfs->map_base == NULL) {
+        return SFS_NOT_MAPPED;
+    }
+
+    if (file_moved(sfs, file) == true) {
+        return SFS_FILE_MOVED;
+    }
+
+    if (tail_at_end(sfs, file) == true) {
+        return SFS_EOF;
+    }
+
+    uint32_t cursor = file->address_pointer;
+    uint8_t format = file->read_format;
+    uint32_t line_size;
+
+    sfs_err_t ret = read_selected_len(sfs, file, &cursor, &format, &line_size);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (cursor + line_size > sector_data_end(sfs, cursor, format)) {
+        return SFS_NOT_CONTIGUOUS;
+    }
+
+    *data = sfs->map_base + cursor;
+    *size = line_size;
+    file->address_pointer = cursor + line_size;
+    file->read_format = format;
+    file->record_index += 1;
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Call visitor for every line from file pointer to end of file,
+ * lines are passed as pointers into mapped flash, lines which span sectors
+ * are copied into scratch first
+ * 
+ * @param sfs 
+ * @param file 
+ * @param visitor return false to stop visiting
+ * @param arg visitor argument
+ * @param scratch buffer for lines which span sectors, NULL to stop at such line
+ * @param scratch_size 
+ * @return sfs_err_t SFS_OK at end of file or when stopped by visitor,
+ * SFS_NOT_CONTIGUOUS or SFS_BUFFER_SIZE if line spanning sectors does not fit
+ * in scratch, file pointer stays at the line
+ */
+sfs_err_t sfs_visit_lines(sfs_t *sfs, sfs_file_t *file, sfs_line_visitor visitor, void *arg,
+                          uint8_t *scratch, uint32_t scratch_size) {
+    if (visitor == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    const uint8_t *data;
+    uint32_t size;
+    sfs_err_t ret;
+    while (true) {
+        ret = sfs_read_line_ptr(sfs, file, &data, &size);
+        if (ret == SFS_NOT_CONTIGUOUS && scratch != NULL) {
+            ret = sfs_read_record(sfs, file, scratch, scratch_size, &size);
+            data = scratch;
+        }
+
+        if (ret != SFS_OK) {
+            break;
+        }
+
+        if (visitor(data, size, arg) == false) {
+            return SFS_OK;
+        }
+    }
+
+    if (ret == SFS_EOF) {
+        return SFS_OK;
+    }
+
+    return ret;
+}
+
+static bool cursor_valid(const uint8_t *data) {
+    return crc32(data, CURSOR_DATA_SIZE - 4U) == read_be(&data[CURSOR_DATA_SIZE - 4U], 4);
+}
+
+/**
+ * @brief Check that cursor name is free or names a cursor file, so cursor
+ * records never go into a data file
+ */
+static sfs_err_t check_cursor_name(sfs_t *sfs, char *cursor_name) {
+    sfs_file_t log;
+    sfs_err_t ret = set_file_name(&log, cursor_name);
+    SFS_RETURN_ON_ERR(ret);
+
+    int32_t index = dir_find(sfs, log.name);
+    if (index >= 0 && sfs->dir[index].kind != SFS_CURSOR_KIND) {
+        return SFS_INVALID_VALUE;
+    }
+
+    return SFS_OK;
+}
+
+/**
+ * @brief Save read position and record index of file in cursor file of
+ * cursor_name, the position names sector of the file with its sequence
+ * number, so it is found again after reset by sfs_open_at_cursor with a few
+ * flash reads, cursor file is a ring of SFS_CURSOR_SECTORS sectors, one
+ * record per save, the save is one append, sector header of the position
+ * is read only if its sequence number is not known in RAM
+ * 
+ * @param sfs 
+ * @param file 
+ * @param cursor_name file name of the cursor
+ * @return sfs_err_t SFS_INVALID_VALUE if cursor_name is taken by a file
+ * which is not a cursor
+ */
+sfs_err_t sfs_cursor_save(sfs_t *sfs, sfs_file_t *file, char *cursor_name) {
+    if (sfs == NULL || file == NULL || cursor_name == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    if (file_moved(sfs, file) == true) {
+        return SFS_FILE_MOVED;
+    }
+
+    // Sectors written since v1 carry creation number of the file
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    uint32_t sector = address_to_sector(sfs, file->address_pointer);
+    sector_header_t header;
+    header.created = entry->created;
+    header.sequence = SFS_UNSET;
+    if (file->read_format != SFS_FORMAT_LEGACY && sector == entry->last_sector) {
+        header.sequence = entry->last_sequence;
+    } else if (file->read_format != SFS_FORMAT_LEGACY && sfs->chain_valid == true &&
+               sfs->chain_owner[sector] == file->file_descriptor) {
+        header.sequence = sfs->chain_sequence[sector];
+    }
+
+    sfs_err_t ret = check_cursor_name(sfs, cursor_name);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (header.sequence == SFS_UNSET) {
+        ret = read_sector_header(sfs, sector, &header);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    uint8_t data[CURSOR_DATA_SIZE];
+    (void) memcpy(data, file->name, MAX_FILE_NAME_SIZE);
+    write_be(&data[MAX_FILE_NAME_SIZE], header.created, 4);
+    write_be(&data[MAX_FILE_NAME_SIZE + 4U], header.sequence, 4);
+    write_be(&data[MAX_FILE_NAME_SIZE + 8U], sector, 4);
+    write_be(&data[MAX_FILE_NAME_SIZE + 12U], file->address_pointer - sector_to_address(sfs, sector), 4);
+    write_be(&data[MAX_FILE_NAME_SIZE + 16U], file->record_index, 4);
+    write_be(&data[CURSOR_DATA_SIZE - 4U], crc32(data, CURSOR_DATA_SIZE - 4U), 4);
+
+    sfs_file_t log;
+    sfs_file_config_t config = {0};
+    config.flags = SFS_CURSOR_KIND;
+    config.ring_sectors = SFS_CURSOR_SECTORS;
+    ret = open_attached(sfs, &log, cursor_name, &config);
+    SFS_RETURN_ON_ERR(ret);
+
+    // Records do not span sectors, the last one ends at the end of file
+    uint32_t sector_free_size = sector_data_end(sfs, log.end_address, log.write_format) - log.end_address;
+    if (log.write_format == SFS_FORMAT_V2 && sector_free_size < CURSOR_RECORD_SIZE) {
+        if (sector_free_size > 0) {
+            uint8_t padding = SFS_PADDING;
+            ret = write_bytes(sfs, &log, &padding, sizeof(padding));
+            SFS_RETURN_ON_ERR(ret);
+        }
+
+        ret = open_next_sector(sfs, &log, 0);
+        SFS_RETURN_ON_ERR(ret);
+    }
+
+    ret = write_record(sfs, &log, NULL, NULL, data, sizeof(data));
+    SFS_RETURN_ON_ERR(ret);
+
+    return sfs_close(sfs, &log);
+}
+
+/**
+ * @brief Find the last valid record of cursor file, it ends at the end of
+ * file unless torn write was repaired, then the last sector is read
+ */
+static sfs_err_t cursor_load(sfs_t *sfs, char *cursor_name, uint8_t *data, bool *found) {
+    *found = false;
+    sfs_err_t ret = check_cursor_name(sfs, cursor_name);
+    SFS_RETURN_ON_ERR(ret);
+
+    sfs_file_t log;
+    sfs_file_config_t config = {0};
+    config.flags = SFS_OPEN_NO_CREATE;
+    ret = open_attached(sfs, &log, cursor_name, &config);
+    SFS_RETURN_ON_ERR(ret);
+
+    sfs_dir_entry_t *entry = &sfs->dir[log.file_descriptor];
+    if (log.end_address >= sector_to_address(sfs, entry->last_sector) + SECTOR_HEADER_SIZE + CURSOR_RECORD_SIZE) {
+        uint8_t bytes[CURSOR_RECORD_SIZE];
+        ret = flash_read(sfs, log.end_address - CURSOR_RECORD_SIZE, bytes, sizeof(bytes));
+        SFS_RETURN_ON_ERR(ret);
+
+        if (bytes[0] == CURSOR_DATA_SIZE && cursor_valid(&bytes[1]) == true) {
+            (void) memcpy(data, &bytes[1], CURSOR_DATA_SIZE);
+            *found = true;
+            return sfs_close(sfs, &log);
+        }
+    }
+
+    ret = sfs_seek_sector(sfs, &log, entry->last_sector);
+    SFS_RETURN_ON_ERR(ret);
+
+    uint8_t bytes[CURSOR_DATA_SIZE];
+    uint32_t size;
+    while (sfs_read_record(sfs, &log, bytes, sizeof(bytes), &size) == SFS_OK) {
+        if (size == CURSOR_DATA_SIZE && cursor_valid(bytes) == true) {
+            (void) memcpy(data, bytes, CURSOR_DATA_SIZE);
+            *found = true;
+        }
+    }
+
+    return sfs_close(sfs, &log);
+}
+
+/**
+ * @brief Move read pointer of open file to position of the last cursor record
+ */
+static sfs_err_t cursor_seek(sfs_t *sfs, sfs_file_t *file, char *cursor_name) {
+    uint8_t data[CURSOR_DATA_SIZE];
+    bool found;
+    sfs_err_t ret = cursor_load(sfs, cursor_name, data, &found);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (found == false || sfs_scan_equal(data, file->name, MAX_FILE_NAME_SIZE) == false) {
+        return SFS_CURSOR_STALE;
+    }
+
+    uint32_t sector = read_be(&data[MAX_FILE_NAME_SIZE + 8U], 4);
+    uint32_t offset = read_be(&data[MAX_FILE_NAME_SIZE + 12U], 4);
+    if (sector >= number_of_sectors(sfs)) {
+        return SFS_CURSOR_STALE;
+    }
+
+    // Erased, reused or rewritten sector has other owner, creation or sequence
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    sector_header_t header;
+    bool owned;
+    ret = sector_owned(sfs, sector, entry, &header, &owned);
+    SFS_RETURN_ON_ERR(ret);
+
+    uint32_t address = sector_to_address(sfs, sector);
+    if (owned == false || header.created != read_be(&data[MAX_FILE_NAME_SIZE], 4) ||
+        header.sequence != read_be(&data[MAX_FILE_NAME_SIZE + 4U], 4) ||
+        offset < header.header_size + header.continuation ||
+        offset > sector_data_end(sfs, address, header.format) - address) {
+        return SFS_CURSOR_STALE;
+    }
+
+    address += offset;
+    if (sector == entry->last_sector && address > entry->end_address) {
+        return SFS_CURSOR_STALE;
+    }
+
+    file->address_pointer = address;
+    file->read_format = header.format;
+    file->record_index = read_be(&data[MAX_FILE_NAME_SIZE + 16U], 4);
+    return SFS_OK;
+}
+
+/**
+ * @brief Open file and move read pointer to position saved by sfs_cursor_save,
+ * costs the last cursor record and one sector header instead of reading
+ * the file from the start, record_index of file is restored as well
+ * 
+ * @param sfs 
+ * @param file 
+ * @param file_name 
+ * @param cursor_name 
+ * @return sfs_err_t SFS_CURSOR_STALE if saved sector does not hold the file
+ * anymore (ring reuse, compaction, file recreated) or cursor file is damaged,
+ * file is open at the first record then, as it is when no cursor was saved yet,
+ * SFS_INVALID_VALUE if cursor_name is taken by a file which is not a cursor
+ */
+sfs_err_t sfs_open_at_cursor(sfs_t *sfs, sfs_file_t *file, char *file_name, char *cursor_name) {
+    if (sfs == NULL || file == NULL || file_name == NULL || cursor_name == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    sfs_err_t ret = open_attached(sfs, file, file_name, NULL);
+    SFS_RETURN_ON_ERR(ret);
+
+    ret = cursor_seek(sfs, file, cursor_name);
+    if (ret != SFS_FILE_NOT_FOUND && ret != SFS_CURSOR_STALE) {
+        return ret;
+    }
+
+    // Position was not saved or is gone, reading starts at the first record
+    sfs_err_t rewind = rewind_file(sfs, file);
+    SFS_RETURN_ON_ERR(rewind);
+
+    return ret == SFS_CURSOR_STALE ? SFS_CURSOR_STALE : SFS_OK;
+}
+
+sfs_err_t sfs_close(sfs_t *sfs, sfs_file_t *file) {
+    (void) sfs;
+    (void) memset(file, 0, sizeof(sfs_file_t));
     return SFS_OK;
 }
 
-static bool uint8_cmpr(uint8_t *buf1, uint8_t *buf2, size_t size) {
-    for (size_t i = 0; i < size; ++i) {
-        if (buf1[i] != buf2[i]) {
-            return false;
+static void fill_stat(sfs_dir_entry_t *entry, sfs_stat_t *info) {
+    (void) memset(info, SFS_EMPTY_VALUE, sizeof(sfs_stat_t));
+    for (uint8_t i = 0; i < MAX_FILE_NAME_SIZE - 1; ++i) {
+        if (entry->name[i] == FLASH_NO_DATA || entry->name[i] == '\0') {
+            break;
         }
+        info->name[i] = (char) entry->name[i];
     }
 
-    return true;
+    info->size = entry->size;
+    info->records = entry->records;
+    info->sectors = entry->sectors;
+    info->first_sector = entry->first_sector;
+    info->last_sector = entry->last_sector;
+    info->created = entry->created;
+    info->kind = entry->kind;
 }
 
-static sfs_err_t get_data_len(sfs_t *sfs, uint32_t address, uint16_t *len) {
-    uint8_t len_buffer[DATA_LEN_SIZE];
-    int ret = sfs->read_fnc(address, len_buffer, sizeof(len_buffer));
+/**
+ * @brief Get file information from directory, does not read flash after mount
+ * 
+ * @param sfs 
+ * @param file_name 
+ * @param info 
+ * @return sfs_err_t SFS_FILE_NOT_FOUND if there is no such file
+ */
+sfs_err_t sfs_stat(sfs_t *sfs, char *file_name, sfs_stat_t *info) {
+    if (sfs == NULL || info == NULL) {
+        return SFS_NULL_POINTER;
+    }
+
+    sfs_file_t file;
+    sfs_err_t ret = set_file_name(&file, file_name);
+    SFS_RETURN_ON_ERR(ret);
 
-    if (ret != sizeof(len_buffer)) {
-        return SFS_FLASH_READ;
+    ret = mount_if_needed(sfs);
+    SFS_RETURN_ON_ERR(ret);
+
+    int32_t index = dir_find(sfs, file.name);
+    if (index < 0) {
+        return SFS_FILE_NOT_FOUND;
     }
 
-    *len = len_buffer[1];
-    *len |= (len_buffer[0] << 8);
+    fill_stat(&sfs->dir[index], info);
 
     return SFS_OK;
 }
 
-// static bool check_file_name(uint8_t *file_name, size_t file_name_size) {
-//     if (file_name_size != MAX_FILE_NAME_SIZE) {
-//         return false;
-//     }
+sfs_err_t sfs_opendir(sfs_t *sfs, sfs_dir_t *dir) {
+    if (sfs == NULL || dir == NULL) {
+        return SFS_NULL_POINTER;
+    }
 
-//     if (file_name[MAX_FILE_NAME_SIZE - 1] != '\0') {
-//         return false;
-//     }
+    dir->index = 0;
 
-//     return true;
-// }
+    return mount_if_needed(sfs);
+}
 
-static sfs_err_t set_file_name(sfs_file_t *file, char *file_name) {
-    if (file == NULL || file_name == NULL) {
+/**
+ * @brief Get next file in creation order
+ * 
+ * @param sfs 
+ * @param dir 
+ * @param info 
+ * @return sfs_err_t SFS_EOF after last file
+ */
+sfs_err_t sfs_readdir(sfs_t *sfs, sfs_dir_t *dir, sfs_stat_t *info) {
+    if (sfs == NULL || dir == NULL || info == NULL) {
         return SFS_NULL_POINTER;
     }
 
-    if (strlen(file_name) > MAX_FILE_NAME_SIZE) {
-        return SFS_INVALID_FILE_NAME;
+    if (dir->index >= sfs->dir_count) {
+        return SFS_EOF;
     }
 
-    (void) memset(file->name, 0xFF, sizeof(file->name));
-    (void) memcpy(file->name, file_name, strlen(file_name));
-    file->name[MAX_FILE_NAME_SIZE - 1] = '\0';
+    fill_stat(&sfs->dir[dir->index], info);
+    dir->index += 1;
 
     return SFS_OK;
 }
 
-static uint32_t sector_to_address(sfs_t *sfs, uint32_t sector) {
-    return sector * sfs->flash_sector_bits;
-}
-
-static sfs_err_t sector_belongs_to_file(sfs_t *sfs, sfs_file_t *file, uint32_t sector, bool *belongs) {
-    uint8_t sector_file_name[MAX_FILE_NAME_SIZE] = {0};
-    *belongs = false;
-    
-    int ret_size = sfs->read_fnc(sector_to_address(sfs, sector) + FILE_PREFIX_SIZE,
-                                sector_file_name, sizeof(sector_file_name));
-    if (ret_size != sizeof(sector_file_name)) {
-        return SFS_FLASH_READ;
+/**
+ * @brief Write header of the copy of source sector, sequence and summary
+ * are kept, extent left after the run is recorded in the copy of the last sector
+ */
+static sfs_err_t compact_header(sfs_t *sfs, sfs_dir_entry_t *entry, const sector_header_t *source,
+                                uint32_t sector, bool last) {
+    uint8_t header[SECTOR_HEADER_SIZE];
+    (void) memset(header, FLASH_NO_DATA, sizeof(header));
+    (void) memcpy(header, file_prefix, sizeof(file_prefix));
+    (void) memcpy(&header[FILE_PREFIX_SIZE], entry->name, sizeof(entry->name));
+    header[HEADER_SIZE_OFFSET] = SECTOR_HEADER_SIZE;
+    write_be(&header[CONTINUATION_OFFSET], source->continuation, 4);
+    write_be(&header[SEQUENCE_OFFSET], source->sequence, 4);
+    write_be(&header[CREATED_OFFSET], source->created, 4);
+    write_be(&header[RECORDS_OFFSET], source->records, 4);
+    write_be(&header[SIZE_OFFSET], source->size, 4);
+    write_be(&header[RING_OFFSET], source->ring_sectors, 4);
+    if (last == true && sector + 1U < sfs->compact_end) {
+        write_be(&header[EXTENT_OFFSET], entry->extent_sectors, 4);
+        write_be(&header[EXTENT_END_OFFSET], sfs->compact_end, 4);
     }
-    
-    if (uint8_cmpr(sector_file_name, file->name, sizeof(sector_file_name)) == true) {
-        *belongs = true;
+    write_be(&header[TIME_MIN_OFFSET], source->time_min, 4);
+    write_be(&header[TIME_MAX_OFFSET], source->time_max, 4);
+    write_be(&header[GENERATION_OFFSET], entry->generation + 1U, 4);
+    write_be(&header[TAGS_OFFSET], source->tags, 4);
+    if (entry->kind != SFS_UNSET) {
+        write_be(&header[KIND_OFFSET], entry->kind, 4);
     }
 
-    return SFS_OK;
+    free_map_set(sfs, sector, true);
+    return device_write(sfs, sector_to_address(sfs, sector), header, sizeof(header));
 }
 
-static sfs_err_t get_first_last_sector(sfs_t *sfs, sfs_file_t *file, int32_t *first, int32_t *last) {
-    uint32_t number_of_sectors = sfs->flash_size_bits / sfs->flash_sector_bits;
-    bool belongs_to_file = false; 
-
-    for (uint32_t sector = 0; sector < number_of_sectors; ++sector) {
-        sfs_err_t ret = sector_belongs_to_file(sfs, file, sector, &belongs_to_file);
+/**
+ * @brief Drop uncommitted copy, its sectors would be erased by mount anyway
+ */
+static sfs_err_t compact_abort(sfs_t *sfs) {
+    bool free = false;
+    sfs->compact_phase = SFS_COMPACT_IDLE;
+    for (uint32_t sector = sfs->compact_base; sector < sfs->compact_end; ++sector) {
+        sfs_err_t ret = sector_is_free(sfs, sector, &free);
         SFS_RETURN_ON_ERR(ret);
 
-        if (belongs_to_file == true) {
-            if (*first < 0) {
-                *first = sector;
-            }
-
-            *last = sector;
+        if (free == false) {
+            ret = device_erase(sfs, sector);
+            SFS_RETURN_ON_ERR(ret);
         }
     }
 
     return SFS_OK;
 }
 
-static sfs_err_t find_free_sector(sfs_t *sfs, int32_t *sector) {
-    int32_t number_of_sectors = sfs->flash_size_bits / sfs->flash_sector_bits;
-    int32_t last_sector_with_data = -1;
-    int32_t first_sector_without_data = -1;
-    uint8_t sector_third_element = 0;
+static sfs_err_t compact_update_free_sector(sfs_t *sfs) {
+    if (sfs->io_scheduler == true) {
+        start_free_scan(sfs);
+        snapshot_save(sfs);
+        return SFS_OK;
+    }
 
-    for (int32_t i = 0; i < number_of_sectors; ++i) {
-        int len = sfs->read_fnc(sector_to_address(sfs, i), &sector_third_element, 
-                                sizeof(sector_third_element));
+    return update_free_sector(sfs);
+}
 
-        if (len != sizeof(sector_third_element)) {
-            return SFS_FLASH_READ;
-        }
+/**
+ * @brief Program commit of the copy, then switch directory to it,
+ * old sectors are released afterwards
+ */
+static sfs_err_t compact_commit(sfs_t *sfs) {
+    sfs_dir_entry_t *entry = &sfs->dir[sfs->compact_file];
+    uint32_t count = sfs->compact_position + 1U;
+    uint8_t commit[4] = {0};
+    sfs_err_t ret = device_write(sfs, sector_to_address(sfs, sfs->compact_base) + COMMIT_OFFSET,
+                                 commit, sizeof(commit));
+    SFS_RETURN_ON_ERR(ret);
 
-        if (sector_third_element != FLASH_NO_DATA) {
-            last_sector_with_data = i;
-        } else if (first_sector_without_data < 0) {
-            first_sector_without_data = i;
+    if (sfs->chain_owner != NULL) {
+        uint32_t first_sequence = entry->last_sequence + 1U - count;
+        for (uint32_t sector = 0; sector < number_of_sectors(sfs); ++sector) {
+            if (sfs->chain_owner[sector] == sfs->compact_file) {
+                chain_set(sfs, sector, CHAIN_NO_OWNER, SFS_UNSET);
+            }
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            chain_set(sfs, sfs->compact_base + i, sfs->compact_file, first_sequence + i);
         }
     }
 
-    // TO DO Check wear leveling
-    if ((last_sector_with_data + 1)  == number_of_sectors) {
-        // Last sector has data, go to firts sector without data
-        *sector = first_sector_without_data;
-    } else {
-        // Last sector with data is not at the end 
-        *sector = last_sector_with_data + 1;
+    uint32_t end_offset = entry->end_address - sector_to_address(sfs, entry->last_sector);
+    entry->first_sector = sfs->compact_base;
+    entry->last_sector = sfs->compact_base + count - 1U;
+    entry->last_format = SFS_FORMAT_V2;
+    entry->end_address = sector_to_address(sfs, entry->last_sector) + end_offset;
+    entry->generation += 1;
+    if (entry->last_sector + 1U < sfs->compact_end) {
+        // Spare sectors of the run keep the file contiguous
+        entry->extent_next = entry->last_sector + 1U;
+        entry->extent_end = sfs->compact_end;
     }
 
+    sfs->compact_phase = SFS_COMPACT_RELEASE;
+    sfs->compact_source = sfs->compact_first;
+    sfs->compact_position = count;
+
     return SFS_OK;
 }
 
 /**
- * @brief Write file prefix to sector, set file address 
+ * @brief Copy bytes of the current source sector, copy of the last sector
+ * is done at once, so writer can not append between copy and commit
  * 
  * @param sfs 
- * @param file 
- * @param sector 
+ * @param budget bytes which can be copied in this call
  * @return sfs_err_t 
  */
-static sfs_err_t create_file(sfs_t *sfs, sfs_file_t *file, int32_t sector) {
-    if (sector < 0) {
-        return SFS_UNKNOWN;
-    }
-
-    int len = 0;
-    len = sfs->write_fnc(sector_to_address(sfs, sector), file_prefix, sizeof(file_prefix));
-    if (len != sizeof(file_prefix)) {
-        return SFS_FLASH_WRITE;
-    }
+static sfs_err_t compact_copy(sfs_t *sfs, uint32_t budget) {
+    uint8_t scratch[SFS_COPY_CHUNK];
+    uint8_t *buffer = sfs->compact.buffer != NULL ? sfs->compact.buffer : scratch;
+    uint32_t buffer_size = sfs->compact.buffer != NULL ? sfs->compact.buffer_size : sizeof(scratch);
+    sfs_dir_entry_t *entry = &sfs->dir[sfs->compact_file];
+    uint32_t source = sfs->compact_source;
+    uint32_t target = sfs->compact_base + sfs->compact_position;
+    bool last = source == entry->last_sector;
+    sfs_err_t ret;
 
-    len = sfs->write_fnc(sector_to_address(sfs, sector) + sizeof(file_prefix), 
-                                            file->name, sizeof(file->name)); 
-    if (len != sizeof(file->name)) {
-        return SFS_FLASH_WRITE;
+    if (entry->first_sector != sfs->compact_first || target >= sfs->compact_end) {
+        // Ring moved its head or file outgrew the run
+        ret = compact_abort(sfs);
+        SFS_RETURN_ON_ERR(ret);
+        return SFS_FLASH_FULL;
     }
 
-    file->start_address = sector_to_address(sfs, sector);
-    file->end_address = file->start_address + FILE_INFO_SIZE;
-    file->address_pointer = file->end_address;
+    if (sfs->compact_offset == 0) {
+        sector_header_t header;
+        ret = read_sector_header(sfs, source, &header);
+        SFS_RETURN_ON_ERR(ret);
 
-    return SFS_OK;
-}
+        if (header.format != SFS_FORMAT_V2 || header.header_size != SECTOR_HEADER_SIZE) {
+            // Data of older sector layouts would move, copy has to be byte exact
+            ret = compact_abort(sfs);
+            SFS_RETURN_ON_ERR(ret);
+            return SFS_INVALID_VALUE;
+        }
 
-static sfs_err_t open_file(sfs_t *sfs, sfs_file_t *file, int32_t start_sector, int32_t end_sector) {
-    uint32_t cursor = sector_to_address(sfs, end_sector) + FILE_INFO_SIZE;
-    uint16_t data_len = 0;
+        ret = compact_header(sfs, entry, &header, target, last);
+        SFS_RETURN_ON_ERR(ret);
+        sfs->compact_offset = SECTOR_HEADER_SIZE;
+    }
 
+    bool pipeline = sfs->io_async == true && sfs->compact.buffer != NULL && buffer_size >= 2U;
+    if (pipeline == true) {
+        // Next chunk is read into one half while the other half is programmed
+        buffer_size /= 2U;
+    }
 
-    while(cursor < sfs->flash_sector_bits) {
-        sfs_err_t ret = get_data_len(sfs, cursor, &data_len);
-        SFS_RETURN_ON_ERR(ret);
-        
-        if (data_len == 0) {
-                 return SFS_DATA_SIZE_ZERO;
+    uint32_t copy_end = last == true ? entry->end_address - sector_to_address(sfs, source) :
+                                       sfs->flash_sector_bits - END_OF_SECTOR_SIZE;
+    int8_t program = -1;
+    uint32_t program_address = 0;
+    uint32_t program_size = 0;
+    uint8_t half = 0;
+    ret = SFS_OK;
+    while (sfs->compact_offset < copy_end && (budget > 0 || last == true)) {
+        // Chunks are aligned to buffer size, page sized buffer gives page programs
+        uint32_t chunk = buffer_size - sfs->compact_offset % buffer_size;
+        if (chunk > copy_end - sfs->compact_offset) {
+            chunk = copy_end - sfs->compact_offset;
+        }
+        if (last == false && chunk > budget) {
+            chunk = budget;
         }
 
-        if (data_len == NO_MORE_DATA) {
+        uint8_t *data = &buffer[half * buffer_size];
+        ret = flash_read(sfs, sector_to_address(sfs, source) + sfs->compact_offset, data, chunk);
+        if (ret != SFS_OK) {
             break;
         }
 
-        cursor += data_len + DATA_SIZE_LEN;
-    }
+        if (sfs_scan_not_erased(data, chunk) != chunk) {
+            ret = device_write_end(sfs, program, program_address, program_size);
+            program = -1;
+            if (ret != SFS_OK) {
+                break;
+            }
 
-    file->start_address = sector_to_address(sfs, start_sector);
-    file->end_address = cursor;
-    file->address_pointer = file->start_address + FILE_INFO_SIZE;
+            program_address = sector_to_address(sfs, target) + sfs->compact_offset;
+            program_size = chunk;
+            ret = device_write_start(sfs, program_address, data, chunk, &program);
+            if (ret != SFS_OK) {
+                break;
+            }
+        }
 
-    return SFS_OK;
-}
+        half = pipeline == true ? half ^ 1U : 0;
+        sfs->compact_offset += chunk;
+        budget = budget > chunk ? budget - chunk : 0;
+    }
 
-static sfs_err_t read_file_info_from_sectors(sfs_t *sfs, sfs_file_t *file) {
-    sfs_err_t ret = SFS_OK;
-    int32_t file_first_sector = -1;
-    int32_t file_last_sector = -1;
-    
-    ret = get_first_last_sector(sfs, file, &file_first_sector, &file_last_sector);
+    sfs_err_t program_ret = device_write_end(sfs, program, program_address, program_size);
+    ret = ret == SFS_OK ? program_ret : ret;
     SFS_RETURN_ON_ERR(ret);
 
-    // There is no sector with this file name 
-    if (file_first_sector == -1) {
-        int32_t last_sector = 0;
-        ret = find_free_sector(sfs, &last_sector);
-        SFS_RETURN_ON_ERR(ret);
+    if (sfs->compact_offset < copy_end) {
+        return SFS_OK;
+    }
 
-        if (last_sector < 0) {
-            return SFS_FLASH_FULL;
-        }
+    if (last == true) {
+        return compact_commit(sfs);
+    }
 
-        ret = create_file(sfs, file, last_sector);
-        SFS_RETURN_ON_ERR(ret);
+    ret = write_next_sector(sfs, target, SFS_FORMAT_V2, target + 1U);
+    SFS_RETURN_ON_ERR(ret);
 
-    } else {
-        ret = open_file(sfs, file, file_first_sector, file_last_sector);
-        SFS_RETURN_ON_ERR(ret);
+    uint32_t next_sector;
+    ret = chain_next(sfs, source, SFS_FORMAT_V2, &next_sector);
+    SFS_RETURN_ON_ERR(ret);
+
+    if (next_sector >= number_of_sectors(sfs)) {
+        return SFS_DATA_CORRUPTED;
     }
 
+    sfs->compact_source = next_sector;
+    sfs->compact_position += 1;
+    sfs->compact_offset = 0;
+
     return SFS_OK;
 }
 
-sfs_err_t sfs_open(sfs_t *sfs, sfs_file_t *file, char *file_name) {
-    sfs_err_t ret;
-    
-    ret = set_file_name(file, file_name);
+/**
+ * @brief Erase one sector of the old chain, links of old chain are still intact
+ */
+static sfs_err_t compact_release(sfs_t *sfs) {
+    uint32_t sector = sfs->compact_source;
+    uint32_t next_sector = NO_NEXT_SECTOR;
+    sfs_err_t ret = read_next_sector(sfs, sector_to_address(sfs, sector), SFS_FORMAT_V2, &next_sector);
     SFS_RETURN_ON_ERR(ret);
 
-    ret = read_file_info_from_sectors(sfs, file);
+    ret = device_erase(sfs, sector);
     SFS_RETURN_ON_ERR(ret);
 
-    ret = find_free_sector(sfs, &sfs->next_free_sector);
-    SFS_RETURN_ON_ERR(ret);
+    sfs->compact_position -= 1;
+    sfs->compact_source = next_sector;
+    if (sfs->compact_position == 0 || next_sector >= number_of_sectors(sfs)) {
+        // Sectors left behind by damaged link belong to old generation, mount erases them
+        sfs->compact_phase = SFS_COMPACT_IDLE;
+        return compact_update_free_sector(sfs);
+    }
 
     return SFS_OK;
 }
 
-bool is_open(sfs_file_t *file) {
-    (void) file;
-    return true;
-}
-
-static sfs_err_t write_2bytes(sfs_t *sfs, sfs_file_t *file, uint16_t data) {
-    uint8_t two_bytes[2];
-    two_bytes[0] = (data >> 8) & 0xFF;
-    two_bytes[1] = data & 0xFF;
-    
-    int ret_size = sfs->write_fnc(file->end_address, two_bytes, sizeof(two_bytes));
-    file->end_address += ret_size;
-    if (ret_size != sizeof(two_bytes)) {
-        return SFS_FLASH_WRITE;
+/**
+ * @brief Reserve run of free sectors for copy of the file, with spare
+ * sectors for its growth when there is room
+ */
+static sfs_err_t compact_begin(sfs_t *sfs, sfs_file_t *file, const sfs_compact_config_t *config) {
+    if (sfs == NULL || file == NULL) {
+        return SFS_NULL_POINTER;
     }
 
-    return SFS_OK;
-}
-
-static sfs_err_t write_size_and_data(sfs_t *sfs, sfs_file_t *file, 
-                                     uint8_t *data, uint16_t size) {
-    // Write size
-    sfs_err_t ret = write_2bytes(sfs, file, size);
-    if (ret != SFS_OK) {
-        return ret;
+    if (sfs->compact_phase != SFS_COMPACT_IDLE || file->file_descriptor >= sfs->dir_count) {
+        return SFS_INVALID_VALUE;
     }
 
-    // Write data
-    int ret_size = sfs->write_fnc(file->end_address, data, size);
-    file->end_address += ret_size;
-    if (ret_size != size) {
-        return SFS_FLASH_WRITE;
+    if (config != NULL && config->buffer != NULL && config->buffer_size == 0) {
+        return SFS_INVALID_SIZE;
     }
 
-    return SFS_OK;
-}
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    int32_t base = -1;
+    uint32_t reserved = entry->sectors + SFS_COMPACT_SPARE;
+    sfs_err_t ret = find_free_extent(sfs, reserved, &base);
+    SFS_RETURN_ON_ERR(ret);
 
-sfs_err_t open_sector_and_write(sfs_t *sfs, sfs_file_t *file, uint8_t *data, uint16_t size) {
-    // write next free sector
-    // TO DO: CAST FROM INT32 to UIN16
-    SFS_DEBUG("NEXT SECTOR %d", sfs->next_free_sector);
-    sfs_err_t ret = write_2bytes(sfs, file, sfs->next_free_sector);    
-    if (ret != SFS_OK) {
-        return ret;
-    }
-    
-    // open new sector
-    uint32_t file_start_address = file->start_address;
-    uint32_t file_address_pointer = file->address_pointer;
-    ret = create_file(sfs, file, sfs->next_free_sector);
-    
-    file->start_address = file_start_address;
-    file->address_pointer = file_address_pointer;
-    if (ret != SFS_OK) {
-        return ret;
+    if (base < 0) {
+        reserved = entry->sectors;
+        ret = find_free_extent(sfs, reserved, &base);
+        SFS_RETURN_ON_ERR(ret);
     }
 
-    // write data
-    ret = write_size_and_data(sfs, file, data, size);
-    if (ret != SFS_OK) {
-        return ret;
+    if (base < 0) {
+        return SFS_FLASH_FULL;
     }
-    
-    // find new free sector
-    ret = find_free_sector(sfs, &sfs->next_free_sector);
-    if (ret != SFS_OK) {
-        return ret;
+
+    (void) memset(&sfs->compact, SFS_EMPTY_VALUE, sizeof(sfs->compact));
+    if (config != NULL) {
+        sfs->compact = *config;
     }
+    sfs->compact_phase = SFS_COMPACT_COPY;
+    sfs->compact_file = file->file_descriptor;
+    sfs->compact_base = base;
+    sfs->compact_end = base + reserved;
+    sfs->compact_first = entry->first_sector;
+    sfs->compact_source = entry->first_sector;
+    sfs->compact_position = 0;
+    sfs->compact_offset = 0;
+    snapshot_invalidate(sfs);
 
-    return SFS_OK;
+    // Run is reserved now, free sector must not point into it
+    return compact_update_free_sector(sfs);
 }
 
-sfs_err_t sfs_write(sfs_t *sfs, sfs_file_t *file, uint8_t *data, uint16_t size) {
-    if (is_open(file) == false) {
-        return SFS_FILE_NOT_OPEN;
-    }
+/**
+ * @brief Move read position of handle to the copy, old chain is still intact
+ */
+static sfs_err_t compact_remap(sfs_t *sfs, sfs_file_t *file) {
+    sfs_dir_entry_t *entry = &sfs->dir[file->file_descriptor];
+    uint32_t reader = address_to_sector(sfs, file->address_pointer);
+    uint32_t sector = sfs->compact_first;
+    file->start_address = sector_to_address(sfs, entry->first_sector);
+    file->end_address = entry->end_address;
+    file->write_format = SFS_FORMAT_V2;
 
-    uint32_t sector_free_size = sfs->flash_sector_bits - (file->end_address % sfs->flash_sector_bits);
-    uint16_t first_write_size = 0;
-    // get first write size, save last 2 bytes for next sector'
-    if (sector_free_size >= (size + DATA_LEN_SIZE + END_OF_SECTOR_SIZE)) {
-        first_write_size = size;
-    } else if (sector_free_size == 2) {
-        first_write_size = 0;
-    } else {
-        // Data len + data size = size + DATA_LEN_SIZE
-        first_write_size = sector_free_size - DATA_LEN_SIZE - END_OF_SECTOR_SIZE;
-    }
-    
-    // // write size and data
-    sfs_err_t ret;
-    if (sector_free_size > 2) {
-        ret = write_size_and_data(sfs, file, data, first_write_size);
-        if (ret != SFS_OK) {
-            return ret;
+    for (uint32_t i = 0; i < sfs->compact_position && sector < number_of_sectors(sfs); ++i) {
+        if (sector == reader) {
+            file->address_pointer = sector_to_address(sfs, sfs->compact_base + i) +
+                                    file->address_pointer % sfs->flash_sector_bits;
+            file->read_format = SFS_FORMAT_V2;
+            file->generation = entry->generation;
+            return SFS_OK;
         }
-    } 
 
-    // end of sector 
-    if (first_write_size != size) {
-        ret = open_sector_and_write(sfs, file, data + first_write_size,
-                                    size - first_write_size);
-        if (ret != SFS_OK) {
-            return ret;
-        }
+        sfs_err_t ret = read_next_sector(sfs, sector_to_address(sfs, sector), SFS_FORMAT_V2, &sector);
+        SFS_RETURN_ON_ERR(ret);
     }
 
+    // Read position is not in the file, reads report SFS_FILE_MOVED
     return SFS_OK;
 }
 
-static sfs_err_t read_2bytes(sfs_t *sfs, sfs_file_t *file, uint16_t *ret_val) {
-    uint8_t bytes[DATA_SIZE_LEN];
-    int ret_size = sfs->read_fnc(file->address_pointer, bytes, sizeof(bytes));
-    if (ret_size != sizeof(bytes)) {
-        return SFS_FLASH_READ;
+/**
+ * @brief Copy file into contiguous run of erased sectors and release its
+ * old sectors, copy becomes the file at once when its commit is programmed,
+ * interrupted compaction is finished or undone by mount
+ * 
+ * @param sfs 
+ * @param file handle keeps its position, other handles of the file have to
+ * seek before reading, writers continue at the new end
+ * @param config optional, copy buffer
+ * @return sfs_err_t SFS_FLASH_FULL if there is no run for the file
+ */
+sfs_err_t sfs_compact(sfs_t *sfs, sfs_file_t *file, const sfs_compact_config_t *config) {
+    sfs_err_t ret = compact_begin(sfs, file, config);
+    SFS_RETURN_ON_ERR(ret);
+
+    while (sfs->compact_phase == SFS_COMPACT_COPY) {
+        ret = compact_copy(sfs, UINT32_MAX);
+        SFS_RETURN_ON_ERR(ret);
     }
 
-    file->address_pointer += ret_size;
-    *ret_val |= bytes[0] << 8;
-    *ret_val |= bytes[1];
-    return SFS_OK;
-}
+    ret = compact_remap(sfs, file);
+    SFS_RETURN_ON_ERR(ret);
 
-static bool address_on_end_of_sector(sfs_t *sfs, uint32_t address) {
-    uint32_t position_in_sector = address % sfs->flash_sector_bits;
-    if (position_in_sector != sfs->flash_sector_bits - END_OF_SECTOR_SIZE) {
-        return false;
+    while (sfs->compact_phase == SFS_COMPACT_RELEASE) {
+        ret = compact_release(sfs);
+        SFS_RETURN_ON_ERR(ret);
     }
 
-    return true;
+    return SFS_OK;
 }
 
-static bool address_after_end_of_sector(sfs_t *sfs, uint32_t address) {
-    uint32_t position_in_sector = address % sfs->flash_sector_bits;
-    if (position_in_sector < sfs->flash_sector_bits - END_OF_SECTOR_SIZE) {
-        return false;
+/**
+ * @brief Start compaction done by sfs_poll, slice_bytes are copied per call,
+ * writer can append meanwhile, ring files are compacted only by sfs_compact
+ * 
+ * @param sfs 
+ * @param file 
+ * @param config optional, copy buffer and slice size, copied
+ * @return sfs_err_t 
+ */
+sfs_err_t sfs_compact_start(sfs_t *sfs, sfs_file_t *file, const sfs_compact_config_t *config) {
+    if (sfs == NULL || file == NULL) {
+        return SFS_NULL_POINTER;
     }
 
-    return true;
-}
+    if (file->file_descriptor < sfs->dir_count && sfs->dir[file->file_descriptor].ring_sectors != 0) {
+        // Recycling would erase head which was already copied
+        return SFS_INVALID_VALUE;
+    }
 
-static sfs_err_t move_ptr_to_next_sector(sfs_t *sfs, sfs_file_t *file) {
-    uint16_t sector;
-    sfs_err_t ret = read_2bytes(sfs, file, &sector);
-    SFS_RETURN_ON_ERR(ret);
+    return compact_begin(sfs, file, config);
+}
 
-    file->address_pointer = sector * sfs->flash_sector_bits + FILE_INFO_SIZE;
+/**
+ * @brief Run one slice of background work, call it from idle time,
+ * free sector scan slice goes first, then erase suspended by foreground
+ * access is resumed or next queued erase is started, so erase runs
+ * on the device until the next foreground access, compaction slice
+ * runs when no erase is in progress
+ * 
+ * @param sfs 
+ * @param pending optional, set if there is more work
+ * @return sfs_err_t 
+ */
+sfs_err_t sfs_poll(sfs_t *sfs, bool *pending) {
+    if (sfs == NULL) {
+        return SFS_NULL_POINTER;
+    }
 
-    return SFS_OK;
-}
+    sfs_err_t ret = SFS_OK;
+    bool in_flight = io_poll(sfs);
+    if (sfs->io_scan_pending == true) {
+        ret = scan_free_sectors(sfs, SFS_IO_SCAN_SLICE);
+        if (ret == SFS_OK && sfs->io_scan_next >= number_of_sectors(sfs)) {
+            ret = finish_free_scan(sfs);
+        }
+        SFS_RETURN_ON_ERR(ret);
+    }
 
-static sfs_err_t read_size_and_data(sfs_t *sfs, sfs_file_t *file,
-                                    uint8_t *buffer, uint16_t buffer_size) {
-    uint16_t size;
-    sfs_err_t ret = read_2bytes(sfs, file, &size);
-    SFS_RETURN_ON_ERR(ret);
+    if (sfs->io_erasing >= 0 || sfs->io_count > 0) {
+        // Erase control waits for transfers
+        io_quiesce(sfs);
+        in_flight = false;
+    }
 
-    if (size == NO_MORE_DATA) {
-        return SFS_EOF;
+    if (sfs->io_erasing >= 0) {
+        sfs_device_t *device = &sfs->devices[sfs->io_erasing % sfs->device_count];
+        if (sfs->io_suspended == true) {
+            (void) device->resume_fnc(device->ctx);
+            sfs->io_suspended = false;
+        } else if (device->busy_fnc(device->ctx) == false) {
+            io_erase_done(sfs);
+        }
     }
 
-    if (size > buffer_size) {
-        return SFS_BUFFER_SIZE;
+    if (sfs->io_erasing < 0 && sfs->io_count > 0) {
+        uint32_t sector = sfs->io_queue[0];
+        sfs->io_count -= 1;
+        (void) memmove(&sfs->io_queue[0], &sfs->io_queue[1], sfs->io_count * sizeof(sfs->io_queue[0]));
+        SFS_TRACE(SFS_TRACE_ERASE_START, sector, sfs->io_count);
+
+        sfs_device_t *device = sfs->device_count > 0 ? &sfs->devices[sector % sfs->device_count] : NULL;
+        if (device != NULL && device->erase_start_fnc != NULL && device->busy_fnc != NULL) {
+            sfs->io_erasing = sector;
+            if (device->erase_start_fnc(device->ctx, device_sector(sfs, sector)) == false) {
+                // Sector is already detached from its file, erase it now
+                sfs->io_erasing = -1;
+                ret = device_erase(sfs, sector);
+            } else {
+                free_map_set(sfs, sector, false);
+                chain_set(sfs, sector, CHAIN_NO_OWNER, SFS_UNSET);
+            }
+        } else {
+            // Device can not erase in background, whole erase is one slice
+            ret = device_erase(sfs, sector);
+        }
     }
 
-    int ret_size = sfs->read_fnc(file->address_pointer, buffer, size);
-    SFS_RETURN_ON_ERR(ret);
+    if (ret == SFS_OK && sfs->io_erasing < 0 && sfs->compact_phase == SFS_COMPACT_COPY) {
+        uint32_t budget = sfs->compact.slice_bytes;
+        if (budget == 0) {
+            budget = sfs->compact.buffer != NULL ? sfs->compact.buffer_size : SFS_COPY_CHUNK;
+        }
+        ret = compact_copy(sfs, budget);
+    } else if (ret == SFS_OK && sfs->io_erasing < 0 && sfs->compact_phase == SFS_COMPACT_RELEASE) {
+        ret = compact_release(sfs);
+    }
 
-    file->address_pointer += ret_size;
+    if (pending != NULL) {
+        *pending = sfs->io_scan_pending == true || sfs->io_erasing >= 0 || sfs->io_count > 0 ||
+                   sfs->compact_phase != SFS_COMPACT_IDLE || in_flight == true;
+    }
 
-    return SFS_OK;
+    return ret;
 }
 
-sfs_err_t sfs_read_line(sfs_t *sfs, sfs_file_t *file, uint8_t *buffer, uint16_t buffer_size) {
-    sfs_err_t ret;
-    if (address_on_end_of_sector(sfs, file->address_pointer)) {
-        ret = move_ptr_to_next_sector(sfs, file);
-        SFS_RETURN_ON_ERR(ret);
+/**
+ * @brief Save mount state and append positions into retention RAM now, it is
+ * also saved by mount and whenever a file gains or loses sectors
+ * 
+ * @param sfs 
+ * @return sfs_err_t SFS_INVALID_VALUE if no retention RAM is configured
+ */
+sfs_err_t sfs_snapshot(sfs_t *sfs) {
+    if (sfs == NULL) {
+        return SFS_NULL_POINTER;
+    }
 
-    } else if (address_after_end_of_sector(sfs, file->address_pointer)) {
-        return SFS_DATA_CORRUPTED;
+    if (sfs->retention == NULL) {
+        return SFS_INVALID_VALUE;
     }
 
-    ret = read_size_and_data(sfs, file, buffer, buffer_size);
+    sfs_err_t ret = mount_if_needed(sfs);
     SFS_RETURN_ON_ERR(ret);
 
+    snapshot_save(sfs);
     return SFS_OK;
 }
-
-
-sfs_err_t sfs_close(sfs_t *sfs, sfs_file_t *file) {
-    (void) sfs;
-    (void) memset(file, 0, sizeof(sfs_file_t));
-    return SFS_OK;
-}
-
-
-
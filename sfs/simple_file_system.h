@@ -5,22 +5,102 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "sfs_trace.h"
+
 #define NO_MORE_DATA 0xFFFF
+#define NO_NEXT_SECTOR 0xFFFFFFFFU
 #define SFS_EMPTY_VALUE 0x00
 #define FLASH_NO_DATA 0xFF
-#define DATA_SIZE_LEN 0x02
+#define SFS_PADDING 0x00
 
 #define MAX_FILE_NAME_SIZE 8
 #define FILE_PREFIX_SIZE 3
-#define DATA_LEN_SIZE 2U
-#define END_OF_SECTOR_SIZE 2U
 #define FILE_INFO_SIZE (MAX_FILE_NAME_SIZE + FILE_PREFIX_SIZE)
 
+// Last byte of the prefix holds the on-flash format version
+#define SFS_FORMAT_LEGACY 0x53 // Original "SFS" prefix, 2 byte lengths and links
+#define SFS_FORMAT_V1 0x01 // Not torn write safe, record cut after its length reads as 0xFF data
+#define SFS_FORMAT_V2 0x02 // Record lengths carry commit bit
+
+// Format v2 sector layout (v1 ends with tags):
+// | prefix 3 | name 8 | header size 1 | continuation 4 | sequence 4 | created 4 |
+// | records 4 | size 4 | ring sectors 4 | extent sectors 4 | extent end 4 |
+// | time min 4 | time max 4 | generation 4 | commit 4 | tags 4 | origin 4 | kind 4 |
+// | records ... | next sector 4 |
+// Record: length (1, 2 or 4 bytes, see SFS_DATA_LEN_SIZE) + data, data can span sectors,
+// continuation is the number of bytes at the start of the sector that belong to
+// a record started in one of the previous sectors, sequence is the sector position
+// in the file, created is the file creation number, records and size summarize
+// the sector and are programmed when the sector is closed, ring sectors is
+// the sector budget of ring file (erased for regular files), extent sectors
+// and extent end describe contiguous sectors reserved for the file, time min
+// and time max are timestamp range of timed records, programmed at close,
+// generation counts compactions of the file (erased for 0), commit is
+// programmed in the first sector of compacted copy once it is complete,
+// tags is bitmap of stream tags of records started in the sector, programmed
+// at close (erased if unknown, every tag can be present), origin is the address
+// of the length of the record continued in the sector (erased if there is none),
+// kind is sfs_open_flags_t record kind of the file (erased in files written before it).
+// In v2 the length is programmed with commit bit set and the bit is cleared once
+// record data is complete, summary of a sector closed in the middle of a record
+// is programmed after the commit, mount drops the uncommitted record.
+// Fields after continuation are optional, readers check header size.
+#define SECTOR_HEADER_SIZE (FILE_INFO_SIZE + 1U + 4U * 16U)
+#define SFS_TIME_SIZE 4U
+#define SFS_TAG_SIZE 1U
+#define SFS_MAX_TAGS 32U
+#define SFS_TAG(x) (1UL << (x)) // Bit of tag in tag filter and sector bitmap
+#define SFS_MATCH_MAX_SIZE 16U // Bytes compared by sfs_filter_t, SFS_SCAN_PATTERN_MAX
+#define END_OF_SECTOR_SIZE 4U
+#define DATA_LEN_MAX_SIZE 4U
+#define SFS_DATA_LEN_SIZE(x) ((x) < 0x40U ? 1U : ((x) < 0x2000U ? 2U : 4U))
+#define SFS_MAX_RECORD_SIZE 0x0FFFFFFFU
+
+#define LEGACY_DATA_LEN_SIZE 2U
+#define LEGACY_END_OF_SECTOR_SIZE 2U
+
+#define SFS_UNSET 0xFFFFFFFFU
+
+#ifndef SFS_MAX_FILES
+#define SFS_MAX_FILES 16
+#endif
+
+#ifndef SFS_MAX_DEVICES
+#define SFS_MAX_DEVICES 4
+#endif
+
+#ifndef SFS_COMPACT_SPARE
+#define SFS_COMPACT_SPARE 2U    // Sectors reserved after compacted file for its growth
+#endif
+
+#ifndef SFS_COPY_CHUNK
+#define SFS_COPY_CHUNK 64U      // Compaction copy unit when no buffer is given
+#endif
+
+// I/O scheduler is cooperative, foreground calls (appends, reads) run at once and
+// suspend background erase, free sector scan and queued ring erases run in bounded
+// slices from sfs_poll, scan first, reads and programs are not split
+#ifndef SFS_IO_QUEUE_SIZE
+#define SFS_IO_QUEUE_SIZE 4     // Background erases waiting for sfs_poll
+#endif
+
+#ifndef SFS_ARENA_ALIGN
+#define SFS_ARENA_ALIGN 4U
+#endif
+
+#ifndef SFS_IO_INFLIGHT
+#define SFS_IO_INFLIGHT 4       // Asynchronous transfers submitted and not collected yet
+#endif
+
+#ifndef SFS_IO_SCAN_SLICE
+#define SFS_IO_SCAN_SLICE 64    // Sectors checked by one sfs_poll call
+#endif
+
 #define MB_TO_BITS(x) (x * 1024 * 1024)
 #define KB_TO_BITS(x) (x * 1024)
 
-#define SFS_DEBUG_ON
-#ifdef SFS_DEBUG_ON 
+// Text debug output, opt-in, use SFS_TRACE for events on the write path
+#ifdef SFS_DEBUG_ON
 #define SFS_DEBUG(format, ...) printf("SFS_D: "format"\n", __VA_ARGS__)
 #else
 #define SFS_DEBUG(format, ...)
@@ -31,6 +111,16 @@ extern uint8_t file_prefix[FILE_PREFIX_SIZE]; // Testing purpose
 typedef bool(*sfs_flash_erase)(uint32_t sector);
 typedef int(*sfs_flash_read)(uint32_t address, uint8_t *buffer, uint32_t size);
 typedef int(*sfs_flash_write)(uint32_t address, uint8_t* buffer, uint32_t size);
+typedef bool(*sfs_device_erase)(void *ctx, uint32_t sector);
+typedef int(*sfs_device_read)(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size);
+typedef int(*sfs_device_write)(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size);
+typedef bool(*sfs_device_control)(void *ctx);
+typedef void(*sfs_io_done)(void *arg, int result);
+typedef bool(*sfs_device_submit)(void *ctx, uint8_t op, uint32_t address, uint8_t *buffer, uint32_t size,
+                                 sfs_io_done done, void *arg);
+typedef bool(*sfs_line_visitor)(const uint8_t *data, uint32_t size, void *arg);
+typedef void(*sfs_tail_notify)(void *arg);
+typedef bool(*sfs_record_filter)(const uint8_t *data, uint32_t size, void *arg);
 
 typedef enum {
     SFS_OK = 0,
@@ -49,8 +139,21 @@ typedef enum {
     SFS_EOF,
     SFS_BUFFER_SIZE,
     SFS_DATA_CORRUPTED,
+    SFS_NOT_MAPPED,
+    SFS_NOT_CONTIGUOUS,
+    SFS_FILE_NOT_FOUND,
+    SFS_DIR_FULL,
+    SFS_FLASH_ERASE,
+    SFS_FILE_MOVED,
+    SFS_CURSOR_STALE,
 } sfs_err_t;
 
+typedef enum {
+    SFS_OPEN_NO_CREATE = 0x01, // Return SFS_FILE_NOT_FOUND instead of creating file
+    SFS_OPEN_TIMED = 0x02,  // File takes only sfs_write_timed records, kind is kept by the file
+    SFS_OPEN_TAGGED = 0x04, // File takes only sfs_write_tagged records, kind is kept by the file
+} sfs_open_flags_t;
+
 typedef struct {
     uint8_t name[MAX_FILE_NAME_SIZE]; // File name
     uint32_t end_address;   // End of data
@@ -58,16 +161,246 @@ typedef struct {
     uint32_t address_pointer; // User address pointer
 
     uint8_t file_descriptor;
+    uint8_t read_format;  // Format of sector under address_pointer
+    uint8_t write_format; // Format of sector under end_address
+    bool tail;            // Reader follows writer of the file in RAM, see sfs_tail
+    uint32_t generation;  // File generation at open or seek, reads return SFS_FILE_MOVED after compaction
+    uint32_t tags;        // Tag filter of reads, see sfs_select_tags, 0 to read every record
+    uint32_t record_index; // Records returned by reads since open or seek, kept by sfs_cursor_save
 } sfs_file_t;
 
+typedef struct {
+    uint8_t name[MAX_FILE_NAME_SIZE];
+    uint32_t created;       // File creation number
+    uint32_t first_sector;
+    uint32_t last_sector;
+    uint32_t sectors;
+    uint32_t records;
+    uint32_t size;          // Data bytes
+    uint32_t end_address;   // First free byte
+    uint32_t last_sequence; // Sequence number of last sector
+    uint8_t last_format;    // Format of last sector, write format of opened files
+    uint32_t kind;          // Record kind from header, SFS_UNSET if any record is taken
+    uint32_t last_records;  // Records started in last sector
+    uint32_t last_size;     // Data bytes in last sector
+    uint32_t last_time_min; // Timestamp range of last sector, empty if min > max
+    uint32_t last_time_max;
+    uint32_t last_tags;     // Tags of records started in last sector, SFS_UNSET if unknown
+    uint32_t ring_sectors;  // Sector budget of ring file, 0 if file is not a ring
+    int32_t ring_spare;     // Oldest sector detached for background erase, -1 if none
+    uint32_t extent_sectors; // Size of extent reserved when file runs out of it, 0 to disable
+    uint32_t extent_next;   // Next reserved sector, extent is empty if equal to extent_end
+    uint32_t extent_end;
+    sfs_tail_notify tail_fnc; // Called after every record written to the file, NULL if not used
+    void *tail_arg;
+    uint32_t generation;    // Compactions of the file, highest generation seen during mount
+    uint32_t generation_low; // Used during mount to detect interrupted compaction
+    uint32_t generation_committed;
+    uint64_t first_order;   // Used during mount to find first and last sector
+    uint64_t last_order;
+    uint64_t prev_order;    // Sector before the last one, checked by power loss recovery
+    uint32_t prev_sector;
+    uint32_t pending_record; // Length of record whose data is not complete, SFS_UNSET if none
+    uint8_t pending_commit; // First length byte with commit bit cleared
+    uint32_t pending_sector; // First sector closed while record was pending, SFS_UNSET if none
+    uint32_t pending_records; // Summary of pending_sector, programmed after the commit
+    uint32_t pending_size;
+} sfs_dir_entry_t;
+
+#define SFS_SNAPSHOT_MAGIC 0x53465352U
+
+// Mount state kept in retention RAM over reset, see sfs_config_t.retention
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;           // CRC-32 of everything after this field up to the last used entry
+    uint32_t generation;    // Counts saves, newer of the two copies is adopted
+    uint32_t flash_size_bits; // Geometry the state belongs to
+    uint32_t flash_sector_bits;
+    uint32_t partition_address;
+    uint8_t device_count;
+    uint8_t dir_count;
+    int32_t next_free_sector; // -1 if free sector scan was pending
+    uint32_t next_created;
+    sfs_dir_entry_t dir[SFS_MAX_FILES];
+} sfs_snapshot_t;
+
+// Retention RAM for two copies of the state, one survives reset during save
+#define SFS_RETENTION_SIZE (2U * sizeof(sfs_snapshot_t))
+// Cursor files are named by the cursor and marked by their kind, each takes one of SFS_MAX_FILES
+// directory entries and is listed by sfs_readdir and sfs_stat, count them in SFS_MAX_FILES
+#define SFS_CURSOR_SECTORS 2U // Ring budget of cursor files, see sfs_cursor_save
+#define SFS_CURSOR_KIND 0x80U // sfs_stat_t kind of cursor files, they take no sfs_write records
+
+typedef struct {
+    char name[MAX_FILE_NAME_SIZE];
+    uint32_t size;          // Data bytes, without record lengths
+    uint32_t records;
+    uint32_t sectors;
+    uint32_t first_sector;
+    uint32_t last_sector;
+    uint32_t created;       // File creation number, increasing
+    uint32_t kind;          // Record kind, sfs_open_flags_t, SFS_UNSET if file was written without it
+} sfs_stat_t;
+
+typedef struct {
+    uint32_t index;
+} sfs_dir_t;
+
+typedef struct {
+    char name[MAX_FILE_NAME_SIZE];
+    uint8_t format;
+    uint32_t sequence;      // SFS_UNSET in sectors without sequence number
+    uint32_t created;
+    uint32_t first_record;  // Address of the first record which starts in this sector
+    uint32_t tags;          // Tags of records started in this sector, SFS_UNSET if not known
+    uint32_t next_sector;   // NO_NEXT_SECTOR if not linked
+} sfs_sector_info_t;
+
+typedef struct {
+    void *ctx;              // Passed to every call, e.g. SPI bus of the chip
+    sfs_device_erase erase_fnc;
+    sfs_device_read read_fnc;   // Device addresses, sector of the device * sector size
+    sfs_device_write write_fnc;
+    // Optional, used by I/O scheduler, erase runs in background when
+    // erase_start_fnc and busy_fnc are set, suspend/resume let reads and
+    // programs run during erase instead of waiting for its end
+    sfs_device_erase erase_start_fnc;
+    sfs_device_control busy_fnc;    // True while erase is running
+    sfs_device_control suspend_fnc; // False if there is nothing to suspend
+    sfs_device_control resume_fnc;
+    // Optional asynchronous transfers, e.g. SPI with DMA, used when every device
+    // has both: submit_fnc queues sfs_io_op_t and returns at once (false if the
+    // queue is full), done gets transferred bytes or negative error and is
+    // called from poll_fnc, which returns true while transfers are in flight.
+    // Erase, control and blocking functions are called only when nothing is in flight
+    sfs_device_submit submit_fnc;
+    sfs_device_control poll_fnc;
+} sfs_device_t;
+
+typedef enum {
+    SFS_IO_READ = 0,
+    SFS_IO_PROGRAM,
+} sfs_io_op_t;
+
+typedef enum {
+    SFS_IO_FREE = 0,
+    SFS_IO_FLIGHT,          // Submitted, done was not called yet
+    SFS_IO_DONE,            // Result waits for its owner
+} sfs_io_state_t;
+
+typedef struct {
+    uint8_t state;          // sfs_io_state_t
+    int result;             // Transferred bytes, negative on error
+} sfs_io_slot_t;
+
+typedef struct {
+    uint32_t flags;         // sfs_open_flags_t
+    uint32_t ring_sectors;  // Keep only last N sectors, oldest is erased and reused, 0 to disable
+    uint32_t extent_sectors; // Reserve N contiguous sectors at once, 0 to allocate sector by sector
+} sfs_file_config_t;
+
+// Byte range of record is compared with value as big endian unsigned number
+typedef enum {
+    SFS_MATCH_EQ = 0,
+    SFS_MATCH_NE,
+    SFS_MATCH_LT,
+    SFS_MATCH_LE,
+    SFS_MATCH_GT,
+    SFS_MATCH_GE,
+} sfs_match_op_t;
+
+typedef struct {
+    sfs_record_filter fnc;  // Return true to read record, NULL to match byte range instead
+    void *arg;
+    uint32_t offset;        // Byte range of record data, records shorter than range do not match
+    uint8_t size;           // Up to SFS_MATCH_MAX_SIZE
+    uint8_t op;             // sfs_match_op_t
+    uint8_t value[SFS_MATCH_MAX_SIZE];
+    uint32_t record_size;   // Data size of fixed layout records, 0 if records differ in size
+} sfs_filter_t;
+
+typedef struct {
+    uint8_t *buffer;        // Copy buffer, NULL to copy in SFS_COPY_CHUNK pieces on stack
+    uint32_t buffer_size;   // Peak RAM of compaction, unit of reads and programs, e.g. flash page
+    uint32_t slice_bytes;   // Bytes copied by one sfs_poll call, 0 for one buffer
+} sfs_compact_config_t;
+
+// Record written and read in pieces, see sfs_object_begin and sfs_object_read_begin
+typedef struct {
+    uint8_t *buffer;        // Write staging buffer, NULL to program appended pieces as they come
+    uint32_t buffer_size;   // Programs end on multiples of buffer_size, e.g. flash page
+    uint32_t size;          // Object data size
+    uint32_t offset;        // Bytes appended or read so far
+    uint32_t buffered;      // Appended bytes waiting in buffer
+} sfs_object_t;
+
+typedef enum {
+    SFS_COMPACT_IDLE = 0,
+    SFS_COMPACT_COPY,       // Copying sectors of the file into reserved run
+    SFS_COMPACT_RELEASE,    // Copy is committed, old sectors are erased
+} sfs_compact_phase_t;
+
 typedef struct {
     sfs_flash_erase erase_fnc;
     sfs_flash_read read_fnc;
     sfs_flash_write write_fnc;
+    uint8_t device_count;   // 0 if single flash is accessed with *_fnc
+    sfs_device_t devices[SFS_MAX_DEVICES];
+    const uint8_t *map_base; // Flash mapped into address space, NULL if not available
+    uint8_t *burst_buffer;  // Read ahead window of record reads, NULL if not used
+    uint32_t burst_size;
+    uint32_t burst_address; // Flash address of burst_buffer content
+    uint32_t burst_length;  // Valid bytes in burst_buffer
+    uint8_t *burst_spare;   // Second half of the window, filled ahead by async read, NULL if not used
+    uint32_t burst_spare_address;
+    uint32_t burst_spare_length;
+    int8_t burst_spare_slot; // Read of the spare half, -1 if none
+    bool burst_spare_stale; // Flash under spare half changed after the read was submitted
     int32_t next_free_sector;
 
-    uint32_t flash_size_bits;
+    uint8_t *arena;         // Caller memory for caches and indexes, nothing is malloc'ed
+    uint32_t arena_size;
+    uint32_t arena_used;
+    uint8_t *free_map;      // Bit per sector, set if sector is used, NULL to scan flash
+    bool free_map_valid;    // Built by mount
+    uint8_t *chain_owner;   // Directory index of sector owner per sector, NULL to follow links only
+    uint32_t *chain_sequence; // Sequence number per sector, SFS_UNSET if not known
+    bool chain_valid;       // Built by mount
+
+    bool io_scheduler;
+    uint8_t io_count;
+    uint32_t io_queue[SFS_IO_QUEUE_SIZE]; // Sectors to erase
+    int32_t io_erasing;     // Sector with erase in progress, -1 if none
+    bool io_suspended;
+    bool io_scan_pending;   // next_free_sector is updated by sfs_poll
+    uint32_t io_scan_next;
+    int32_t io_scan_last_used;
+    int32_t io_scan_first_free;
+    bool io_async;          // Transfers are submitted, see sfs_device_t.submit_fnc
+    sfs_io_slot_t io_slots[SFS_IO_INFLIGHT];
+
+    sfs_compact_phase_t compact_phase;
+    sfs_compact_config_t compact;
+    uint8_t compact_file;   // Directory index of compacted file
+    uint32_t compact_base;  // First sector of the run, copy of sector at position n is base + n
+    uint32_t compact_end;   // End of reserved run
+    uint32_t compact_first; // First sector of the old chain
+    uint32_t compact_source; // Old sector being copied or released
+    uint32_t compact_position; // Position of source in the file, old sectors left in release phase
+    uint32_t compact_offset; // Copied bytes of source, header included
+
+    sfs_snapshot_t *retention; // Two copies of mount state, NULL if not used
+    uint32_t snapshot_generation;
+    bool free_sector_valid; // next_free_sector is up to date (scanned or checked snapshot), open skips the scan
+
+    bool mounted;
+    uint8_t dir_count;
+    uint32_t next_created;
+    sfs_dir_entry_t dir[SFS_MAX_FILES];
+
+    uint32_t flash_size_bits; // Size of the partition, whole devices if none is configured
     uint32_t flash_sector_bits;
+    uint32_t partition_address; // Device address of sector 0
 } sfs_t;
 
 typedef struct {
@@ -77,13 +410,69 @@ typedef struct {
     sfs_flash_erase erase_fnc;
     sfs_flash_read read_fnc;
     sfs_flash_write write_fnc;
+    const uint8_t *map_base; // Optional, address 0 of the flash in the data bus, single device only
+    const sfs_device_t *devices; // Optional, sectors are striped across devices, *_fnc are not used
+    uint8_t device_count;   // Devices of the same size, flash_size_mb each
+    uint8_t *burst_buffer;  // Optional, records are read in bursts of burst_size bytes
+    uint32_t burst_size;
+    bool io_scheduler;      // Defer erase and free sector scan to sfs_poll
+    uint8_t *arena;         // Optional, RAM budget for caches and indexes, see sfs_ram_usage
+    uint32_t arena_size;
+    uint8_t *retention;     // Optional, RAM kept over reset, mount adopts state saved in it, see SFS_RETENTION_SIZE
+    uint32_t retention_size;
+    uint32_t partition_offset; // Device address where the file system starts, multiple of sector size
+    uint32_t partition_sectors; // Sectors of the file system, 0 for everything from partition_offset on
 } sfs_config_t;
 
+// RAM each arena feature needs at given geometry, features are granted in
+// this order, feature which does not fit falls back to flash scanning,
+// burst window is shrunk to the space left
+typedef struct {
+    uint32_t free_map;      // Free sector bitmap, allocation without flash scan
+    uint32_t chain_index;   // Owner and sequence of every sector, random access and damaged link recovery
+    uint32_t burst;         // Read ahead window, when burst_buffer is not given
+    uint32_t total;
+} sfs_ram_usage_t;
+
 sfs_err_t sfs_init(sfs_t *sfs, sfs_config_t *config);
+sfs_err_t sfs_ram_usage(const sfs_config_t *config, sfs_ram_usage_t *usage);
+sfs_err_t sfs_mount(sfs_t *sfs);
 sfs_err_t sfs_open(sfs_t *sfs, sfs_file_t *file, char *file_name);
-sfs_err_t sfs_write(sfs_t *sfs, sfs_file_t *file, uint8_t *data, uint16_t size);
-sfs_err_t sfs_read_line(sfs_t *sfs, sfs_file_t *file, uint8_t *buffer, uint16_t buffer_size);
+sfs_err_t sfs_open_ex(sfs_t *sfs, sfs_file_t *file, char *file_name, const sfs_file_config_t *config);
+sfs_err_t sfs_write(sfs_t *sfs, sfs_file_t *file, uint8_t *data, uint32_t size);
+sfs_err_t sfs_write_timed(sfs_t *sfs, sfs_file_t *file, uint32_t time, uint8_t *data, uint32_t size);
+sfs_err_t sfs_write_tagged(sfs_t *sfs, sfs_file_t *file, uint8_t tag, uint8_t *data, uint32_t size);
+sfs_err_t sfs_object_begin(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object, uint32_t size);
+sfs_err_t sfs_object_append(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object, const uint8_t *data,
+                            uint32_t size);
+sfs_err_t sfs_object_end(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object);
+sfs_err_t sfs_select_tags(sfs_t *sfs, sfs_file_t *file, uint32_t tags);
+sfs_err_t sfs_read_line(sfs_t *sfs, sfs_file_t *file, uint8_t *buffer, uint32_t buffer_size);
+sfs_err_t sfs_read_record(sfs_t *sfs, sfs_file_t *file, uint8_t *buffer, uint32_t buffer_size,
+                          uint32_t *size);
+sfs_err_t sfs_read_filtered(sfs_t *sfs, sfs_file_t *file, const sfs_filter_t *filter,
+                            uint8_t *buffer, uint32_t buffer_size, uint32_t *size);
+sfs_err_t sfs_object_read_begin(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object);
+sfs_err_t sfs_object_read(sfs_t *sfs, sfs_file_t *file, sfs_object_t *object, uint8_t *buffer,
+                          uint32_t buffer_size, uint32_t *size);
+sfs_err_t sfs_read_line_ptr(sfs_t *sfs, sfs_file_t *file, const uint8_t **data, uint32_t *size);
+sfs_err_t sfs_visit_lines(sfs_t *sfs, sfs_file_t *file, sfs_line_visitor visitor, void *arg,
+                          uint8_t *scratch, uint32_t scratch_size);
+sfs_err_t sfs_tail(sfs_t *sfs, sfs_file_t *reader, sfs_tail_notify notify, void *arg);
+sfs_err_t sfs_compact(sfs_t *sfs, sfs_file_t *file, const sfs_compact_config_t *config);
+sfs_err_t sfs_compact_start(sfs_t *sfs, sfs_file_t *file, const sfs_compact_config_t *config);
+sfs_err_t sfs_seek_sector(sfs_t *sfs, sfs_file_t *file, uint32_t sector);
+sfs_err_t sfs_seek_time(sfs_t *sfs, sfs_file_t *file, uint32_t time);
+sfs_err_t sfs_seek_position(sfs_t *sfs, sfs_file_t *file, uint32_t position);
+sfs_err_t sfs_cursor_save(sfs_t *sfs, sfs_file_t *file, char *cursor_name);
+sfs_err_t sfs_open_at_cursor(sfs_t *sfs, sfs_file_t *file, char *file_name, char *cursor_name);
 sfs_err_t sfs_close(sfs_t *sfs, sfs_file_t *file);
+sfs_err_t sfs_sector_info(sfs_t *sfs, uint32_t sector, sfs_sector_info_t *info);
+sfs_err_t sfs_stat(sfs_t *sfs, char *file_name, sfs_stat_t *info);
+sfs_err_t sfs_opendir(sfs_t *sfs, sfs_dir_t *dir);
+sfs_err_t sfs_readdir(sfs_t *sfs, sfs_dir_t *dir, sfs_stat_t *info);
+sfs_err_t sfs_poll(sfs_t *sfs, bool *pending);
+sfs_err_t sfs_snapshot(sfs_t *sfs);
 
 
 #define SFS_FILE_INIT_DEFAULT() \
@@ -92,9 +481,28 @@ sfs_err_t sfs_close(sfs_t *sfs, sfs_file_t *file);
         .start_address = 0,     \
         .end_address = 0,       \
         .address_pointer = 0,   \
-        .file_descirptor = 0,   \
+        .file_descriptor = 0,   \
+        .read_format = 0,       \
+        .write_format = 0,      \
+        .tail = false,          \
+        .generation = 0,        \
+        .tags = 0,              \
+        .record_index = 0,      \
     }                           \
 
+#define SFS_FILE_CONFIG_DEFAULT() \
+    {                             \
+        .flags = 0,               \
+        .ring_sectors = 0,        \
+        .extent_sectors = 0,      \
+    }                             \
+
 #endif
 
-#define SFS_RETURN_ON_ERR(x) if (x != SFS_OK) return x;
+#define SFS_RETURN_ON_ERR(x) do {                                                    \
+        sfs_err_t sfs_err_ = (x);                                                    \
+        if (sfs_err_ != SFS_OK) {                                                    \
+            if (sfs_err_ != SFS_EOF) SFS_TRACE(SFS_TRACE_ERROR, sfs_err_, __LINE__); \
+            return sfs_err_;                                                         \
+        }                                                                            \
+    } while (0)
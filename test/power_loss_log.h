@@ -0,0 +1,75 @@
+#pragma once
+
+// Ring log written by the power loss test and bench, every record carries
+// its index, so the log read after a crash is checked against acknowledged writes
+
+#include <cstring>
+#include <vector>
+
+extern "C" {
+    #include "sfs/simple_file_system.h"
+}
+
+#define CRASH_RECORD_MAX 256U
+
+// Record i: 4 byte index + payload derived from index
+static inline uint32_t crash_record(uint32_t index, uint8_t *data) {
+    uint32_t size = 4 + (index * 37) % 200 + 1;
+    data[0] = index >> 24;
+    data[1] = index >> 16;
+    data[2] = index >> 8;
+    data[3] = index;
+    for (uint32_t i = 4; i < size; ++i) {
+        data[i] = index * 31 + i;
+    }
+
+    return size;
+}
+
+/**
+ * @brief Read whole log after crash, every record has to be one of the written
+ * ones with its exact content and in order, every acknowledged record from the
+ * first one still in the ring has to be there, write which was not acknowledged
+ * can be missing or complete
+ *
+ * @param sfs
+ * @param file log open at the first record
+ * @param acked result of every write so far
+ * @param records number of records read, can be NULL
+ * @return true if the log matches the writes
+ */
+static inline bool crash_verify(sfs_t *sfs, sfs_file_t *file, const std::vector<bool> &acked,
+                                uint32_t *records) {
+    uint8_t data[CRASH_RECORD_MAX];
+    uint8_t expected[CRASH_RECORD_MAX];
+    uint32_t size = 0;
+    uint32_t count = 0;
+    int64_t last = -1;
+    bool ok = true;
+    sfs_err_t ret;
+    while ((ret = sfs_read_record(sfs, file, data, sizeof(data), &size)) == SFS_OK) {
+        count += 1;
+        uint32_t index = size >= 4 ? (uint32_t) data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3] : 0;
+        if (size < 4 || index >= acked.size() || (int64_t) index <= last ||
+            crash_record(index, expected) != size || memcmp(data, expected, size) != 0) {
+            // Torn, repeated or foreign record
+            ok = false;
+            break;
+        }
+
+        for (int64_t i = last + 1; last >= 0 && i < index; ++i) {
+            ok = ok && acked[i] == false;
+        }
+        last = index;
+    }
+
+    for (int64_t i = last + 1; i < (int64_t) acked.size(); ++i) {
+        ok = ok && acked[i] == false;
+    }
+
+    if (records != NULL) {
+        *records = count;
+    }
+
+    return ok == true && ret == SFS_EOF;
+}
@@ -1,6 +1,12 @@
 #include <gtest/gtest.h>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 #include "sfs_wrapper.h"
+#include "power_loss_log.h"
 
 TEST_F(FlashTest, Open_invalid_file_name) {
     char file_name[MAX_FILE_NAME_SIZE + 2];
@@ -26,7 +32,7 @@ TEST_F(FlashTest, Open_valid_file_name) {
 
     // Check that file was created 
     EXPECT_EQ(true, this->checkFileStartAddress(&file, 0));
-    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, FILE_INFO_SIZE));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, SECTOR_HEADER_SIZE));
     EXPECT_EQ(true, this->checkSectorFileName(0, file_name));
     EXPECT_EQ(true, this->checkSFSNextFreeSector(1));
 }
@@ -69,6 +75,24 @@ TEST_F(FlashTest, Open_previous_created_file) {
     EXPECT_EQ(true, this->checkSFSNextFreeSector(2));
 }
 
+TEST_F(FlashTest, Create_file_scans_flash_once) {
+    char file_name[] = "file1";
+    char file_name2[] = "file2";
+    sfs_file_t file;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+
+    // Free sector is known, it is looked for again only after the new file took it
+    uint32_t sectors = this->file_system->flash_size_bits / this->file_system->flash_sector_bits;
+    (void) this->readCalls();
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name2));
+    uint32_t calls = this->readCalls();
+    EXPECT_LE(calls, sectors + 8);
+    EXPECT_EQ(true, this->checkSFSNextFreeSector(2));
+
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    EXPECT_LE(this->readCalls(), 8);
+}
+
 TEST_F(FlashTest, WearLevel_new_file) {
     char file_name[] = "file2";
     sfs_file_t file;
@@ -77,7 +101,7 @@ TEST_F(FlashTest, WearLevel_new_file) {
     EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
 
     EXPECT_EQ(true, this->checkFileStartAddress(&file, 3));
-    EXPECT_EQ(true, this->checkFileEndAddress(&file, 3, FILE_INFO_SIZE));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 3, SECTOR_HEADER_SIZE));
     EXPECT_EQ(true, this->checkSectorFileName(3, file_name));
     EXPECT_EQ(true, this->checkSFSNextFreeSector(4));
 }
@@ -91,7 +115,7 @@ TEST_F(FlashTest, WearLevel_new_last_sector) {
     EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
 
     EXPECT_EQ(true, this->checkFileStartAddress(&file, 0));
-    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, FILE_INFO_SIZE));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, SECTOR_HEADER_SIZE));
     EXPECT_EQ(true, this->checkSectorFileName(0, file_name));
     EXPECT_EQ(true, this->checkSFSNextFreeSector(1));
 }
@@ -106,7 +130,7 @@ TEST_F(FlashTest, WearLevel_new_last_sector_with_data_in_the_middle_and_end) {
     EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
 
     EXPECT_EQ(true, this->checkFileStartAddress(&file, 0));
-    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, FILE_INFO_SIZE));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, SECTOR_HEADER_SIZE));
     EXPECT_EQ(true, this->checkSectorFileName(0, file_name));
     EXPECT_EQ(true, this->checkSFSNextFreeSector(1));
 }
@@ -118,7 +142,7 @@ TEST_F(FlashTest, Write_to_file) {
 
     uint8_t data[10] = {0x32};
     EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
-    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, FILE_INFO_SIZE + 2 + sizeof(data)));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, SECTOR_HEADER_SIZE + 1 + sizeof(data)));
 }
 
 TEST_F(FlashTest, Reopen_file_with_data) {
@@ -132,7 +156,7 @@ TEST_F(FlashTest, Reopen_file_with_data) {
     EXPECT_EQ(SFS_OK, sfs_close(this->file_system, &file));
     EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
 
-    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, FILE_INFO_SIZE + 2 + sizeof(data)));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, SECTOR_HEADER_SIZE + 1 + sizeof(data)));
 }
 
 TEST_F(FlashTest, Reopen_file_with_data_2) {
@@ -147,15 +171,15 @@ TEST_F(FlashTest, Reopen_file_with_data_2) {
     EXPECT_EQ(SFS_OK, sfs_close(this->file_system, &file));
     EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
 
-    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, FILE_INFO_SIZE + 2*(2 + sizeof(data))));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, SECTOR_HEADER_SIZE + 2*(1 + sizeof(data))));
 }
 
 TEST_F(FlashTest, Write_end_of_sector_edge_case) {
     char file_name[] = "file";
     sfs_file_t file;
     EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
-    uint32_t sector_free_size = this->file_system->flash_sector_bits - FILE_INFO_SIZE;
-    uint32_t data_size = sector_free_size - END_OF_SECTOR_SIZE - DATA_LEN_SIZE;
+    uint32_t sector_free_size = this->file_system->flash_sector_bits - SECTOR_HEADER_SIZE;
+    uint32_t data_size = sector_free_size - END_OF_SECTOR_SIZE - SFS_DATA_LEN_SIZE(sector_free_size);
     // uint8_t data[120] = {0x12};
     uint8_t *data = new uint8_t[data_size];
     (void) memset(data, 0x12, data_size);
@@ -167,7 +191,7 @@ TEST_F(FlashTest, Write_end_of_sector_edge_case) {
     EXPECT_EQ(true, this->checkSectorFileName(0, file_name));
     EXPECT_EQ(true, this->checkSectorFileName(1, file_name));
     EXPECT_EQ(true, this->checkFileStartAddress(&file, 0));
-    EXPECT_EQ(true, this->checkFileEndAddress(&file, 1, FILE_INFO_SIZE + data_size + DATA_LEN_SIZE));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 1, SECTOR_HEADER_SIZE + data_size + SFS_DATA_LEN_SIZE(data_size)));
 
 }
 
@@ -175,8 +199,8 @@ TEST_F(FlashTest, Write_end_of_sector) {
     char file_name[] = "file";
     sfs_file_t file;
     EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
-    uint32_t sector_free_size = this->file_system->flash_sector_bits - FILE_INFO_SIZE;
-    uint32_t data_size = sector_free_size - END_OF_SECTOR_SIZE - DATA_LEN_SIZE - 20;
+    uint32_t sector_free_size = this->file_system->flash_sector_bits - SECTOR_HEADER_SIZE;
+    uint32_t data_size = sector_free_size - END_OF_SECTOR_SIZE - SFS_DATA_LEN_SIZE(sector_free_size) - 20;
     // uint8_t data[120] = {0x12};
     uint8_t *data = new uint8_t[data_size];
     (void) memset(data, 0x12, data_size);
@@ -188,7 +212,8 @@ TEST_F(FlashTest, Write_end_of_sector) {
     EXPECT_EQ(true, this->checkSectorFileName(0, file_name));
     EXPECT_EQ(true, this->checkSectorFileName(1, file_name));
     EXPECT_EQ(true, this->checkFileStartAddress(&file, 0));
-    EXPECT_EQ(true, this->checkFileEndAddress(&file, 1, FILE_INFO_SIZE + data_size - 18 + DATA_LEN_SIZE));
+    // Record spans sectors, rest of data goes right after header
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 1, SECTOR_HEADER_SIZE + data_size - 18));
 }
 
 TEST_F(FlashTest, Read_from_file) {
@@ -248,8 +273,8 @@ TEST_F(FlashTest, Write_from_two_sectors) {
     char file_name[] = "file";
     sfs_file_t file;
     EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
-    uint32_t sector_free_size = this->file_system->flash_sector_bits - FILE_INFO_SIZE;
-    uint32_t data_size = sector_free_size - END_OF_SECTOR_SIZE - DATA_LEN_SIZE - 20;
+    uint32_t sector_free_size = this->file_system->flash_sector_bits - SECTOR_HEADER_SIZE;
+    uint32_t data_size = sector_free_size - END_OF_SECTOR_SIZE - SFS_DATA_LEN_SIZE(sector_free_size) - 20;
     uint8_t *data = new uint8_t[data_size];
     uint8_t *ret = new uint8_t[data_size];
     (void) memset(data, 0x12, data_size);
@@ -261,4 +286,2254 @@ TEST_F(FlashTest, Write_from_two_sectors) {
     EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, ret, data_size));
    
     delete[] data;
-}
\ No newline at end of file
+}
+
+TEST_F(FlashTest, Read_ptr_not_mapped) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+
+    const uint8_t *line;
+    uint32_t line_size;
+    EXPECT_EQ(SFS_NOT_MAPPED, sfs_read_line_ptr(this->file_system, &file, &line, &line_size));
+}
+
+TEST_F(FlashTest, Read_ptr_from_mapped_flash) {
+    this->enableMemoryMap();
+    char file_name[] = "file";
+    sfs_file_t file;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+
+    uint8_t data[] = "Hello I am under the water\n";
+    uint8_t data2[] = "Please Help Me :0\n";
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data2, sizeof(data2)));
+
+    const uint8_t *line;
+    uint32_t line_size;
+    EXPECT_EQ(SFS_OK, sfs_read_line_ptr(this->file_system, &file, &line, &line_size));
+    EXPECT_EQ(sizeof(data), line_size);
+    EXPECT_EQ(true, this->arrayEqual(data, (uint8_t*)line, sizeof(data)));
+    // Pointer goes directly into flash
+    EXPECT_EQ(this->memory->memory + SECTOR_HEADER_SIZE + 1, line);
+
+    EXPECT_EQ(SFS_OK, sfs_read_line_ptr(this->file_system, &file, &line, &line_size));
+    EXPECT_EQ(sizeof(data2), line_size);
+    EXPECT_EQ(true, this->arrayEqual(data2, (uint8_t*)line, sizeof(data2)));
+    EXPECT_EQ(SFS_EOF, sfs_read_line_ptr(this->file_system, &file, &line, &line_size));
+}
+
+static bool count_lines(const uint8_t *data, uint32_t size, void *arg) {
+    (void) data;
+    (void) size;
+    *(int*)arg += 1;
+    return true;
+}
+
+TEST_F(FlashTest, Visit_lines_from_two_sectors) {
+    this->enableMemoryMap();
+    char file_name[] = "file";
+    sfs_file_t file;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    uint32_t sector_free_size = this->file_system->flash_sector_bits - SECTOR_HEADER_SIZE;
+    uint32_t data_size = sector_free_size - END_OF_SECTOR_SIZE - SFS_DATA_LEN_SIZE(sector_free_size) - 20;
+    uint8_t *data = new uint8_t[data_size];
+    (void) memset(data, 0x12, data_size);
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, data_size));
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, data_size));
+
+    // Second line spans sectors and is visited from scratch
+    int lines = 0;
+    EXPECT_EQ(SFS_OK, sfs_visit_lines(this->file_system, &file, count_lines, &lines, data, data_size));
+    EXPECT_EQ(2, lines);
+
+    EXPECT_EQ(SFS_OK, sfs_seek_position(this->file_system, &file, 0));
+    EXPECT_EQ(SFS_NOT_CONTIGUOUS, sfs_visit_lines(this->file_system, &file, count_lines, &lines, NULL, 0));
+    EXPECT_EQ(3, lines);
+    EXPECT_EQ(SFS_BUFFER_SIZE, sfs_visit_lines(this->file_system, &file, count_lines, &lines, data, 20));
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, data_size));
+    delete[] data;
+}
+
+TEST_F(FlashTest, Reopen_file_with_mapped_flash) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+
+    uint8_t data[10] = {0x32};
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    EXPECT_EQ(SFS_OK, sfs_close(this->file_system, &file));
+
+    this->enableMemoryMap();
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, SECTOR_HEADER_SIZE + 1 + sizeof(data)));
+    EXPECT_EQ(true, this->checkSFSNextFreeSector(1));
+}
+
+TEST_F(FlashTest, Write_data_len_sizes) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+
+    // Length grows from 1 to 2 bytes at 64 and to 4 bytes at 8192
+    uint32_t sizes[] = {1, 63, 64, 8191, 8192, 70000};
+    EXPECT_EQ(1U, SFS_DATA_LEN_SIZE(63U));
+    EXPECT_EQ(2U, SFS_DATA_LEN_SIZE(64U));
+    EXPECT_EQ(2U, SFS_DATA_LEN_SIZE(8191U));
+    EXPECT_EQ(4U, SFS_DATA_LEN_SIZE(8192U));
+    uint8_t *data = new uint8_t[70000];
+    uint8_t *ret = new uint8_t[70000];
+    for (uint32_t i = 0; i < 70000; ++i) {
+        data[i] = i % 251;
+    }
+
+    for (uint32_t size : sizes) {
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, size));
+    }
+
+    for (uint32_t size : sizes) {
+        uint32_t read_size = 0;
+        EXPECT_EQ(SFS_OK, sfs_read_record(this->file_system, &file, ret, 70000, &read_size));
+        EXPECT_EQ(size, read_size);
+        EXPECT_EQ(true, this->arrayEqual(data, ret, size));
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &file, ret, 70000));
+
+    delete[] data;
+    delete[] ret;
+}
+
+TEST_F(FlashTest, Write_small_record_overhead) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+
+    uint8_t data[60] = {0x21};
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 0, SECTOR_HEADER_SIZE + 1 + sizeof(data)));
+    EXPECT_EQ(SFS_DATA_SIZE_ZERO, sfs_write(this->file_system, &file, data, 0));
+}
+
+TEST_F(FlashTest, Write_large_record_reopen) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+
+    uint32_t capacity = this->file_system->flash_sector_bits - SECTOR_HEADER_SIZE - END_OF_SECTOR_SIZE;
+    uint32_t data_size = 3 * capacity;
+    uint8_t *data = new uint8_t[data_size];
+    (void) memset(data, 0x43, data_size);
+    uint8_t small[10] = {0x11};
+
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, data_size));
+    EXPECT_EQ(SFS_OK, sfs_close(this->file_system, &file));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+
+    // Last sector holds only continuation of the large record
+    uint32_t in_last_sector = data_size - (capacity - SFS_DATA_LEN_SIZE(data_size)) - 2 * capacity;
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 3, SECTOR_HEADER_SIZE + in_last_sector));
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, small, sizeof(small)));
+
+    uint32_t size = 0;
+    EXPECT_EQ(SFS_BUFFER_SIZE, sfs_read_record(this->file_system, &file, small, sizeof(small), &size));
+    EXPECT_EQ(data_size, size);
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, data_size));
+    EXPECT_EQ(SFS_OK, sfs_read_record(this->file_system, &file, small, sizeof(small), &size));
+    EXPECT_EQ(sizeof(small), size);
+    delete[] data;
+}
+
+TEST_F(FlashTest, Write_padding_at_end_of_sector) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+
+    // Leave one byte in sector, not enough for length and data
+    uint32_t data_size = this->file_system->flash_sector_bits - SECTOR_HEADER_SIZE -
+                         END_OF_SECTOR_SIZE - 2 - 1;
+    uint8_t *data = new uint8_t[data_size];
+    (void) memset(data, 0x43, data_size);
+    uint8_t small[10] = {0x11};
+
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, data_size));
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, small, sizeof(small)));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 1, SECTOR_HEADER_SIZE + 1 + sizeof(small)));
+
+    uint32_t size = 0;
+    EXPECT_EQ(SFS_OK, sfs_read_record(this->file_system, &file, data, data_size, &size));
+    EXPECT_EQ(data_size, size);
+    EXPECT_EQ(SFS_OK, sfs_read_record(this->file_system, &file, data, data_size, &size));
+    EXPECT_EQ(sizeof(small), size);
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &file, data, data_size));
+    delete[] data;
+}
+
+TEST_F(FlashTest, Read_legacy_file) {
+    char file_name[] = "old";
+    uint32_t sector_size = this->file_system->flash_sector_bits;
+    EXPECT_EQ(true, this->writeLegacySectorHeader(0, file_name));
+    EXPECT_EQ(true, this->write2Bytes(0, FILE_INFO_SIZE, 3));
+    EXPECT_EQ(true, this->setMemory(0, FILE_INFO_SIZE + 2, 0x31, 3));
+    EXPECT_EQ(true, this->write2Bytes(0, sector_size - LEGACY_END_OF_SECTOR_SIZE, 1));
+    EXPECT_EQ(true, this->writeLegacySectorHeader(1, file_name));
+    EXPECT_EQ(true, this->write2Bytes(1, FILE_INFO_SIZE, 2));
+    EXPECT_EQ(true, this->setMemory(1, FILE_INFO_SIZE + 2, 0x32, 2));
+
+    sfs_file_t file;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 1, FILE_INFO_SIZE + 2 + 2));
+
+    uint8_t buffer[10];
+    uint32_t size = 0;
+    EXPECT_EQ(SFS_OK, sfs_read_record(this->file_system, &file, buffer, sizeof(buffer), &size));
+    EXPECT_EQ(3, size);
+    EXPECT_EQ(0x31, buffer[0]);
+    EXPECT_EQ(SFS_OK, sfs_read_record(this->file_system, &file, buffer, sizeof(buffer), &size));
+    EXPECT_EQ(2, size);
+    EXPECT_EQ(0x32, buffer[0]);
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &file, buffer, sizeof(buffer)));
+}
+
+TEST_F(FlashTest, Append_to_legacy_file) {
+    char file_name[] = "old";
+    EXPECT_EQ(true, this->writeLegacySectorHeader(0, file_name));
+    EXPECT_EQ(true, this->write2Bytes(0, FILE_INFO_SIZE, 3));
+    EXPECT_EQ(true, this->setMemory(0, FILE_INFO_SIZE + 2, 0x31, 3));
+
+    sfs_file_t file;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    uint8_t data[5] = {0x33};
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+
+    // Legacy sector is closed, new data goes to new format sector
+    EXPECT_EQ(true, this->checkSectorFileName(1, file_name));
+    EXPECT_EQ(true, this->checkFileEndAddress(&file, 1, SECTOR_HEADER_SIZE + 1 + sizeof(data)));
+
+    uint8_t buffer[10];
+    uint32_t size = 0;
+    EXPECT_EQ(SFS_OK, sfs_read_record(this->file_system, &file, buffer, sizeof(buffer), &size));
+    EXPECT_EQ(3, size);
+    EXPECT_EQ(SFS_OK, sfs_read_record(this->file_system, &file, buffer, sizeof(buffer), &size));
+    EXPECT_EQ(sizeof(data), size);
+    EXPECT_EQ(0x33, buffer[0]);
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &file, buffer, sizeof(buffer)));
+}
+
+TEST_F(FlashTest, Open_no_create) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    sfs_file_config_t cfg = {};
+    cfg.flags = SFS_OPEN_NO_CREATE;
+
+    EXPECT_EQ(SFS_FILE_NOT_FOUND, sfs_open_ex(this->file_system, &file, file_name, &cfg));
+    EXPECT_EQ(false, this->checkSectorFileName(0, file_name));
+
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    EXPECT_EQ(SFS_OK, sfs_close(this->file_system, &file));
+    EXPECT_EQ(SFS_OK, sfs_open_ex(this->file_system, &file, file_name, &cfg));
+    EXPECT_EQ(true, this->checkFileStartAddress(&file, 0));
+}
+
+TEST_F(FlashTest, Stat_file) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    sfs_stat_t info;
+    EXPECT_EQ(SFS_FILE_NOT_FOUND, sfs_stat(this->file_system, file_name, &info));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+
+    uint8_t data[1000] = {0x12};
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, file_name, &info));
+    EXPECT_STREQ(file_name, info.name);
+    EXPECT_EQ(10 * sizeof(data), info.size);
+    EXPECT_EQ(10, info.records);
+    EXPECT_EQ(3, info.sectors);
+    EXPECT_EQ(0, info.first_sector);
+    EXPECT_EQ(2, info.last_sector);
+    EXPECT_EQ(0, info.created);
+
+    // Closed sectors are summarized in headers, stat is the same after mount
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    sfs_stat_t mounted_info;
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, file_name, &mounted_info));
+    EXPECT_EQ(0, memcmp(&info, &mounted_info, sizeof(info)));
+
+    // Writing after mount continues at the same place
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    uint32_t end_address = file.end_address;
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, 10));
+    EXPECT_EQ(end_address + 11, file.end_address);
+}
+
+TEST_F(FlashTest, Stat_file_wrapped_around_flash) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    sfs_stat_t info;
+    uint32_t nb_of_sectors = this->file_system->flash_size_bits / this->file_system->flash_sector_bits;
+    EXPECT_EQ(true, this->setMemory(nb_of_sectors - 3, 0, 12, 10));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+
+    uint8_t data[1000] = {0x12};
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, file_name, &info));
+    EXPECT_EQ(nb_of_sectors - 2, info.first_sector);
+    EXPECT_EQ(0, info.last_sector);
+    EXPECT_EQ(10, info.records);
+
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    EXPECT_EQ(true, this->checkFileStartAddress(&file, nb_of_sectors - 2));
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+}
+
+TEST_F(FlashTest, Read_dir) {
+    char file_name[] = "file1";
+    char file_name2[] = "file2";
+    sfs_file_t file;
+    sfs_file_t file2;
+    uint8_t data[10] = {0x12};
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file2, file_name2));
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file2, data, sizeof(data)));
+
+    // Remount, directory has to keep creation order
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+
+    sfs_dir_t dir;
+    sfs_stat_t info;
+    EXPECT_EQ(SFS_OK, sfs_opendir(this->file_system, &dir));
+    EXPECT_EQ(SFS_OK, sfs_readdir(this->file_system, &dir, &info));
+    EXPECT_STREQ(file_name, info.name);
+    EXPECT_EQ(0, info.size);
+    EXPECT_EQ(0, info.created);
+    EXPECT_EQ(SFS_OK, sfs_readdir(this->file_system, &dir, &info));
+    EXPECT_STREQ(file_name2, info.name);
+    EXPECT_EQ(sizeof(data), info.size);
+    EXPECT_EQ(1, info.records);
+    EXPECT_EQ(1, info.created);
+    EXPECT_EQ(SFS_EOF, sfs_readdir(this->file_system, &dir, &info));
+}
+
+TEST_F(FlashTest, Ring_file_keeps_last_sectors) {
+    char file_name[] = "ring";
+    sfs_file_t file;
+    sfs_stat_t info;
+    sfs_file_config_t cfg = {};
+    cfg.ring_sectors = 3;
+    EXPECT_EQ(SFS_OK, sfs_open_ex(this->file_system, &file, file_name, &cfg));
+
+    uint8_t data[1000] = {0};
+    uint32_t records = 40;
+    for (uint32_t i = 0; i < records; ++i) {
+        data[0] = (uint8_t) i;
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, file_name, &info));
+    EXPECT_EQ(3, info.sectors);
+    uint32_t kept = info.records;
+    EXPECT_LT(kept, records);
+
+    // Ring budget has to survive remount
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, file_name, &info));
+    EXPECT_EQ(3, info.sectors);
+    EXPECT_EQ(kept, info.records);
+
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    for (uint32_t i = records - kept; i < records; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+        EXPECT_EQ((uint8_t) i, data[0]);
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+
+    for (uint32_t i = 0; i < 10; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, file_name, &info));
+    EXPECT_EQ(3, info.sectors);
+}
+
+TEST_F(FlashTest, Ring_file_reuses_sectors_when_flash_full) {
+    char file_name[] = "ring";
+    sfs_file_t file;
+    sfs_stat_t info;
+    sfs_file_config_t cfg = {};
+    cfg.ring_sectors = 0xFFFF;
+    uint32_t nb_of_sectors = this->file_system->flash_size_bits / this->file_system->flash_sector_bits;
+    for (uint32_t sector = 2; sector < nb_of_sectors; ++sector) {
+        EXPECT_EQ(true, this->setMemory(sector, 0, 0, 1));
+    }
+
+    EXPECT_EQ(SFS_OK, sfs_open_ex(this->file_system, &file, file_name, &cfg));
+    uint8_t data[1000] = {0x12};
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, file_name, &info));
+    EXPECT_EQ(2, info.sectors);
+
+    // Regular file can not take sectors from ring
+    char other_name[] = "other";
+    sfs_file_t other;
+    EXPECT_EQ(SFS_FLASH_FULL, sfs_open(this->file_system, &other, other_name));
+}
+
+TEST_F(FlashTest, Extent_keeps_file_sectors_contiguous) {
+    char file_name[] = "file1";
+    char file_name2[] = "file2";
+    sfs_file_t file;
+    sfs_file_t file2;
+    sfs_stat_t info;
+    sfs_file_config_t cfg = {};
+    cfg.extent_sectors = 8;
+    EXPECT_EQ(SFS_OK, sfs_open_ex(this->file_system, &file, file_name, &cfg));
+    EXPECT_EQ(SFS_OK, sfs_open_ex(this->file_system, &file2, file_name2, &cfg));
+    EXPECT_EQ(true, this->checkFileStartAddress(&file, 0));
+    EXPECT_EQ(true, this->checkFileStartAddress(&file2, 8));
+    EXPECT_EQ(true, this->checkSFSNextFreeSector(16));
+
+    // Interleaved writes, each file stays in its own extent
+    uint8_t data[1000] = {0x12};
+    for (int i = 0; i < 12; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file2, data, sizeof(data)));
+    }
+
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, file_name, &info));
+    EXPECT_EQ(0, info.first_sector);
+    EXPECT_EQ(info.sectors - 1, info.last_sector);
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, file_name2, &info));
+    EXPECT_EQ(8, info.first_sector);
+    EXPECT_EQ(8 + info.sectors - 1, info.last_sector);
+
+    // Reservation survives remount, new file goes after both extents
+    char file_name3[] = "file3";
+    sfs_file_t file3;
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file3, file_name3));
+    EXPECT_EQ(true, this->checkFileStartAddress(&file3, 16));
+
+    // Used up extent is followed by a new one
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    for (int i = 0; i < 30; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, file_name, &info));
+    EXPECT_EQ(17 + info.sectors - 9, info.last_sector);
+}
+
+TEST_F(FlashTest, Burst_read_of_contiguous_sectors) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    sfs_file_config_t cfg = {};
+    cfg.extent_sectors = 8;
+    EXPECT_EQ(SFS_OK, sfs_open_ex(this->file_system, &file, file_name, &cfg));
+
+    uint8_t data[100] = {0};
+    for (int i = 0; i < 200; ++i) {
+        data[0] = (uint8_t) i;
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+
+    static uint8_t burst[16 * 1024];
+    this->enableBurstRead(burst, sizeof(burst));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    (void) this->readCalls();
+    for (int i = 0; i < 200; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+        EXPECT_EQ((uint8_t) i, data[0]);
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+
+    // 20 kB of records in 6 sectors, a few windows instead of a read per record
+    EXPECT_LE(this->readCalls(), 4);
+}
+
+TEST_F(FlashTest, Seek_time_skips_sectors) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    uint8_t data[100] = {0};
+    uint32_t size;
+    sfs_file_config_t config = {};
+    config.flags = SFS_OPEN_TIMED;
+    EXPECT_EQ(SFS_OK, sfs_open_ex(this->file_system, &file, file_name, &config));
+    for (uint32_t i = 0; i < 500; ++i) {
+        data[0] = (uint8_t) i;
+        EXPECT_EQ(SFS_OK, sfs_write_timed(this->file_system, &file, i * 10, data, sizeof(data)));
+    }
+
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    (void) this->readCalls();
+    EXPECT_EQ(SFS_OK, sfs_seek_time(this->file_system, &file, 4005));
+    EXPECT_LT(this->readCalls(), 100);
+
+    uint8_t record[SFS_TIME_SIZE + sizeof(data)];
+    EXPECT_EQ(SFS_OK, sfs_read_record(this->file_system, &file, record, sizeof(record), &size));
+    EXPECT_EQ(sizeof(record), size);
+    EXPECT_EQ(4010, (record[0] << 24) | (record[1] << 16) | (record[2] << 8) | record[3]);
+    EXPECT_EQ(401 % 256, record[SFS_TIME_SIZE]);
+
+    // Records of the open sector are found by scan
+    EXPECT_EQ(SFS_OK, sfs_seek_time(this->file_system, &file, 4990));
+    EXPECT_EQ(SFS_OK, sfs_read_record(this->file_system, &file, record, sizeof(record), &size));
+    EXPECT_EQ(499 % 256, record[SFS_TIME_SIZE]);
+    EXPECT_EQ(SFS_EOF, sfs_read_record(this->file_system, &file, record, sizeof(record), &size));
+
+    EXPECT_EQ(SFS_EOF, sfs_seek_time(this->file_system, &file, 5000));
+    EXPECT_EQ(SFS_EOF, sfs_read_record(this->file_system, &file, record, sizeof(record), &size));
+
+    EXPECT_EQ(SFS_OK, sfs_seek_time(this->file_system, &file, 0));
+    EXPECT_EQ(SFS_OK, sfs_read_record(this->file_system, &file, record, sizeof(record), &size));
+    EXPECT_EQ(0, record[SFS_TIME_SIZE]);
+}
+
+TEST_F(FlashTest, Timed_file_takes_only_timed_records) {
+    char timed_name[] = "timed";
+    char plain_name[] = "plain";
+    sfs_file_t timed;
+    sfs_file_t plain;
+    uint8_t data[10] = {0};
+    sfs_file_config_t config = {};
+    config.flags = SFS_OPEN_TIMED;
+    EXPECT_EQ(SFS_OK, sfs_open_ex(this->file_system, &timed, timed_name, &config));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &plain, plain_name));
+    EXPECT_EQ(SFS_OK, sfs_write_timed(this->file_system, &timed, 1, data, sizeof(data)));
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &plain, data, sizeof(data)));
+
+    // Plain record would be read as timestamp by seek
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_write(this->file_system, &timed, data, sizeof(data)));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_write_timed(this->file_system, &plain, 1, data, sizeof(data)));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_seek_time(this->file_system, &plain, 0));
+
+    // Kind is kept in sector headers
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_open_ex(this->file_system, &plain, plain_name, &config));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &timed, timed_name));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_write(this->file_system, &timed, data, sizeof(data)));
+    EXPECT_EQ(SFS_OK, sfs_seek_time(this->file_system, &timed, 0));
+    sfs_stat_t info;
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, timed_name, &info));
+    EXPECT_EQ((uint32_t) SFS_OPEN_TIMED, info.kind);
+    EXPECT_EQ(1U, info.records);
+}
+
+#ifdef SFS_TRACE_ON
+TEST_F(FlashTest, Trace_records_rollover) {
+    char file_name[] = "file";
+    sfs_file_t file;
+    uint8_t data[1000] = {0x12};
+    sfs_trace_reset();
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+
+    const sfs_trace_t *trace = sfs_trace_get();
+    EXPECT_EQ(SFS_TRACE_MAGIC, trace->magic);
+    bool rollover = false;
+    for (uint32_t i = 0; i < trace->head && i < SFS_TRACE_ENTRIES; ++i) {
+        const sfs_trace_entry_t *entry = &trace->ring[i];
+        if (entry->event == SFS_TRACE_ROLLOVER) {
+            EXPECT_EQ(0, entry->args[0]);
+            EXPECT_EQ(1, entry->args[1]);
+            rollover = true;
+        }
+    }
+    EXPECT_EQ(true, rollover);
+    EXPECT_STREQ("rollover", sfs_trace_event_name(SFS_TRACE_ROLLOVER));
+}
+#endif
+
+static bool device_erase(void *ctx, uint32_t sector) {
+    return flash_mock_erase_sector((flash_mock_t *) ctx, sector);
+}
+
+static int device_read(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    return flash_mock_read((flash_mock_t *) ctx, address, buffer, size);
+}
+
+static int device_write(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    flash_mock_t *dev = (flash_mock_t *) ctx;
+    return flash_mock_write(dev, address / dev->sector_size_bytes, address % dev->sector_size_bytes,
+                            buffer, size);
+}
+
+static bool device_erase_start(void *ctx, uint32_t sector) {
+    return flash_mock_erase_start((flash_mock_t *) ctx, sector);
+}
+
+static bool device_busy(void *ctx) {
+    return flash_mock_busy((flash_mock_t *) ctx);
+}
+
+static bool device_suspend(void *ctx) {
+    return flash_mock_suspend((flash_mock_t *) ctx);
+}
+
+static bool device_resume(void *ctx) {
+    return flash_mock_resume((flash_mock_t *) ctx);
+}
+
+TEST_F(FlashTest, Stripe_sectors_across_devices) {
+    flash_mock_t chips[2];
+    sfs_device_t devices[2];
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_EQ(true, flash_mock_init(&chips[i], SIZE_8MB, 4));
+        devices[i] = {};
+        devices[i].ctx = &chips[i];
+        devices[i].erase_fnc = device_erase;
+        devices[i].read_fnc = device_read;
+        devices[i].write_fnc = device_write;
+    }
+
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = devices;
+    cfg.device_count = 2;
+    sfs_t sfs;
+    EXPECT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+    EXPECT_EQ(MB_TO_BITS(16), sfs.flash_size_bits);
+
+    char file_name[] = "file";
+    sfs_file_t file;
+    uint8_t data[1000] = {0};
+    EXPECT_EQ(SFS_OK, sfs_open(&sfs, &file, file_name));
+    for (int i = 0; i < 20; ++i) {
+        data[0] = (uint8_t) i;
+        EXPECT_EQ(SFS_OK, sfs_write(&sfs, &file, data, sizeof(data)));
+    }
+
+    // Consecutive sectors of the file alternate between chips
+    uint32_t sector_size = chips[0].sector_size_bytes;
+    for (uint32_t sector = 0; sector < 2; ++sector) {
+        for (int i = 0; i < 2; ++i) {
+            EXPECT_EQ(0, memcmp(&chips[i].memory[sector * sector_size], file_prefix, sizeof(file_prefix)));
+        }
+    }
+
+    static uint8_t burst[3 * 4096];
+    cfg.burst_buffer = burst;
+    cfg.burst_size = sizeof(burst);
+    EXPECT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+    EXPECT_EQ(SFS_OK, sfs_open(&sfs, &file, file_name));
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(&sfs, &file, data, sizeof(data)));
+        EXPECT_EQ(i, data[0]);
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(&sfs, &file, data, sizeof(data)));
+
+    cfg.map_base = chips[0].memory;
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_init(&sfs, &cfg));
+
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_EQ(true, flash_mock_deinit(&chips[i]));
+    }
+}
+
+TEST_F(FlashTest, Striped_size_fits_addresses) {
+    sfs_device_t devices[4] = {};
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 2048;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = devices;
+    cfg.device_count = 4;
+    sfs_t sfs;
+    EXPECT_EQ(SFS_INVALID_SIZE, sfs_init(&sfs, &cfg));
+
+    cfg.device_count = 1;
+    cfg.flash_size_mb = 4096;
+    EXPECT_EQ(SFS_INVALID_SIZE, sfs_init(&sfs, &cfg));
+
+    cfg.device_count = 4;
+    cfg.flash_size_mb = 512;
+    EXPECT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+    EXPECT_EQ(MB_TO_BITS(2048U), sfs.flash_size_bits);
+}
+
+/**
+ * @brief Log to ring file on flash with timing model, return worst write latency
+ */
+static uint64_t ring_write_latency(bool io_scheduler) {
+    flash_mock_t chip;
+    EXPECT_EQ(true, flash_mock_init(&chip, SIZE_8MB, 4));
+    chip.timing.program_ns_per_byte = 2700;
+    chip.timing.read_ns_per_byte = 20;
+    chip.timing.erase_ns = 45000000;
+    chip.timing.suspend_ns = 20000;
+    chip.timing.status_ns = 1000;
+
+    sfs_device_t device = {};
+    device.ctx = &chip;
+    device.erase_fnc = device_erase;
+    device.read_fnc = device_read;
+    device.write_fnc = device_write;
+    device.erase_start_fnc = device_erase_start;
+    device.busy_fnc = device_busy;
+    device.suspend_fnc = device_suspend;
+    device.resume_fnc = device_resume;
+
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = &device;
+    cfg.device_count = 1;
+    cfg.io_scheduler = io_scheduler;
+    sfs_t sfs;
+    EXPECT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+
+    char file_name[] = "ring";
+    sfs_file_t file;
+    sfs_file_config_t file_cfg = {};
+    file_cfg.ring_sectors = 3;
+    EXPECT_EQ(SFS_OK, sfs_open_ex(&sfs, &file, file_name, &file_cfg));
+
+    uint8_t data[100] = {0};
+    uint64_t worst = 0;
+    for (int i = 0; i < 400; ++i) {
+        uint64_t start = chip.now_ns;
+        EXPECT_EQ(SFS_OK, sfs_write(&sfs, &file, data, sizeof(data)));
+        if (chip.now_ns - start > worst) {
+            worst = chip.now_ns - start;
+        }
+
+        // Idle time between samples
+        EXPECT_EQ(SFS_OK, sfs_poll(&sfs, NULL));
+        flash_mock_advance(&chip, 2000000);
+    }
+
+    sfs_stat_t info;
+    EXPECT_EQ(SFS_OK, sfs_stat(&sfs, file_name, &info));
+    EXPECT_LE(info.sectors, 3);
+    EXPECT_EQ(true, flash_mock_deinit(&chip));
+
+    return worst;
+}
+
+TEST_F(FlashTest, Scheduler_hides_erase_latency) {
+    uint64_t blocking = ring_write_latency(false);
+    uint64_t scheduled = ring_write_latency(true);
+
+    EXPECT_GE(blocking, 45000000U);
+    EXPECT_LT(scheduled, 2000000U);
+}
+
+TEST_F(FlashTest, Scheduler_scans_free_sectors_in_slices) {
+    flash_mock_t chip;
+    EXPECT_EQ(true, flash_mock_init(&chip, SIZE_8MB, 4));
+    sfs_device_t device = {};
+    device.ctx = &chip;
+    device.erase_fnc = device_erase;
+    device.read_fnc = device_read;
+    device.write_fnc = device_write;
+
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = &device;
+    cfg.device_count = 1;
+    cfg.io_scheduler = true;
+    sfs_t sfs;
+    EXPECT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+
+    char file_name[] = "file";
+    sfs_file_t file;
+    uint8_t data[1000] = {0};
+    EXPECT_EQ(SFS_OK, sfs_open(&sfs, &file, file_name));
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_write(&sfs, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(true, sfs.io_scan_pending);
+
+    bool pending = true;
+    uint32_t polls = 0;
+    while (pending == true) {
+        EXPECT_EQ(SFS_OK, sfs_poll(&sfs, &pending));
+        polls += 1;
+    }
+    EXPECT_EQ(2048 / SFS_IO_SCAN_SLICE, polls);
+    EXPECT_EQ(2, sfs.next_free_sector);
+
+    // Allocation does not wait for sfs_poll
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_write(&sfs, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(SFS_OK, sfs_mount(&sfs));
+    EXPECT_EQ(SFS_OK, sfs_open(&sfs, &file, file_name));
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(&sfs, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(&sfs, &file, data, sizeof(data)));
+    EXPECT_EQ(true, flash_mock_deinit(&chip));
+}
+
+TEST_F(FlashTest, Arena_budget_for_free_map_and_burst) {
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.erase_fnc = this->file_system->erase_fnc;
+    cfg.read_fnc = this->file_system->read_fnc;
+    cfg.write_fnc = this->file_system->write_fnc;
+    cfg.burst_size = 8192;
+
+    sfs_ram_usage_t usage;
+    EXPECT_EQ(SFS_OK, sfs_ram_usage(&cfg, &usage));
+    EXPECT_EQ(2048 / 8, usage.free_map);
+    EXPECT_EQ(2048 * 4 + 2048, usage.chain_index);
+    EXPECT_EQ(8192, usage.burst);
+    EXPECT_EQ(256 + 10240 + 8192, usage.total);
+
+    // Burst window is shrunk to the space left after free map
+    static uint8_t arena[512];
+    cfg.arena = arena;
+    cfg.arena_size = sizeof(arena);
+    EXPECT_EQ(SFS_OK, sfs_init(this->file_system, &cfg));
+    EXPECT_NE(nullptr, this->file_system->free_map);
+    EXPECT_EQ(nullptr, this->file_system->chain_owner);
+    EXPECT_EQ(256, this->file_system->burst_size);
+
+    char file_name[] = "file";
+    sfs_file_t file;
+    uint8_t data[1000] = {0};
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    (void) this->readCalls();
+    for (int i = 0; i < 10; ++i) {
+        data[0] = (uint8_t) i;
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+    // Rollovers take free sector from bitmap, flash is not scanned
+    EXPECT_LT(this->readCalls(), 20);
+    EXPECT_EQ(true, this->checkSFSNextFreeSector(3));
+
+    // Too small budget, file system scans flash as before
+    cfg.arena_size = 16;
+    EXPECT_EQ(SFS_OK, sfs_init(this->file_system, &cfg));
+    EXPECT_EQ(nullptr, this->file_system->free_map);
+    EXPECT_EQ(16, this->file_system->burst_size);
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(true, this->checkSFSNextFreeSector(5));
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+        EXPECT_EQ(i, data[0]);
+    }
+}
+
+TEST_F(FlashTest, Chain_index_random_access_and_damaged_link) {
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.erase_fnc = this->file_system->erase_fnc;
+    cfg.read_fnc = this->file_system->read_fnc;
+    cfg.write_fnc = this->file_system->write_fnc;
+    static uint8_t arena[12 * 1024];
+    cfg.arena = arena;
+    cfg.arena_size = sizeof(arena);
+    EXPECT_EQ(SFS_OK, sfs_init(this->file_system, &cfg));
+    EXPECT_NE(nullptr, this->file_system->chain_owner);
+
+    char file_name[] = "file";
+    sfs_file_t file;
+    uint8_t data[1000] = {0};
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    for (int i = 0; i < 20; ++i) {
+        data[0] = (uint8_t) i;
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+
+    // Record 12 continues from sector 2, record 13 is the first one which starts in sector 3
+    (void) this->readCalls();
+    EXPECT_EQ(SFS_OK, sfs_seek_position(this->file_system, &file, 3));
+    EXPECT_LT(this->readCalls(), 5);
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+    EXPECT_EQ(13, data[0]);
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_seek_position(this->file_system, &file, 5));
+
+    // Link of sector 1 points back to sector 0, sequence order wins
+    EXPECT_EQ(true, this->setMemory(1, 4096 - END_OF_SECTOR_SIZE, 0x00, END_OF_SECTOR_SIZE));
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+        EXPECT_EQ(i, data[0]);
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+}
+
+static void tail_count(void *arg) {
+    *(uint32_t *) arg += 1;
+}
+
+TEST_F(FlashTest, Tail_reader_follows_writer_in_RAM) {
+    static uint8_t burst[512];
+    this->enableBurstRead(burst, sizeof(burst));
+
+    char file_name[] = "file";
+    sfs_file_t writer;
+    sfs_file_t reader;
+    uint8_t data[10] = {0};
+    uint32_t notified = 0;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &writer, file_name));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &reader, file_name));
+    EXPECT_EQ(SFS_OK, sfs_tail(this->file_system, &reader, tail_count, &notified));
+    for (int i = 0; i < 3; ++i) {
+        data[0] = (uint8_t) i;
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &writer, data, sizeof(data)));
+    }
+    EXPECT_EQ(3, notified);
+
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &reader, data, sizeof(data)));
+        EXPECT_EQ(i, data[0]);
+    }
+
+    // End of file and fresh record come from RAM
+    (void) this->readCalls();
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &reader, data, sizeof(data)));
+    data[0] = 3;
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &writer, data, sizeof(data)));
+    EXPECT_EQ(4, notified);
+    data[0] = 0;
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &reader, data, sizeof(data)));
+    EXPECT_EQ(3, data[0]);
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &reader, data, sizeof(data)));
+    EXPECT_EQ(0, this->readCalls());
+}
+
+struct tail_wait_t {
+    std::mutex lock;
+    std::condition_variable written;
+};
+
+static void tail_wake(void *arg) {
+    static_cast<tail_wait_t *>(arg)->written.notify_one();
+}
+
+TEST_F(FlashTest, Tail_reader_wakes_on_condition_variable) {
+    char file_name[] = "file";
+    sfs_file_t writer;
+    sfs_file_t reader;
+    tail_wait_t wait;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &writer, file_name));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &reader, file_name));
+    EXPECT_EQ(SFS_OK, sfs_tail(this->file_system, &reader, tail_wake, &wait));
+
+    // File system is not reentrant, both tasks hold the lock during calls
+    std::thread logger([this, &writer, &wait]() {
+        uint8_t data[100] = {0};
+        for (int i = 0; i < 100; ++i) {
+            data[0] = (uint8_t) i;
+            std::lock_guard<std::mutex> guard(wait.lock);
+            EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &writer, data, sizeof(data)));
+        }
+    });
+
+    uint8_t data[100];
+    std::unique_lock<std::mutex> guard(wait.lock);
+    for (int i = 0; i < 100; ++i) {
+        sfs_err_t ret;
+        while ((ret = sfs_read_line(this->file_system, &reader, data, sizeof(data))) == SFS_EOF) {
+            wait.written.wait(guard);
+        }
+        EXPECT_EQ(SFS_OK, ret);
+        EXPECT_EQ(i, data[0]);
+    }
+    guard.unlock();
+    logger.join();
+}
+
+static void write_interleaved(sfs_t *sfs, sfs_file_t *a, sfs_file_t *b, int records) {
+    uint8_t data[1000] = {0};
+    for (int i = 0; i < records; ++i) {
+        data[0] = (uint8_t) i;
+        EXPECT_EQ(SFS_OK, sfs_write(sfs, a, data, sizeof(data)));
+        data[0] = (uint8_t) (100 + i);
+        EXPECT_EQ(SFS_OK, sfs_write(sfs, b, data, sizeof(data)));
+    }
+}
+
+TEST_F(FlashTest, Compact_file_into_contiguous_run) {
+    char name_a[] = "a";
+    char name_b[] = "b";
+    sfs_file_t a;
+    sfs_file_t b;
+    sfs_file_t stale;
+    uint8_t data[1000];
+    sfs_stat_t info;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &a, name_a));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &b, name_b));
+    write_interleaved(this->file_system, &a, &b, 16);
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &stale, name_a));
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, name_a, &info));
+    EXPECT_EQ(4, info.sectors);
+    EXPECT_NE(info.sectors, info.last_sector - info.first_sector + 1);
+
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &a, data, sizeof(data)));
+    }
+
+    static uint8_t page[256];
+    sfs_compact_config_t cfg = {};
+    cfg.buffer = page;
+    cfg.buffer_size = sizeof(page);
+    EXPECT_EQ(SFS_OK, sfs_compact(this->file_system, &a, &cfg));
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, name_a, &info));
+    EXPECT_EQ(4, info.sectors);
+    EXPECT_EQ(info.sectors, info.last_sector - info.first_sector + 1);
+
+    // Compacted handle keeps its position and writes after the copy
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &a, data, sizeof(data)));
+    EXPECT_EQ(5, data[0]);
+    data[0] = 16;
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &a, data, sizeof(data)));
+    EXPECT_EQ(SFS_FILE_MOVED, sfs_read_line(this->file_system, &stale, data, sizeof(data)));
+    EXPECT_EQ(SFS_OK, sfs_seek_position(this->file_system, &stale, 0));
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &stale, data, sizeof(data)));
+    EXPECT_EQ(0, data[0]);
+
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &a, name_a));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &b, name_b));
+    for (int i = 0; i < 17; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &a, data, sizeof(data)));
+        EXPECT_EQ(i, data[0]);
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &a, data, sizeof(data)));
+    for (int i = 0; i < 16; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &b, data, sizeof(data)));
+        EXPECT_EQ(100 + i, data[0]);
+    }
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, name_a, &info));
+    EXPECT_EQ(info.sectors, info.last_sector - info.first_sector + 1);
+}
+
+TEST_F(FlashTest, Compact_in_background_survives_interruption) {
+    char name_a[] = "a";
+    char name_b[] = "b";
+    sfs_file_t a;
+    sfs_file_t b;
+    uint8_t data[1000];
+    sfs_stat_t before;
+    sfs_stat_t info;
+    bool pending = false;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &a, name_a));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &b, name_b));
+    write_interleaved(this->file_system, &a, &b, 16);
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, name_a, &before));
+
+    // Power cut before commit, copy is dropped
+    sfs_compact_config_t cfg = {};
+    cfg.slice_bytes = 1024;
+    EXPECT_EQ(SFS_OK, sfs_compact_start(this->file_system, &a, &cfg));
+    for (int i = 0; i < 6; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_poll(this->file_system, &pending));
+    }
+    EXPECT_EQ(true, pending);
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, name_a, &info));
+    EXPECT_EQ(before.first_sector, info.first_sector);
+    EXPECT_EQ(before.sectors, info.sectors);
+
+    // Writer appends during copy, power cut after commit, old sectors are erased by mount
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &a, name_a));
+    EXPECT_EQ(SFS_OK, sfs_compact_start(this->file_system, &a, &cfg));
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_poll(this->file_system, &pending));
+    }
+    data[0] = 16;
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &a, data, sizeof(data)));
+    while (this->file_system->compact_phase == SFS_COMPACT_COPY) {
+        EXPECT_EQ(SFS_OK, sfs_poll(this->file_system, &pending));
+    }
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, name_a, &info));
+    EXPECT_EQ(info.sectors, info.last_sector - info.first_sector + 1);
+    EXPECT_EQ(true, this->checkSectorFileName(before.first_sector, name_a) == false);
+
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &a, name_a));
+    for (int i = 0; i < 17; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &a, data, sizeof(data)));
+        EXPECT_EQ(i, data[0]);
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &a, data, sizeof(data)));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &b, name_b));
+    for (int i = 0; i < 16; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &b, data, sizeof(data)));
+        EXPECT_EQ(100 + i, data[0]);
+    }
+}
+
+TEST_F(FlashTest, Scan_kernels_at_unaligned_offsets) {
+    uint8_t buffer[300];
+    for (size_t offset = 0; offset < 8; ++offset) {
+        for (size_t size = 0; size + offset <= sizeof(buffer); size += 37) {
+            uint8_t *data = &buffer[offset];
+            memset(buffer, 0xFF, sizeof(buffer));
+            EXPECT_EQ(size, sfs_scan_not_erased(data, size));
+
+            for (size_t at = 0; at < size; at += 13) {
+                memset(buffer, 0xFF, sizeof(buffer));
+                data[at] = 0xFE;
+                EXPECT_EQ(at, sfs_scan_not_erased(data, size));
+                // Bytes outside of the range are not checked
+                data[at] = 0xFF;
+                if (offset > 0) {
+                    buffer[offset - 1] = 0x00;
+                }
+                buffer[offset + size] = 0x00;
+                EXPECT_EQ(size, sfs_scan_not_erased(data, size));
+            }
+        }
+    }
+
+    uint8_t copy[sizeof(buffer)];
+    memcpy(copy, buffer, sizeof(buffer));
+    EXPECT_EQ(true, sfs_scan_equal(buffer, copy, sizeof(buffer)));
+    copy[sizeof(buffer) - 1] ^= 1;
+    EXPECT_EQ(false, sfs_scan_equal(buffer, copy, sizeof(buffer)));
+    EXPECT_EQ(true, sfs_scan_equal(buffer, copy, sizeof(buffer) - 1));
+
+    // Headers 20 bytes apart starting at odd address, every third matches
+    uint8_t headers[1 + 20 * 19 + SFS_SCAN_PATTERN_MAX] = {0};
+    const uint8_t pattern[] = {0x53, 0x46, 0x01};
+    for (uint32_t i = 0; i < 19; i += 3) {
+        memcpy(&headers[1 + i * 20], pattern, sizeof(pattern));
+    }
+    headers[1 + 20 * 1] = 0x53;
+    headers[1 + 20 * 2 + 1] = 0x46;
+    uint8_t matches[3] = {0xAA, 0xAA, 0xAA};
+    EXPECT_EQ(7U, sfs_scan_headers(&headers[1], 20, 19, pattern, sizeof(pattern), matches));
+    EXPECT_EQ(0x49, matches[0]);
+    EXPECT_EQ(0x92, matches[1]);
+    EXPECT_EQ(0x04, matches[2]);
+    EXPECT_EQ(0U, sfs_scan_headers(&headers[1], 20, 19, pattern, SFS_SCAN_PATTERN_MAX + 1, matches));
+    EXPECT_NE(nullptr, sfs_scan_kernel());
+}
+
+TEST_F(FlashTest, Mount_matches_mapped_sector_headers) {
+    char name_a[] = "a";
+    char name_b[] = "b";
+    sfs_file_t a;
+    sfs_file_t b;
+    uint8_t data[200] = {0};
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &a, name_a));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &b, name_b));
+    for (int i = 0; i < 100; ++i) {
+        data[0] = i;
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, i % 2 == 0 ? &a : &b, data, sizeof(data)));
+    }
+
+    // Foreign data past the files has no header and is not a file sector
+    uint8_t foreign[] = {0x53, 0x00, 0x01};
+    EXPECT_EQ((int) sizeof(foreign), flash_mock_write(this->memory, 100, 0, foreign, sizeof(foreign)));
+
+    sfs_stat_t before_a;
+    sfs_stat_t before_b;
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, name_a, &before_a));
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, name_b, &before_b));
+
+    this->enableMemoryMap();
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    sfs_stat_t info;
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, name_a, &info));
+    EXPECT_EQ(before_a.sectors, info.sectors);
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, name_b, &info));
+    EXPECT_EQ(before_b.sectors, info.sectors);
+
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &b, name_b));
+    for (int i = 1; i < 100; i += 2) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &b, data, sizeof(data)));
+        EXPECT_EQ(i, data[0]);
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &b, data, sizeof(data)));
+}
+
+/**
+ * @brief Read selected records of file, return number of records
+ */
+static int read_tagged(sfs_t *sfs, sfs_file_t *file, uint8_t *data, uint32_t size) {
+    int records = 0;
+    while (sfs_read_line(sfs, file, data, size) == SFS_OK) {
+        records += 1;
+    }
+
+    return records;
+}
+
+TEST_F(FlashTest, Tagged_streams_skip_sectors_without_tag) {
+    char file_name[] = "sensors";
+    sfs_file_t file;
+    uint8_t data[100] = {0};
+    sfs_file_config_t config = {};
+    config.flags = SFS_OPEN_TAGGED;
+    EXPECT_EQ(SFS_OK, sfs_open_ex(this->file_system, &file, file_name, &config));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_write_tagged(this->file_system, &file, SFS_MAX_TAGS, data, sizeof(data)));
+
+    // Seven streams all the time, barometer (tag 7) only for a while
+    for (int i = 0; i < 700; ++i) {
+        data[0] = i & 0xFF;
+        EXPECT_EQ(SFS_OK, sfs_write_tagged(this->file_system, &file, i % 7, data, sizeof(data)));
+        if (i >= 300 && i < 311) {
+            data[0] = i - 300;
+            EXPECT_EQ(SFS_OK, sfs_write_tagged(this->file_system, &file, 7, data, sizeof(data)));
+        }
+    }
+
+    sfs_sector_info_t info;
+    sfs_stat_t stat;
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, file_name, &stat));
+    EXPECT_EQ(SFS_OK, sfs_sector_info(this->file_system, stat.first_sector, &info));
+    EXPECT_EQ(0x7FU, info.tags);
+    EXPECT_EQ(SFS_OK, sfs_sector_info(this->file_system, stat.last_sector, &info));
+    EXPECT_EQ(SFS_UNSET, info.tags);
+
+    uint8_t line[sizeof(data) + SFS_TAG_SIZE];
+    sfs_file_t reader;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &reader, file_name));
+    (void) this->readCalls();
+    EXPECT_EQ(711, read_tagged(this->file_system, &reader, line, sizeof(line)));
+    int all_reads = this->readCalls();
+
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &reader, file_name));
+    EXPECT_EQ(SFS_OK, sfs_select_tags(this->file_system, &reader, SFS_TAG(7)));
+    (void) this->readCalls();
+    for (int i = 0; i < 11; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &reader, line, sizeof(line)));
+        EXPECT_EQ(7, line[0]);
+        EXPECT_EQ(i, line[1]);
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &reader, line, sizeof(line)));
+    EXPECT_LT(this->readCalls() * 4, all_reads);
+
+    // New record of the stream in open sector is found by the same reader
+    data[0] = 11;
+    EXPECT_EQ(SFS_OK, sfs_write_tagged(this->file_system, &file, 7, data, sizeof(data)));
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &reader, line, sizeof(line)));
+    EXPECT_EQ(11, line[1]);
+
+    // Tags of open sector are unknown after mount, its records are checked one by one
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &reader, file_name));
+    EXPECT_EQ(SFS_OK, sfs_select_tags(this->file_system, &reader, SFS_TAG(0) | SFS_TAG(7)));
+    EXPECT_EQ(100 + 12, read_tagged(this->file_system, &reader, line, sizeof(line)));
+    EXPECT_EQ(SFS_OK, sfs_select_tags(this->file_system, &reader, 0));
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &reader, line, sizeof(line)));
+}
+
+TEST_F(FlashTest, Tagged_file_takes_only_tagged_records) {
+    char tagged_name[] = "tagged";
+    char plain_name[] = "plain";
+    sfs_file_t tagged;
+    sfs_file_t plain;
+    uint8_t data[10] = {0};
+    sfs_file_config_t config = {};
+    config.flags = SFS_OPEN_TAGGED;
+    EXPECT_EQ(SFS_OK, sfs_open_ex(this->file_system, &tagged, tagged_name, &config));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &plain, plain_name));
+    EXPECT_EQ(SFS_OK, sfs_write_tagged(this->file_system, &tagged, 3, data, sizeof(data)));
+
+    // First byte of plain record would pass a tag filter
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &plain, data, sizeof(data)));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_write(this->file_system, &tagged, data, sizeof(data)));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_write_tagged(this->file_system, &plain, 0, data, sizeof(data)));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_select_tags(this->file_system, &plain, SFS_TAG(0)));
+    EXPECT_EQ(SFS_OK, sfs_select_tags(this->file_system, &plain, 0));
+
+    config.flags = SFS_OPEN_TIMED;
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_open_ex(this->file_system, &tagged, tagged_name, &config));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &tagged, tagged_name));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_write_timed(this->file_system, &tagged, 1, data, sizeof(data)));
+    EXPECT_EQ(SFS_OK, sfs_select_tags(this->file_system, &tagged, SFS_TAG(3)));
+    uint8_t line[SFS_TAG_SIZE + sizeof(data)];
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &tagged, line, sizeof(line)));
+    EXPECT_EQ(3, line[0]);
+}
+
+static bool odd_payload(const uint8_t *data, uint32_t size, void *arg) {
+    (void) arg;
+    return size > 3 && (data[3] & 1) != 0;
+}
+
+/**
+ * @brief Read every accepted record, return ids of records (first 2 bytes)
+ */
+static std::vector<int> read_filtered_ids(sfs_t *sfs, char *file_name, const sfs_filter_t *filter) {
+    std::vector<int> ids;
+    sfs_file_t file;
+    uint8_t data[32];
+    uint32_t size = 0;
+    EXPECT_EQ(SFS_OK, sfs_open(sfs, &file, file_name));
+    sfs_err_t ret;
+    while ((ret = sfs_read_filtered(sfs, &file, filter, data, sizeof(data), &size)) == SFS_OK) {
+        ids.push_back(data[0] << 8 | data[1]);
+    }
+    EXPECT_EQ(SFS_EOF, ret);
+
+    return ids;
+}
+
+TEST_F(FlashTest, Read_filtered_records) {
+    char file_name[] = "log";
+    sfs_file_t file;
+    uint8_t data[20] = {0};
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    for (int i = 0; i < 1000; ++i) {
+        data[0] = i >> 8;
+        data[1] = i & 0xFF;
+        data[2] = i % 20 == 7 ? 1 : 0;
+        data[3] = i % 3;
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+        if (i == 500) {
+            // Record of other layout breaks block of fixed records
+            data[2] = 1;
+            EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, 5));
+        }
+    }
+
+    sfs_filter_t filter = {};
+    filter.offset = 2;
+    filter.size = 1;
+    filter.op = SFS_MATCH_EQ;
+    filter.value[0] = 1;
+    std::vector<int> expected;
+    for (int i = 7; i < 1000; i += 20) {
+        expected.push_back(i);
+    }
+    expected.insert(expected.begin() + 25, 500);
+    EXPECT_EQ(expected, read_filtered_ids(this->file_system, file_name, &filter));
+
+    // Fixed layout is compared in blocks, from device, burst window and mapped flash
+    filter.record_size = sizeof(data);
+    EXPECT_EQ(expected, read_filtered_ids(this->file_system, file_name, &filter));
+    static uint8_t burst[1024];
+    this->enableBurstRead(burst, sizeof(burst));
+    EXPECT_EQ(expected, read_filtered_ids(this->file_system, file_name, &filter));
+    this->enableBurstRead(nullptr, 0);
+    this->enableMemoryMap();
+    EXPECT_EQ(expected, read_filtered_ids(this->file_system, file_name, &filter));
+
+    filter.offset = 0;
+    filter.size = 2;
+    filter.op = SFS_MATCH_LT;
+    filter.value[0] = 0;
+    filter.value[1] = 3;
+    EXPECT_EQ(std::vector<int>({0, 1, 2}), read_filtered_ids(this->file_system, file_name, &filter));
+    filter.op = SFS_MATCH_GE;
+    filter.value[0] = 999 >> 8;
+    filter.value[1] = 999 & 0xFF;
+    EXPECT_EQ(std::vector<int>({999}), read_filtered_ids(this->file_system, file_name, &filter));
+    filter.size = SFS_MATCH_MAX_SIZE + 1;
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_read_filtered(this->file_system, &file, &filter, data, sizeof(data), nullptr));
+
+    filter.fnc = odd_payload;
+    EXPECT_EQ(333U, read_filtered_ids(this->file_system, file_name, &filter).size());
+
+    // Accepted record which does not fit stays under file pointer
+    filter.fnc = nullptr;
+    filter.offset = 2;
+    filter.size = 1;
+    filter.op = SFS_MATCH_EQ;
+    filter.value[0] = 1;
+    uint32_t size = 0;
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, file_name));
+    EXPECT_EQ(SFS_BUFFER_SIZE, sfs_read_filtered(this->file_system, &file, &filter, data, 10, &size));
+    EXPECT_EQ(sizeof(data), size);
+    EXPECT_EQ(SFS_OK, sfs_read_filtered(this->file_system, &file, &filter, data, sizeof(data), &size));
+    EXPECT_EQ(7, data[1]);
+}
+
+/**
+ * @brief Mount file system on image file, write records of file "log" from first to end
+ */
+static void image_round(const std::string &path, flash_file_mode_t mode, int first, int end) {
+    flash_file_t image;
+    EXPECT_EQ(true, flash_file_open(&image, path.c_str(), mode, first == 0 ? MB_TO_BYTES(1) : 0, 4096));
+
+    sfs_device_t device = {};
+    device.ctx = &image;
+    device.erase_fnc = flash_file_device_erase;
+    device.read_fnc = flash_file_device_read;
+    device.write_fnc = flash_file_device_write;
+
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 1;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = &device;
+    cfg.device_count = 1;
+    sfs_t sfs;
+    EXPECT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+
+    char file_name[] = "log";
+    sfs_file_t file;
+    uint8_t data[100] = {0};
+    EXPECT_EQ(SFS_OK, sfs_open(&sfs, &file, file_name));
+    for (int i = 0; i < end; ++i) {
+        if (i < first) {
+            EXPECT_EQ(SFS_OK, sfs_read_line(&sfs, &file, data, sizeof(data)));
+            EXPECT_EQ(i, data[0]);
+        } else {
+            data[0] = i;
+            EXPECT_EQ(SFS_OK, sfs_write(&sfs, &file, data, sizeof(data)));
+        }
+    }
+    EXPECT_EQ(true, flash_file_close(&image));
+}
+
+TEST_F(FlashTest, Image_file_backend) {
+    std::string path = testing::TempDir() + "sfs_image_file.bin";
+    (void) unlink(path.c_str());
+
+    flash_file_t image;
+    EXPECT_EQ(false, flash_file_open(&image, path.c_str(), FLASH_FILE_MMAP, 0, 4096));
+    for (flash_file_mode_t mode : {FLASH_FILE_MMAP, FLASH_FILE_PREAD}) {
+        EXPECT_EQ(true, flash_file_open(&image, path.c_str(), mode, 2 * 4096, 4096));
+        uint8_t bytes[3] = {0xF0, 0x3C, 0x00};
+        uint8_t read[3];
+        EXPECT_EQ(3, flash_file_write(&image, 4094, bytes, sizeof(bytes)));
+        bytes[0] = 0x0F;
+        EXPECT_EQ(1, flash_file_write(&image, 4094, bytes, 1));
+        EXPECT_EQ(3, flash_file_read(&image, 4094, read, sizeof(read)));
+        EXPECT_EQ(0x00, read[0]);
+        EXPECT_EQ(0x3C, read[1]);
+        EXPECT_EQ(-1, flash_file_read(&image, 2 * 4096 - 1, read, 2));
+        EXPECT_EQ(true, flash_file_erase_sector(&image, 0));
+        EXPECT_EQ(false, flash_file_erase_sector(&image, 2));
+        EXPECT_EQ(true, flash_file_close(&image));
+
+        EXPECT_EQ(true, flash_file_open(&image, path.c_str(), FLASH_FILE_PREAD, 0, 4096));
+        EXPECT_EQ(2U * 4096U, image.memory_size_bytes);
+        EXPECT_EQ(3, flash_file_read(&image, 4094, read, sizeof(read)));
+        EXPECT_EQ(0xFF, read[1]);
+        EXPECT_EQ(0x00, read[2]);
+        EXPECT_EQ(true, flash_file_close(&image));
+        (void) unlink(path.c_str());
+    }
+
+    // Image written in one mode is appended to and read in the other
+    image_round(path, FLASH_FILE_PREAD, 0, 100);
+    image_round(path, FLASH_FILE_MMAP, 100, 200);
+    image_round(path, FLASH_FILE_PREAD, 200, 250);
+
+    EXPECT_EQ(true, flash_file_open(&image, path.c_str(), FLASH_FILE_MMAP, 0, 4096));
+    EXPECT_EQ(0, memcmp(image.memory, file_prefix, sizeof(file_prefix)));
+    EXPECT_EQ(true, flash_file_sync(&image));
+    EXPECT_EQ(true, flash_file_close(&image));
+    (void) unlink(path.c_str());
+}
+
+TEST_F(FlashTest, Recover_after_power_loss) {
+    flash_mock_t chip;
+    EXPECT_EQ(true, flash_mock_init(&chip, SIZE_8MB, 4));
+    sfs_device_t device = {};
+    device.ctx = &chip;
+    device.erase_fnc = device_erase;
+    device.read_fnc = device_read;
+    device.write_fnc = device_write;
+
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = &device;
+    cfg.device_count = 1;
+
+    char file_name[] = "log";
+    sfs_file_config_t file_cfg = {};
+    file_cfg.ring_sectors = 8;
+    std::vector<bool> acked;
+    uint8_t data[CRASH_RECORD_MAX];
+    uint32_t seed = 12345;
+    for (uint32_t crash = 0; crash < 300; ++crash) {
+        flash_mock_power_on(&chip);
+        sfs_t sfs;
+        sfs_file_t file;
+        ASSERT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+        ASSERT_EQ(SFS_OK, sfs_open_ex(&sfs, &file, file_name, &file_cfg));
+        uint32_t records = 0;
+        ASSERT_EQ(true, crash_verify(&sfs, &file, acked, &records)) << "crash " << crash;
+
+        // Dropped records are not counted by summaries either
+        sfs_stat_t info;
+        ASSERT_EQ(SFS_OK, sfs_stat(&sfs, file_name, &info));
+        ASSERT_EQ(records, info.records) << "crash " << crash;
+
+        // Power is lost within the next few sectors, by bytes or by operations,
+        // also while a record continues after rollover
+        seed = seed * 1103515245 + 12345;
+        if (crash % 2 == 0) {
+            flash_mock_cut_power(&chip, seed % 12000, UINT32_MAX, seed);
+        } else {
+            flash_mock_cut_power(&chip, UINT32_MAX, seed % 160, seed);
+        }
+
+        sfs_err_t ret = SFS_OK;
+        while (ret == SFS_OK) {
+            uint32_t index = acked.size();
+            ret = sfs_write(&sfs, &file, data, crash_record(index, data));
+            acked.push_back(ret == SFS_OK);
+        }
+    }
+
+    EXPECT_EQ(true, flash_mock_deinit(&chip));
+}
+
+// Reset, sfs_t is lost, chip and retention RAM are kept, bytes read by mount are returned
+static uint64_t warm_reset(sfs_t *sfs, sfs_config_t *cfg, flash_mock_t *chip, sfs_file_t *files,
+                           char **names, uint32_t count) {
+    uint64_t start = chip->now_ns;
+    EXPECT_EQ(SFS_OK, sfs_init(sfs, cfg));
+    for (uint32_t i = 0; i < count; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_open(sfs, &files[i], names[i]));
+    }
+
+    return chip->now_ns - start;
+}
+
+static void expect_same_files(sfs_t *warm, sfs_t *cold, char **names, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        sfs_stat_t a;
+        sfs_stat_t b;
+        ASSERT_EQ(SFS_OK, sfs_stat(warm, names[i], &a));
+        ASSERT_EQ(SFS_OK, sfs_stat(cold, names[i], &b));
+        EXPECT_EQ(b.records, a.records) << names[i];
+        EXPECT_EQ(b.size, a.size) << names[i];
+        EXPECT_EQ(b.sectors, a.sectors) << names[i];
+        EXPECT_EQ(b.first_sector, a.first_sector) << names[i];
+        EXPECT_EQ(b.last_sector, a.last_sector) << names[i];
+        EXPECT_EQ(b.created, a.created) << names[i];
+    }
+    EXPECT_EQ(cold->next_free_sector, warm->next_free_sector);
+}
+
+TEST_F(FlashTest, Warm_mount_from_retention_ram) {
+    flash_mock_t chip;
+    EXPECT_EQ(true, flash_mock_init(&chip, SIZE_8MB, 4));
+    // Virtual clock counts bytes read
+    chip.timing.read_ns_per_byte = 1;
+    sfs_device_t device = {};
+    device.ctx = &chip;
+    device.erase_fnc = device_erase;
+    device.read_fnc = device_read;
+    device.write_fnc = device_write;
+
+    static sfs_snapshot_t retention[2];
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = &device;
+    cfg.device_count = 1;
+    cfg.retention = (uint8_t *) retention;
+    cfg.retention_size = sizeof(retention) - 1;
+    sfs_t sfs;
+    EXPECT_EQ(SFS_BUFFER_SIZE, sfs_init(&sfs, &cfg));
+    cfg.retention_size = SFS_RETENTION_SIZE;
+    sfs_config_t cold_cfg = cfg;
+    cold_cfg.retention = NULL;
+    cold_cfg.retention_size = 0;
+
+    char name_log[] = "log";
+    char name_ring[] = "ring";
+    char *names[] = {name_log, name_ring};
+    sfs_file_t files[2];
+    sfs_file_config_t ring_cfg = {};
+    ring_cfg.ring_sectors = 4;
+    ASSERT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs, &files[0], name_log));
+    ASSERT_EQ(SFS_OK, sfs_open_ex(&sfs, &files[1], name_ring, &ring_cfg));
+    uint8_t data[CRASH_RECORD_MAX];
+    uint32_t index = 0;
+    for (; index < 200; ++index) {
+        ASSERT_EQ(SFS_OK, sfs_write(&sfs, &files[0], data, crash_record(index, data)));
+        ASSERT_EQ(SFS_OK, sfs_write(&sfs, &files[1], data, crash_record(index, data)));
+    }
+
+    // Records appended after the last saved state are found in the last sector
+    sfs_t warm;
+    sfs_t cold;
+    uint64_t warm_bytes = warm_reset(&warm, &cfg, &chip, files, names, 2);
+    uint64_t cold_bytes = warm_reset(&cold, &cold_cfg, &chip, files, names, 2);
+    expect_same_files(&warm, &cold, names, 2);
+    EXPECT_LT(warm_bytes * 20, cold_bytes);
+    EXPECT_EQ(true, warm.free_sector_valid);
+
+    std::vector<bool> acked(index, true);
+    ASSERT_EQ(true, crash_verify(&warm, &files[0], acked, NULL));
+    for (; index < 260; ++index) {
+        ASSERT_EQ(SFS_OK, sfs_write(&warm, &files[0], data, crash_record(index, data)));
+    }
+    warm_bytes = warm_reset(&sfs, &cfg, &chip, files, names, 2);
+    (void) warm_reset(&cold, &cold_cfg, &chip, files, names, 2);
+    expect_same_files(&sfs, &cold, names, 2);
+    EXPECT_LT(warm_bytes * 20, cold_bytes);
+    acked.resize(index, true);
+    ASSERT_EQ(true, crash_verify(&sfs, &files[0], acked, NULL));
+
+    // State saved before a rollover does not match flash anymore, mount scans
+    sfs_snapshot_t stale[2];
+    (void) memcpy(stale, retention, sizeof(stale));
+    for (uint32_t i = 0; i < 40; ++i) {
+        ASSERT_EQ(SFS_OK, sfs_write(&sfs, &files[0], data, crash_record(index + i, data)));
+    }
+    (void) memcpy(retention, stale, sizeof(stale));
+    warm_bytes = warm_reset(&warm, &cfg, &chip, files, names, 2);
+    cold_bytes = warm_reset(&cold, &cold_cfg, &chip, files, names, 2);
+    expect_same_files(&warm, &cold, names, 2);
+    EXPECT_GE(warm_bytes, cold_bytes);
+
+    // Damaged copy is skipped, the other one is adopted
+    retention[warm.snapshot_generation % 2].dir[0].records += 1;
+    warm_bytes = warm_reset(&sfs, &cfg, &chip, files, names, 2);
+    expect_same_files(&sfs, &cold, names, 2);
+    EXPECT_LT(warm_bytes * 20, cold_bytes);
+
+    retention[0].next_created += 1;
+    retention[1].next_created += 1;
+    warm_bytes = warm_reset(&sfs, &cfg, &chip, files, names, 2);
+    expect_same_files(&sfs, &cold, names, 2);
+    EXPECT_GE(warm_bytes, cold_bytes);
+
+    EXPECT_EQ(true, flash_mock_deinit(&chip));
+}
+
+TEST_F(FlashTest, Warm_mount_after_power_loss) {
+    flash_mock_t chip;
+    EXPECT_EQ(true, flash_mock_init(&chip, SIZE_8MB, 4));
+    sfs_device_t device = {};
+    device.ctx = &chip;
+    device.erase_fnc = device_erase;
+    device.read_fnc = device_read;
+    device.write_fnc = device_write;
+
+    static sfs_snapshot_t retention[2];
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = &device;
+    cfg.device_count = 1;
+    cfg.io_scheduler = true;
+    cfg.retention = (uint8_t *) retention;
+    cfg.retention_size = sizeof(retention);
+
+    // Retention RAM survives the brownout, state saved mid-rollover must not be adopted
+    char file_name[] = "log";
+    sfs_file_config_t file_cfg = {};
+    file_cfg.ring_sectors = 6;
+    std::vector<bool> acked;
+    uint8_t data[CRASH_RECORD_MAX];
+    uint32_t seed = 54321;
+    uint32_t adopted = 0;
+    for (uint32_t crash = 0; crash < 200; ++crash) {
+        flash_mock_power_on(&chip);
+        sfs_t sfs;
+        sfs_file_t file;
+        ASSERT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+        ASSERT_EQ(SFS_OK, sfs_open_ex(&sfs, &file, file_name, &file_cfg));
+        adopted += sfs.free_sector_valid == true;
+        ASSERT_EQ(true, crash_verify(&sfs, &file, acked, NULL)) << "crash " << crash;
+
+        seed = seed * 1103515245 + 12345;
+        if (crash % 2 == 0) {
+            flash_mock_cut_power(&chip, seed % 12000, UINT32_MAX, seed);
+        } else {
+            flash_mock_cut_power(&chip, UINT32_MAX, seed % 160, seed);
+        }
+
+        sfs_err_t ret = SFS_OK;
+        while (ret == SFS_OK) {
+            uint32_t index = acked.size();
+            ret = sfs_write(&sfs, &file, data, crash_record(index, data));
+            acked.push_back(ret == SFS_OK);
+            if (ret == SFS_OK && index % 7 == 0) {
+                ret = sfs_poll(&sfs, NULL);
+            }
+        }
+    }
+    EXPECT_GT(adopted, 100U);
+
+    EXPECT_EQ(true, flash_mock_deinit(&chip));
+}
+
+static bool memory_filled(const uint8_t *memory, uint8_t value, uint32_t size) {
+    for (uint32_t i = 0; i < size; ++i) {
+        if (memory[i] != value) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TEST_F(FlashTest, Partitions_share_chip) {
+    const uint32_t sector_size = 4096;
+    sfs_device_t device = {};
+    device.ctx = this->memory;
+    device.erase_fnc = device_erase;
+    device.read_fnc = device_read;
+    device.write_fnc = device_write;
+
+    // Firmware before, between and after the partitions
+    uint8_t *chip = this->memory->memory;
+    (void) memset(chip, 0x5A, 4 * sector_size);
+    (void) memset(chip + 36 * sector_size, 0x5A, 12 * sector_size);
+    (void) memset(chip + 64 * sector_size, 0x5A, 4 * sector_size);
+
+    sfs_config_t cfg_a = {};
+    cfg_a.flash_size_mb = 16;
+    cfg_a.flash_sector_kb = 4;
+    cfg_a.devices = &device;
+    cfg_a.device_count = 1;
+    cfg_a.partition_offset = 100;
+    sfs_t sfs_a;
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_init(&sfs_a, &cfg_a));
+    cfg_a.partition_offset = 4000 * sector_size;
+    cfg_a.partition_sectors = 200;
+    EXPECT_EQ(SFS_INVALID_SIZE, sfs_init(&sfs_a, &cfg_a));
+    cfg_a.partition_offset = 4 * sector_size;
+    cfg_a.partition_sectors = 32;
+    ASSERT_EQ(SFS_OK, sfs_init(&sfs_a, &cfg_a));
+
+    // Second instance reads through the memory map
+    sfs_config_t cfg_b = cfg_a;
+    cfg_b.map_base = chip;
+    cfg_b.partition_offset = 48 * sector_size;
+    cfg_b.partition_sectors = 16;
+    sfs_t sfs_b;
+    ASSERT_EQ(SFS_OK, sfs_init(&sfs_b, &cfg_b));
+
+    char file_name[] = "log";
+    sfs_file_t file_a;
+    sfs_file_t file_b;
+    sfs_file_config_t ring_cfg = {};
+    ring_cfg.ring_sectors = 8;
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs_a, &file_a, file_name));
+    ASSERT_EQ(SFS_OK, sfs_open_ex(&sfs_b, &file_b, file_name, &ring_cfg));
+    uint8_t data[CRASH_RECORD_MAX];
+    sfs_err_t ret = SFS_OK;
+    uint32_t written = 0;
+    for (; ret == SFS_OK; ++written) {
+        ret = sfs_write(&sfs_a, &file_a, data, crash_record(written, data));
+        ASSERT_EQ(SFS_OK, sfs_write(&sfs_b, &file_b, data, crash_record(written, data)));
+    }
+    EXPECT_EQ(SFS_FLASH_FULL, ret);
+
+    // Each instance sees only its own partition
+    sfs_stat_t info;
+    ASSERT_EQ(SFS_OK, sfs_init(&sfs_a, &cfg_a));
+    ASSERT_EQ(SFS_OK, sfs_stat(&sfs_a, file_name, &info));
+    EXPECT_EQ(32U, info.sectors);
+    EXPECT_EQ(0U, info.first_sector);
+    EXPECT_EQ(31U, info.last_sector);
+    EXPECT_EQ(0, memcmp(chip + 4 * sector_size, file_prefix, sizeof(file_prefix)));
+
+    ASSERT_EQ(SFS_OK, sfs_init(&sfs_b, &cfg_b));
+    ASSERT_EQ(SFS_OK, sfs_stat(&sfs_b, file_name, &info));
+    EXPECT_EQ(8U, info.sectors);
+    EXPECT_LT(info.last_sector, 16U);
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs_b, &file_b, file_name));
+    uint32_t size = 0;
+    uint32_t index = 0;
+    uint8_t expected[256];
+    ASSERT_EQ(SFS_OK, sfs_read_record(&sfs_b, &file_b, data, sizeof(data), &size));
+    index = (uint32_t) data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+    do {
+        ASSERT_EQ(crash_record(index, expected), size);
+        ASSERT_EQ(0, memcmp(expected, data, size));
+        index += 1;
+    } while (sfs_read_record(&sfs_b, &file_b, data, sizeof(data), &size) == SFS_OK);
+    EXPECT_EQ(written, index);
+
+    EXPECT_EQ(true, memory_filled(chip, 0x5A, 4 * sector_size));
+    EXPECT_EQ(true, memory_filled(chip + 36 * sector_size, 0x5A, 12 * sector_size));
+    EXPECT_EQ(true, memory_filled(chip + 64 * sector_size, 0x5A, 4 * sector_size));
+
+    // Striped partition starts at the same address on both chips
+    flash_mock_t chips[2];
+    sfs_device_t devices[2] = {};
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_EQ(true, flash_mock_init(&chips[i], SIZE_8MB, 4));
+        (void) memset(chips[i].memory, 0x5A, 2 * sector_size);
+        devices[i] = device;
+        devices[i].ctx = &chips[i];
+    }
+    sfs_config_t cfg = cfg_a;
+    cfg.flash_size_mb = 8;
+    cfg.devices = devices;
+    cfg.device_count = 2;
+    cfg.partition_offset = 2 * sector_size;
+    cfg.partition_sectors = 7;
+    sfs_t sfs;
+    ASSERT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs, &file_a, file_name));
+    for (ret = SFS_OK, written = 0; ret == SFS_OK; ++written) {
+        ret = sfs_write(&sfs, &file_a, data, crash_record(written, data));
+    }
+    EXPECT_EQ(SFS_FLASH_FULL, ret);
+    ASSERT_EQ(SFS_OK, sfs_stat(&sfs, file_name, &info));
+    EXPECT_EQ(7U, info.sectors);
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_EQ(true, memory_filled(chips[i].memory, 0x5A, 2 * sector_size));
+        EXPECT_EQ(0, memcmp(chips[i].memory + 2 * sector_size, file_prefix, sizeof(file_prefix)));
+    }
+    EXPECT_EQ(true, memory_filled(chips[1].memory + 5 * sector_size, 0xFF, sector_size));
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_EQ(true, flash_mock_deinit(&chips[i]));
+    }
+}
+
+static flash_mock_async_t *async_chips[2];
+
+// Transfers in flight on both chips, sampled at every submit
+static uint32_t async_peak = 0;
+
+static bool async_submit(void *ctx, uint8_t op, uint32_t address, uint8_t *buffer, uint32_t size,
+                         sfs_io_done done, void *arg) {
+    if (flash_mock_async_submit(ctx, op, address, buffer, size, done, arg) == false) {
+        return false;
+    }
+
+    uint32_t in_flight = flash_mock_async_in_flight(async_chips[0]) + flash_mock_async_in_flight(async_chips[1]);
+    async_peak = in_flight > async_peak ? in_flight : async_peak;
+    return true;
+}
+
+TEST_F(FlashTest, Async_backend_overlaps_transfers) {
+    flash_mock_t chips[2];
+    flash_mock_async_t async[2];
+    sfs_device_t devices[2] = {};
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_EQ(true, flash_mock_init(&chips[i], SIZE_8MB, 4));
+        ASSERT_EQ(true, flash_mock_async_start(&async[i], &chips[i], 0));
+        async_chips[i] = &async[i];
+        devices[i].ctx = &async[i];
+        devices[i].erase_fnc = flash_mock_async_erase;
+        devices[i].read_fnc = flash_mock_async_read;
+        devices[i].write_fnc = flash_mock_async_write;
+        devices[i].submit_fnc = async_submit;
+        devices[i].poll_fnc = flash_mock_async_poll;
+    }
+
+    static uint8_t window[4096];
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = devices;
+    cfg.device_count = 2;
+    cfg.burst_buffer = window;
+    cfg.burst_size = sizeof(window);
+    sfs_t sfs;
+    ASSERT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+
+    char name_a[] = "a";
+    char name_b[] = "b";
+    sfs_file_t a;
+    sfs_file_t b;
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs, &a, name_a));
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs, &b, name_b));
+    write_interleaved(&sfs, &a, &b, 16);
+
+    // Next window is read while records of the current one are returned
+    flash_mock_async_set_delay(&async[0], 20);
+    flash_mock_async_set_delay(&async[1], 20);
+    uint8_t data[1000];
+    uint32_t overlapped = 0;
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs, &a, name_a));
+    for (int i = 0; i < 16; ++i) {
+        ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &a, data, sizeof(data)));
+        EXPECT_EQ(i, data[0]);
+        overlapped += flash_mock_async_in_flight(&async[0]) + flash_mock_async_in_flight(&async[1]) > 0;
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(&sfs, &a, data, sizeof(data)));
+    EXPECT_GT(overlapped, 0);
+
+    // Sectors of the copy are on the other chip than their source, programs and reads overlap
+    static uint8_t page[512];
+    sfs_compact_config_t compact = {};
+    compact.buffer = page;
+    compact.buffer_size = sizeof(page);
+    async_peak = 0;
+    EXPECT_EQ(SFS_OK, sfs_compact(&sfs, &b, &compact));
+    EXPECT_GE(async_peak, 2);
+
+    ASSERT_EQ(SFS_OK, sfs_seek_position(&sfs, &b, 0));
+    for (int i = 0; i < 16; ++i) {
+        ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &b, data, sizeof(data)));
+        EXPECT_EQ(100 + i, data[0]);
+        EXPECT_EQ(0, data[999]);
+    }
+    EXPECT_EQ(SFS_EOF, sfs_read_line(&sfs, &b, data, sizeof(data)));
+
+    for (int i = 0; i < 2; ++i) {
+        flash_mock_async_stop(&async[i]);
+        EXPECT_LE(async[i].max_in_flight, FLASH_MOCK_ASYNC_DEPTH);
+        EXPECT_EQ(true, flash_mock_deinit(&chips[i]));
+    }
+}
+
+// Programs of the device, address and size
+static std::vector<std::pair<uint32_t, uint32_t>> object_programs;
+
+static int object_write(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    object_programs.push_back({address, size});
+    return device_write(ctx, address, buffer, size);
+}
+
+static void read_object(sfs_t *sfs, sfs_file_t *file, uint32_t size, uint8_t seed) {
+    sfs_object_t object = {};
+    uint8_t chunk[300];
+    uint32_t read_size;
+    ASSERT_EQ(SFS_OK, sfs_object_read_begin(sfs, file, &object));
+    ASSERT_EQ(size, object.size);
+    for (uint32_t offset = 0; offset < size; offset += read_size) {
+        ASSERT_EQ(SFS_OK, sfs_object_read(sfs, file, &object, chunk, sizeof(chunk), &read_size));
+        ASSERT_GT(read_size, 0);
+        for (uint32_t i = 0; i < read_size; ++i) {
+            ASSERT_EQ((uint8_t) (offset + i + seed), chunk[i]);
+        }
+    }
+    EXPECT_EQ(SFS_EOF, sfs_object_read(sfs, file, &object, chunk, sizeof(chunk), &read_size));
+    EXPECT_EQ(0, read_size);
+}
+
+TEST_F(FlashTest, Stream_large_object) {
+    flash_mock_t chip;
+    ASSERT_EQ(true, flash_mock_init(&chip, SIZE_8MB, 4));
+    sfs_device_t device = {};
+    device.ctx = &chip;
+    device.erase_fnc = device_erase;
+    device.read_fnc = device_read;
+    device.write_fnc = object_write;
+
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = &device;
+    cfg.device_count = 1;
+    sfs_t sfs;
+    ASSERT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+
+    char file_name[] = "image";
+    sfs_file_t file;
+    uint8_t small[10] = {7};
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs, &file, file_name));
+    ASSERT_EQ(SFS_OK, sfs_write(&sfs, &file, small, sizeof(small)));
+
+    // 5 sectors appended 100 bytes at a time through one page
+    static uint8_t page[256];
+    const uint32_t object_size = 20000;
+    sfs_object_t object = {};
+    object.buffer = page;
+    object.buffer_size = sizeof(page);
+    ASSERT_EQ(SFS_OK, sfs_object_begin(&sfs, &file, &object, object_size));
+    object_programs.clear();
+    uint8_t data[3000];
+    for (uint32_t offset = 0; offset < object_size; offset += 100) {
+        for (uint32_t i = 0; i < 100; ++i) {
+            data[i] = (uint8_t) (offset + i);
+        }
+        ASSERT_EQ(SFS_OK, sfs_object_append(&sfs, &file, &object, data, 100));
+    }
+    EXPECT_EQ(SFS_INVALID_SIZE, sfs_object_append(&sfs, &file, &object, data, 1));
+
+    // Every program ends on page boundary or sector data end, headers and links aside
+    uint32_t sector_size = chip.sector_size_bytes;
+    uint32_t data_programs = 0;
+    for (const auto &program : object_programs) {
+        uint32_t end = (program.first + program.second) % sector_size;
+        if (program.first % sector_size >= SECTOR_HEADER_SIZE) {
+            EXPECT_EQ(true, end % sizeof(page) == 0 || end == sector_size - END_OF_SECTOR_SIZE);
+            data_programs += 1;
+        }
+    }
+    EXPECT_LE(data_programs, object_size / sizeof(page) + 6);
+    ASSERT_EQ(SFS_OK, sfs_object_end(&sfs, &file, &object));
+
+    // Without buffer appends are programmed as they come, large ones span sectors
+    object = {};
+    ASSERT_EQ(SFS_OK, sfs_object_begin(&sfs, &file, &object, 3 * sizeof(data)));
+    ASSERT_EQ(SFS_INVALID_SIZE, sfs_object_end(&sfs, &file, &object));
+    for (uint32_t offset = 0; offset < 3 * sizeof(data); offset += sizeof(data)) {
+        for (uint32_t i = 0; i < sizeof(data); ++i) {
+            data[i] = (uint8_t) (offset + i + 1);
+        }
+        ASSERT_EQ(SFS_OK, sfs_object_append(&sfs, &file, &object, data, sizeof(data)));
+    }
+    ASSERT_EQ(SFS_OK, sfs_object_end(&sfs, &file, &object));
+    small[0] = 8;
+    ASSERT_EQ(SFS_OK, sfs_write(&sfs, &file, small, sizeof(small)));
+
+    sfs_stat_t info;
+    ASSERT_EQ(SFS_OK, sfs_stat(&sfs, file_name, &info));
+    EXPECT_EQ(4, info.records);
+
+    // Objects are plain records after mount, read in pieces or skipped
+    ASSERT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs, &file, file_name));
+    ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &file, small, sizeof(small)));
+    EXPECT_EQ(7, small[0]);
+    read_object(&sfs, &file, object_size, 0);
+    read_object(&sfs, &file, 3 * sizeof(data), 1);
+    ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &file, small, sizeof(small)));
+    EXPECT_EQ(8, small[0]);
+    EXPECT_EQ(SFS_EOF, sfs_object_read_begin(&sfs, &file, &object));
+
+    uint32_t read_size;
+    ASSERT_EQ(SFS_OK, sfs_seek_position(&sfs, &file, 0));
+    ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &file, small, sizeof(small)));
+    ASSERT_EQ(SFS_OK, sfs_object_read_begin(&sfs, &file, &object));
+    ASSERT_EQ(SFS_OK, sfs_object_read(&sfs, &file, &object, NULL, object_size, &read_size));
+    EXPECT_EQ(object_size, read_size);
+    read_object(&sfs, &file, 3 * sizeof(data), 1);
+
+    EXPECT_EQ(true, flash_mock_deinit(&chip));
+}
+
+static uint32_t cursor_reads = 0;
+
+static int cursor_read(void *ctx, uint32_t address, uint8_t *buffer, uint32_t size) {
+    cursor_reads += 1;
+    return device_read(ctx, address, buffer, size);
+}
+
+TEST_F(FlashTest, Resume_reading_at_saved_cursor) {
+    flash_mock_t chip;
+    ASSERT_EQ(true, flash_mock_init(&chip, SIZE_8MB, 4));
+    sfs_device_t device = {};
+    device.ctx = &chip;
+    device.erase_fnc = device_erase;
+    device.read_fnc = cursor_read;
+    device.write_fnc = device_write;
+
+    static uint8_t arena[1024];
+    sfs_config_t cfg = {};
+    cfg.flash_size_mb = 8;
+    cfg.flash_sector_kb = 4;
+    cfg.devices = &device;
+    cfg.device_count = 1;
+    cfg.arena = arena;
+    cfg.arena_size = sizeof(arena);
+    sfs_t sfs;
+    ASSERT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+
+    char log_name[] = "log";
+    char cursor_name[] = "dl";
+    sfs_file_t file;
+    uint8_t data[100] = {0};
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs, &file, log_name));
+    for (int i = 0; i < 200; ++i) {
+        data[0] = (uint8_t) i;
+        ASSERT_EQ(SFS_OK, sfs_write(&sfs, &file, data, sizeof(data)));
+    }
+
+    // Without saved cursor reading starts at the first record
+    ASSERT_EQ(SFS_OK, sfs_open_at_cursor(&sfs, &file, log_name, cursor_name));
+    for (int i = 0; i < 150; ++i) {
+        ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &file, data, sizeof(data)));
+        EXPECT_EQ(i, data[0]);
+        // Saves fill the cursor ring several times
+        ASSERT_EQ(SFS_OK, sfs_cursor_save(&sfs, &file, cursor_name));
+    }
+
+    sfs_stat_t info;
+    ASSERT_EQ(SFS_OK, sfs_stat(&sfs, cursor_name, &info));
+    EXPECT_EQ(SFS_CURSOR_SECTORS, info.sectors);
+
+    // After reset the position costs a few reads, replay reads every record before it
+    ASSERT_EQ(SFS_OK, sfs_init(&sfs, &cfg));
+    ASSERT_EQ(SFS_OK, sfs_mount(&sfs));
+    cursor_reads = 0;
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs, &file, log_name));
+    for (int i = 0; i < 150; ++i) {
+        ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &file, data, sizeof(data)));
+    }
+    uint32_t replay_reads = cursor_reads;
+
+    cursor_reads = 0;
+    ASSERT_EQ(SFS_OK, sfs_open_at_cursor(&sfs, &file, log_name, cursor_name));
+    EXPECT_LT(cursor_reads * 10, replay_reads);
+    EXPECT_EQ(150U, file.record_index);
+    ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &file, data, sizeof(data)));
+    EXPECT_EQ(150, data[0]);
+    EXPECT_EQ(151U, file.record_index);
+
+    // Damaged last record, the one saved before it is used
+    ASSERT_EQ(SFS_OK, sfs_stat(&sfs, cursor_name, &info));
+    sfs_file_t cursor;
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs, &cursor, cursor_name));
+    chip.memory[cursor.end_address - 1] ^= 0x01;
+    ASSERT_EQ(SFS_OK, sfs_open_at_cursor(&sfs, &file, log_name, cursor_name));
+    EXPECT_EQ(149U, file.record_index);
+    ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &file, data, sizeof(data)));
+    EXPECT_EQ(149, data[0]);
+
+    // Ring reuses sector of the saved position, reading restarts at the oldest record
+    char ring_name[] = "ring";
+    sfs_file_config_t ring = {};
+    ring.ring_sectors = 2;
+    ASSERT_EQ(SFS_OK, sfs_open_ex(&sfs, &file, ring_name, &ring));
+    for (int i = 0; i < 10; ++i) {
+        data[0] = (uint8_t) i;
+        ASSERT_EQ(SFS_OK, sfs_write(&sfs, &file, data, sizeof(data)));
+    }
+    ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &file, data, sizeof(data)));
+    ASSERT_EQ(SFS_OK, sfs_cursor_save(&sfs, &file, cursor_name));
+    ASSERT_EQ(SFS_OK, sfs_open_at_cursor(&sfs, &file, ring_name, cursor_name));
+    ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &file, data, sizeof(data)));
+    EXPECT_EQ(1, data[0]);
+    EXPECT_EQ(SFS_CURSOR_STALE, sfs_open_at_cursor(&sfs, &file, log_name, cursor_name));
+
+    ASSERT_EQ(SFS_OK, sfs_open(&sfs, &file, ring_name));
+    for (int i = 10; i < 200; ++i) {
+        data[0] = (uint8_t) i;
+        ASSERT_EQ(SFS_OK, sfs_write(&sfs, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(SFS_CURSOR_STALE, sfs_open_at_cursor(&sfs, &file, ring_name, cursor_name));
+    EXPECT_EQ(0U, file.record_index);
+    ASSERT_EQ(SFS_OK, sfs_read_line(&sfs, &file, data, sizeof(data)));
+    EXPECT_GT(data[0], 100);
+
+    EXPECT_EQ(true, flash_mock_deinit(&chip));
+}
+
+TEST_F(FlashTest, Cursor_save_and_resume_read_few_bytes) {
+    char log_name[] = "log";
+    char cursor_name[] = "dl";
+    sfs_file_t file;
+    uint8_t data[100] = {0};
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, log_name));
+    for (int i = 0; i < 200; ++i) {
+        data[0] = (uint8_t) i;
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(SFS_OK, sfs_open_at_cursor(this->file_system, &file, log_name, cursor_name));
+    EXPECT_EQ(SFS_OK, sfs_cursor_save(this->file_system, &file, cursor_name));
+
+    // Free sector is not known after mount, cursors do not scan flash for it
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    (void) this->readCalls();
+    EXPECT_EQ(SFS_OK, sfs_open_at_cursor(this->file_system, &file, log_name, cursor_name));
+    EXPECT_LE(this->readCalls(), 2U);
+    for (int i = 0; i < 50; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+        EXPECT_EQ((uint8_t) i, data[0]);
+    }
+
+    // Sequence number of older sector is in its header
+    (void) this->readCalls();
+    EXPECT_EQ(SFS_OK, sfs_cursor_save(this->file_system, &file, cursor_name));
+    EXPECT_LE(this->readCalls(), 1U);
+    EXPECT_EQ(SFS_OK, sfs_open_at_cursor(this->file_system, &file, log_name, cursor_name));
+    EXPECT_LE(this->readCalls(), 2U);
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+    EXPECT_EQ(50, data[0]);
+
+    // Position in the last sector is saved without reads
+    while (sfs_read_line(this->file_system, &file, data, sizeof(data)) == SFS_OK) {
+    }
+    (void) this->readCalls();
+    EXPECT_EQ(SFS_OK, sfs_cursor_save(this->file_system, &file, cursor_name));
+    EXPECT_EQ(0U, this->readCalls());
+    EXPECT_EQ(SFS_OK, sfs_open_at_cursor(this->file_system, &file, log_name, cursor_name));
+    EXPECT_LE(this->readCalls(), 2U);
+    EXPECT_EQ(200U, file.record_index);
+    EXPECT_EQ(SFS_EOF, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+    EXPECT_EQ(false, this->file_system->free_sector_valid);
+
+    // Writer opened by cursor looks for free sector when it needs one
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(true, this->file_system->free_sector_valid);
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+}
+
+TEST_F(FlashTest, Cursor_name_of_data_file_is_refused) {
+    char log_name[] = "log";
+    char data_name[] = "data";
+    char cursor_name[] = "dl";
+    sfs_file_t file;
+    sfs_file_t other;
+    uint8_t data[100] = {0};
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &other, data_name));
+    EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &other, data, sizeof(data)));
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, log_name));
+    for (int i = 0; i < 10; ++i) {
+        data[0] = (uint8_t) i;
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+
+    // Data files keep their records and ring budget
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_cursor_save(this->file_system, &file, data_name));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_cursor_save(this->file_system, &file, log_name));
+    sfs_stat_t info;
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, data_name, &info));
+    EXPECT_EQ(1U, info.records);
+    EXPECT_EQ(100U, info.size);
+    EXPECT_EQ(0U, info.kind);
+
+    // Cursor file keeps its kind over mount and takes no data records
+    EXPECT_EQ(SFS_OK, sfs_cursor_save(this->file_system, &file, cursor_name));
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_OK, sfs_stat(this->file_system, cursor_name, &info));
+    EXPECT_EQ(SFS_CURSOR_KIND, info.kind);
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &other, cursor_name));
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_write(this->file_system, &other, data, sizeof(data)));
+    EXPECT_EQ(SFS_OK, sfs_open_at_cursor(this->file_system, &file, log_name, cursor_name));
+    EXPECT_EQ(1U, file.record_index);
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+    EXPECT_EQ(1, data[0]);
+    EXPECT_EQ(SFS_INVALID_VALUE, sfs_open_at_cursor(this->file_system, &file, log_name, data_name));
+}
+
+TEST_F(FlashTest, Seek_resets_record_index_of_cursor) {
+    char log_name[] = "log";
+    char cursor_name[] = "dl";
+    sfs_file_t file;
+    uint8_t data[100] = {0};
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, log_name));
+    for (int i = 0; i < 200; ++i) {
+        data[0] = (uint8_t) i;
+        EXPECT_EQ(SFS_OK, sfs_write(this->file_system, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(SFS_OK, sfs_open(this->file_system, &file, log_name));
+    for (int i = 0; i < 60; ++i) {
+        EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+    }
+    EXPECT_EQ(60U, file.record_index);
+
+    // Index counts records from the seek target
+    EXPECT_EQ(SFS_OK, sfs_seek_position(this->file_system, &file, 1));
+    EXPECT_EQ(0U, file.record_index);
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+    uint8_t first = data[0];
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+    EXPECT_EQ(2U, file.record_index);
+    EXPECT_EQ(SFS_OK, sfs_cursor_save(this->file_system, &file, cursor_name));
+
+    EXPECT_EQ(SFS_OK, sfs_mount(this->file_system));
+    EXPECT_EQ(SFS_OK, sfs_open_at_cursor(this->file_system, &file, log_name, cursor_name));
+    EXPECT_EQ(2U, file.record_index);
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+    EXPECT_EQ((uint8_t) (first + 2), data[0]);
+    EXPECT_EQ(3U, file.record_index);
+
+    EXPECT_EQ(SFS_OK, sfs_seek_position(this->file_system, &file, 0));
+    EXPECT_EQ(0U, file.record_index);
+    EXPECT_EQ(SFS_OK, sfs_read_line(this->file_system, &file, data, sizeof(data)));
+    EXPECT_EQ(0, data[0]);
+    EXPECT_EQ(1U, file.record_index);
+}
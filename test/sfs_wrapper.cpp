@@ -3,6 +3,8 @@
 static struct {
     flash_mock_t memory;
     sfs_t file_system;
+    sfs_config_t config;
+    uint32_t read_calls;
 } flash_t;
 
 int sfs_write(uint32_t address, uint8_t *buffer, uint32_t size) {
@@ -12,6 +14,7 @@ int sfs_write(uint32_t address, uint8_t *buffer, uint32_t size) {
 }
 
 int sfs_read(uint32_t address, uint8_t *buffer, uint32_t size) {
+    flash_t.read_calls += 1;
     return flash_mock_read(&flash_t.memory, address, buffer, size);
 }
 
@@ -20,12 +23,24 @@ bool sfs_erase(uint32_t sector) {
 }
 
 static bool mock_init(void) {
-    sfs_config_t cfg;
+    sfs_config_t &cfg = flash_t.config;
     cfg.flash_size_mb = 8;
     cfg.flash_sector_kb = 4;
     cfg.erase_fnc = sfs_erase;
     cfg.read_fnc = sfs_read;
     cfg.write_fnc = sfs_write;
+    cfg.map_base = NULL;
+    cfg.burst_buffer = NULL;
+    cfg.burst_size = 0;
+    cfg.devices = NULL;
+    cfg.device_count = 0;
+    cfg.io_scheduler = false;
+    cfg.arena = NULL;
+    cfg.arena_size = 0;
+    cfg.retention = NULL;
+    cfg.retention_size = 0;
+    cfg.partition_offset = 0;
+    cfg.partition_sectors = 0;
     
     if (flash_mock_init(&flash_t.memory, SIZE_16MB, 4) == false) {
         return false;
@@ -93,6 +108,24 @@ void FlashTest::dump256(uint32_t sector, uint32_t address) {
     std::cout << std::endl;
 }
 
+// Features are configured like in production, file system is mounted again on next use
+void FlashTest::enableMemoryMap() {
+    flash_t.config.map_base = this->memory->memory;
+    EXPECT_EQ(SFS_OK, sfs_init(this->file_system, &flash_t.config));
+}
+
+void FlashTest::enableBurstRead(uint8_t *buffer, uint32_t size) {
+    flash_t.config.burst_buffer = buffer;
+    flash_t.config.burst_size = size;
+    EXPECT_EQ(SFS_OK, sfs_init(this->file_system, &flash_t.config));
+}
+
+uint32_t FlashTest::readCalls() {
+    uint32_t calls = flash_t.read_calls;
+    flash_t.read_calls = 0;
+    return calls;
+}
+
 bool FlashTest::checkSFSNextFreeSector(int32_t sector) {
     return this->file_system->next_free_sector == sector;
 }
@@ -144,6 +177,20 @@ bool FlashTest::write2Bytes(uint32_t sector, uint32_t address, uint16_t data) {
     return true;
 }
 
+bool FlashTest::writeLegacySectorHeader(uint32_t sector, char* file_name) {
+    uint8_t header[FILE_INFO_SIZE];
+    header[0] = 0x53;
+    header[1] = 0x46;
+    header[2] = SFS_FORMAT_LEGACY;
+    (void) memset(&header[FILE_PREFIX_SIZE], FLASH_NO_DATA, MAX_FILE_NAME_SIZE);
+    (void) memcpy(&header[FILE_PREFIX_SIZE], file_name, strlen(file_name));
+    header[FILE_INFO_SIZE - 1] = '\0';
+
+    uint32_t sector_size = this->file_system->flash_sector_bits;
+    (void) memcpy(&this->memory->memory[sector_size * sector], header, sizeof(header));
+
+    return true;
+}
 
 bool FlashTest::arrayEqual(uint8_t *arr1, uint8_t *arr2, size_t size) {
     for (size_t i = 0; i < size; ++i) {
@@ -5,7 +5,10 @@
 
 extern "C" {
     #include "flash_mock/flash_mock.h"
+    #include "flash_mock/flash_mock_async.h"
+    #include "flash_file/flash_file.h"
     #include "sfs/simple_file_system.h"
+    #include "sfs/sfs_scan.h"
 }
 
 class FlashTest: public ::testing::Test {
@@ -18,11 +21,15 @@ class FlashTest: public ::testing::Test {
 
     bool checkSectorFileName(uint32_t sector, char* file_name);
     void dump256(uint32_t sector, uint32_t address);
+    void enableMemoryMap();
+    void enableBurstRead(uint8_t *buffer, uint32_t size);
+    uint32_t readCalls();
     bool checkSFSNextFreeSector(int32_t sector);
     bool checkFileStartAddress(sfs_file_t *file, uint32_t sector);
     bool checkFileEndAddress(sfs_file_t *file, uint32_t sector, uint32_t address);
     bool setMemory(uint32_t sector, uint32_t address, uint8_t val, uint32_t size);
     bool write2Bytes(uint32_t sector, uint32_t address, uint16_t data);
+    bool writeLegacySectorHeader(uint32_t sector, char* file_name);
 
     bool arrayEqual(uint8_t *arr1, uint8_t *arr2, size_t size);
 };